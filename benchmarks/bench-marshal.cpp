@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <ultrabus/Message.hpp>
+#include <ultrabus/MessageParamIterator.hpp>
+#include <ultrabus/fixed_array_view.hpp>
+
+
+//
+// Microbenchmark of marshalling method call arguments.
+//
+// Builds method calls with 5 and 10 arguments, typical for a
+// service API: integers, strings, a boolean, a double and a
+// small array of doubles.
+//
+// Compares the dbus_type path, Message::operator<< and dbus_array,
+// with the compile-time typed Message::write. The cost of creating
+// the message is measured separately and included in both.
+//
+// Then compares reading the first argument, and all arguments, of
+// the 10 argument message with Message::get_args and Message::read,
+// measures walking an array of 1000 structs with a
+// MessageParamIterator, and decoding all arguments with
+// Message::arguments with copied and borrowed strings.
+//
+// Last, a 1 MB byte array is added as a dbus_array, a std::vector
+// and a fixed_array_view, and read back with Message::arguments,
+// as a std::vector and as a fixed_array_view.
+//
+// Usage: bench-marshal [number of messages]
+//
+
+
+namespace ubus = ultrabus;
+using namespace std;
+
+
+//
+// Count heap allocations
+//
+static std::atomic<uint64_t> num_allocs {0};
+
+void* operator new (std::size_t size)
+{
+    ++num_allocs;
+    void* p = malloc (size ? size : 1);
+    if (!p)
+        throw std::bad_alloc ();
+    return p;
+}
+void operator delete (void* p) noexcept
+{
+    free (p);
+}
+void operator delete (void* p, std::size_t) noexcept
+{
+    free (p);
+}
+
+
+struct result_t {
+    double ns_per_msg;
+    double allocs_per_msg;
+};
+
+
+static const std::string service   {"se.ultramarin.bench"};
+static const std::string path      {"/se/ultramarin/bench"};
+static const std::string iface     {"se.ultramarin.bench.Sensor"};
+static const std::string method    {"Report"};
+static const std::string sensor    {"temperature-sensor-1"};
+static const std::string location  {"building-a/floor-3/room-12"};
+static const std::string unit      {"celsius"};
+static const std::vector<double> samples {20.5, 20.6, 20.8, 21.0, 21.1, 21.0, 20.9, 20.7};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+template<typename F>
+static result_t run (unsigned num_msgs, F build)
+{
+    uint64_t allocs = num_allocs;
+    auto t0 = chrono::steady_clock::now ();
+    for (unsigned i=0; i<num_msgs; ++i) {
+        ubus::Message msg (service, path, iface, method);
+        build (msg, i);
+    }
+    auto t1 = chrono::steady_clock::now ();
+    allocs = num_allocs - allocs;
+
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count ();
+    return {(double)ns / num_msgs, (double)allocs / num_msgs};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+template<typename F>
+static result_t run_read (unsigned num_msgs, ubus::Message& msg, F read)
+{
+    uint64_t allocs = num_allocs;
+    auto t0 = chrono::steady_clock::now ();
+    for (unsigned i=0; i<num_msgs; ++i)
+        read (msg);
+    auto t1 = chrono::steady_clock::now ();
+    allocs = num_allocs - allocs;
+
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count ();
+    return {(double)ns / num_msgs, (double)allocs / num_msgs};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void print (const char* name, const result_t& r)
+{
+    cout << name << fixed << setprecision(1) << setw(10) << r.ns_per_msg << " ns/msg, "
+         << setprecision(2) << r.allocs_per_msg << " allocations/msg" << endl;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    unsigned num_msgs = argc > 1 ? (unsigned) atoi(argv[1]) : 200000;
+
+    cout << "Number of messages: " << num_msgs << endl;
+
+    auto empty = run (num_msgs, [](ubus::Message&, unsigned){});
+
+    // 5 arguments: isubs
+    auto stream5 = run (num_msgs, [](ubus::Message& msg, unsigned i) {
+            msg << (int32_t)i << sensor << (uint32_t)(i*3) << true << unit;
+        });
+    auto write5 = run (num_msgs, [](ubus::Message& msg, unsigned i) {
+            msg.write<int32_t, std::string, uint32_t, bool, std::string> (i, sensor, i*3, true, unit);
+        });
+
+    // 10 arguments: isubsdxtsad
+    auto stream10 = run (num_msgs, [](ubus::Message& msg, unsigned i) {
+            ubus::dbus_array values ("d");
+            for (auto s : samples)
+                values.add (ubus::dbus_basic(s));
+            msg << (int32_t)i << sensor << (uint32_t)(i*3) << true << unit
+                << 20.5 << (int64_t)-1 << (uint64_t)i << location << values;
+        });
+    auto write10 = run (num_msgs, [](ubus::Message& msg, unsigned i) {
+            msg.write<int32_t, std::string, uint32_t, bool, std::string,
+                      double, int64_t, uint64_t, std::string, std::vector<double>> (
+                i, sensor, i*3, true, unit, 20.5, -1, i, location, samples);
+        });
+
+    ubus::Message msg (service, path, iface, method);
+    msg.write<int32_t, std::string, uint32_t, bool, std::string,
+              double, int64_t, uint64_t, std::string, std::vector<double>> (
+        1, sensor, 3, true, unit, 20.5, -1, 1, location, samples);
+
+    auto get_first = run_read (num_msgs, msg, [](ubus::Message& m) {
+            ubus::dbus_basic id;
+            m.get_args (&id, nullptr);
+        });
+    auto read_first = run_read (num_msgs, msg, [](ubus::Message& m) {
+            m.read<int32_t> ();
+        });
+    auto get_all = run_read (num_msgs, msg, [](ubus::Message& m) {
+            ubus::dbus_basic a0, a1, a2, a3, a4, a5, a6, a7, a8;
+            ubus::dbus_array a9;
+            m.get_args (&a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8, &a9, nullptr);
+        });
+    auto read_all = run_read (num_msgs, msg, [](ubus::Message& m) {
+            m.read<int32_t, std::string, uint32_t, bool, std::string,
+                   double, int64_t, uint64_t, std::string, std::vector<double>> ();
+        });
+
+    std::vector<std::tuple<int32_t, std::string>> entries;
+    for (int32_t i=0; i<1000; ++i)
+        entries.emplace_back (i, location);
+    ubus::Message array_msg (service, path, iface, method);
+    array_msg.write (entries);
+
+    auto walk = run_read (num_msgs/100, array_msg, [](ubus::Message& m) {
+            int32_t sum = 0;
+            for (auto& arg : ubus::MessageParamIterator(m)) {
+                for (auto& element : arg.iterator()) {
+                    auto member = element.iterator ();
+                    int32_t value;
+                    member.basic_value (&value);
+                    sum += value;
+                }
+            }
+            return sum;
+        });
+
+    auto decode_copy = run_read (num_msgs/100, array_msg, [](ubus::Message& m) {
+            return m.arguments().size ();
+        });
+    auto decode_borrow = run_read (num_msgs/100, array_msg, [](ubus::Message& m) {
+            return m.arguments(true).size ();
+        });
+
+    std::vector<uint8_t> blob (1024*1024);
+    for (std::size_t i=0; i<blob.size(); ++i)
+        blob[i] = (uint8_t) i;
+    ubus::dbus_array blob_array ("y");
+    for (auto b : blob)
+        blob_array.add (ubus::dbus_basic(b));
+    unsigned num_blobs = num_msgs/10000 ? num_msgs/10000 : 1;
+
+    auto blob_stream = run (num_blobs, [&blob_array](ubus::Message& msg, unsigned) {
+            msg << blob_array;
+        });
+    auto blob_write = run (num_blobs, [&blob](ubus::Message& msg, unsigned) {
+            msg.write (blob);
+        });
+    auto blob_view = run (num_blobs, [&blob](ubus::Message& msg, unsigned) {
+            msg.write (ubus::fixed_array_view<uint8_t>(blob));
+        });
+
+    ubus::Message blob_msg (service, path, iface, method);
+    blob_msg.write (blob);
+
+    auto blob_decode = run_read (num_blobs, blob_msg, [](ubus::Message& m) {
+            return m.arguments().size ();
+        });
+    auto blob_read = run_read (num_blobs, blob_msg, [](ubus::Message& m) {
+            return std::get<0>(m.read<std::vector<uint8_t>>().get()).size ();
+        });
+    auto blob_read_view = run_read (num_blobs, blob_msg, [](ubus::Message& m) {
+            return std::get<0>(m.read<ubus::fixed_array_view<uint8_t>>().get()).size ();
+        });
+
+    print ("Create message only:     ", empty);
+    print ("5 args, operator<<:      ", stream5);
+    print ("5 args, write<>:         ", write5);
+    print ("10 args, operator<<:     ", stream10);
+    print ("10 args, write<>:        ", write10);
+    print ("First arg, get_args:     ", get_first);
+    print ("First arg, read<>:       ", read_first);
+    print ("All 10 args, get_args:   ", get_all);
+    print ("All 10 args, read<>:     ", read_all);
+    print ("Walk 1000 structs:       ", walk);
+    print ("Decode 1000 structs:     ", decode_copy);
+    print ("Decode, borrowed strings:", decode_borrow);
+    print ("1 MB ay, operator<<:     ", blob_stream);
+    print ("1 MB ay, write<> vector: ", blob_write);
+    print ("1 MB ay, write<> view:   ", blob_view);
+    print ("1 MB ay, arguments():    ", blob_decode);
+    print ("1 MB ay, read<> vector:  ", blob_read);
+    print ("1 MB ay, read<> view:    ", blob_read_view);
+
+    return 0;
+}
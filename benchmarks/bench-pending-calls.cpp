@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <map>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <ultrabus.hpp>
+#include <ultrabus/pending_call_table.hpp>
+
+
+//
+// Microbenchmark of the table of pending method calls in a connection.
+//
+// Compares the pending_call_table used by ultrabus::Connection
+// with a std::map keyed by DBusPendingCall pointers and guarded
+// by a mutex. A number of calls are kept in flight, and for each
+// reply the pending call is looked up, removed, and its callback
+// is called, and a new call is added.
+//
+// Usage: bench-pending-calls [calls in flight] [number of calls]
+//
+
+
+namespace ubus = ultrabus;
+using namespace std;
+
+
+//
+// Count heap allocations
+//
+static std::atomic<uint64_t> num_allocs {0};
+
+void* operator new (std::size_t size)
+{
+    ++num_allocs;
+    void* p = malloc (size ? size : 1);
+    if (!p)
+        throw std::bad_alloc ();
+    return p;
+}
+void operator delete (void* p) noexcept
+{
+    free (p);
+}
+void operator delete (void* p, std::size_t) noexcept
+{
+    free (p);
+}
+
+
+struct result_t {
+    double ns_per_call;
+    double allocs_per_call;
+};
+
+
+//
+// Fake pending call objects, never dereferenced
+//
+static DBusPendingCall* fake_pending (uint32_t serial)
+{
+    return reinterpret_cast<DBusPendingCall*> (static_cast<uintptr_t>(serial) << 4);
+}
+
+
+//
+// A typical reply callback captures a user callback and a pointer.
+//
+using user_cb_t = std::function<void (uint64_t&)>;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static result_t bench_map (unsigned in_flight, unsigned num_calls)
+{
+    std::mutex m;
+    std::map<DBusPendingCall*, std::function<void (ubus::Message&)>> pending;
+    uint64_t sum = 0;
+    user_cb_t user_cb = [](uint64_t& s){ ++s; };
+    ubus::Message reply;
+    uint32_t serial = 1;
+
+    auto add = [&]{
+        std::lock_guard<std::mutex> lock (m);
+        uint64_t* sp = &sum;
+        pending.emplace (fake_pending(serial++), [user_cb, sp](ubus::Message&){ user_cb(*sp); });
+    };
+
+    for (unsigned i=0; i<in_flight; ++i)
+        add ();
+
+    uint64_t allocs = num_allocs;
+    auto t0 = chrono::steady_clock::now ();
+    uint32_t next_reply = 1;
+    for (unsigned i=0; i<num_calls; ++i) {
+        std::function<void (ubus::Message&)> cb;
+        {
+            std::lock_guard<std::mutex> lock (m);
+            auto entry = pending.find (fake_pending(next_reply++));
+            cb = entry->second;
+            pending.erase (entry);
+        }
+        cb (reply);
+        add ();
+    }
+    auto t1 = chrono::steady_clock::now ();
+    allocs = num_allocs - allocs;
+
+    if (sum != num_calls)
+        cerr << "Error: got " << sum << " replies" << endl;
+
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count ();
+    return {(double)ns / num_calls, (double)allocs / num_calls};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static result_t bench_table (unsigned in_flight, unsigned num_calls)
+{
+    ubus::pending_call_table pending;
+    uint64_t sum = 0;
+    user_cb_t user_cb = [](uint64_t& s){ ++s; };
+    ubus::Message reply;
+    uint32_t serial = 1;
+
+    auto add = [&]{
+        uint64_t* sp = &sum;
+        pending.insert (serial, fake_pending(serial),
+                        [user_cb, sp](ubus::Message&){ user_cb(*sp); });
+        ++serial;
+    };
+
+    for (unsigned i=0; i<in_flight; ++i)
+        add ();
+
+    uint64_t allocs = num_allocs;
+    auto t0 = chrono::steady_clock::now ();
+    uint32_t next_reply = 1;
+    for (unsigned i=0; i<num_calls; ++i) {
+        DBusPendingCall* p;
+        ubus::pending_call_table::callback_t cb;
+        pending.take (next_reply++, p, cb);
+        cb (reply);
+        add ();
+    }
+    auto t1 = chrono::steady_clock::now ();
+    allocs = num_allocs - allocs;
+
+    if (sum != num_calls)
+        cerr << "Error: got " << sum << " replies" << endl;
+
+    // Don't let the table release the fake pending calls
+    DBusPendingCall* p;
+    ubus::pending_call_table::callback_t cb;
+    while (next_reply < serial)
+        pending.take (next_reply++, p, cb);
+
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count ();
+    return {(double)ns / num_calls, (double)allocs / num_calls};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    unsigned in_flight = argc > 1 ? (unsigned) atoi(argv[1]) : 1000;
+    unsigned num_calls = argc > 2 ? (unsigned) atoi(argv[2]) : 2000000;
+
+    cout << "Pending calls in flight: " << in_flight << ", number of calls: " << num_calls << endl;
+
+    auto map_result   = bench_map (in_flight, num_calls);
+    auto table_result = bench_table (in_flight, num_calls);
+
+    cout << fixed << setprecision(1);
+    cout << "std::map + mutex:   " << setw(8) << map_result.ns_per_call << " ns/call, "
+         << setprecision(2) << map_result.allocs_per_call << " allocations/call" << endl;
+    cout << setprecision(1);
+    cout << "pending_call_table: " << setw(8) << table_result.ns_per_call << " ns/call, "
+         << setprecision(2) << table_result.allocs_per_call << " allocations/call" << endl;
+
+    return 0;
+}
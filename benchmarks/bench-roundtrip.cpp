@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <ultrabus.hpp>
+
+
+//
+// Benchmark of synchronous method call round trips.
+//
+// Two private connections are made to the same bus, one implementing
+// an echo method and one calling it. The round trip time of
+// Connection::send_and_wait() is compared with a synchronous call
+// implemented the way send_and_wait() used to be implemented: a
+// std::function callback signaling a std::condition_variable,
+// and with send_and_wait() when both connections busy poll.
+// Busy polling needs a free CPU core for each I/O handler to help.
+//
+// Run this against a local dbus-daemon, for example:
+//
+//   dbus-run-session -- ./bench-roundtrip [number of calls] [busy poll usec]
+//
+// The bus address is taken from DBUS_SESSION_BUS_ADDRESS.
+//
+
+
+namespace ubus = ultrabus;
+using namespace std;
+
+
+static constexpr const char* object_path = "/se/ultramarin/ultrabus/bench";
+static constexpr const char* iface_name  = "se.ultramarin.ultrabus.bench";
+
+
+//
+// Count heap allocations made by the calling thread
+//
+static thread_local uint64_t num_allocs = 0;
+
+void* operator new (std::size_t size)
+{
+    ++num_allocs;
+    void* p = malloc (size ? size : 1);
+    if (!p)
+        throw std::bad_alloc ();
+    return p;
+}
+void operator delete (void* p) noexcept
+{
+    free (p);
+}
+void operator delete (void* p, std::size_t) noexcept
+{
+    free (p);
+}
+
+
+struct result_t {
+    double us_per_call;
+    double allocs_per_call;
+    double p50_us;
+    double p99_us;
+    double max_us;
+};
+
+
+//------------------------------------------------------------------------------
+// Synchronous call using a condition variable and a std::function callback.
+//------------------------------------------------------------------------------
+static ubus::Message cv_send_and_wait (ubus::Connection& conn, ubus::Message& msg)
+{
+    std::condition_variable cv;
+    std::mutex m;
+    bool got_reply = false;
+    ubus::Message reply;
+
+    std::function<void (ubus::Message&)> cb = [&](ubus::Message& r) {
+        std::unique_lock<std::mutex> lock (m);
+        reply = std::move (r);
+        got_reply = true;
+        cv.notify_one ();
+    };
+    conn.send (msg, cb);
+
+    std::unique_lock<std::mutex> lock (m);
+    cv.wait (lock, [&got_reply]{return got_reply;});
+    return reply;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static result_t run (ubus::Connection& conn,
+                     const std::string& dest,
+                     unsigned num_calls,
+                     bool use_cv)
+{
+    // Create the messages before the measurement
+    std::vector<ubus::Message> messages;
+    messages.reserve (num_calls);
+    for (unsigned i=0; i<num_calls; ++i)
+        messages.emplace_back (dest, object_path, iface_name, "Echo");
+
+    ubus::latency_histogram histogram;
+
+    unsigned errors = 0;
+    uint64_t allocs = num_allocs;
+    auto t0 = chrono::steady_clock::now ();
+    auto start = t0;
+    for (auto& msg : messages) {
+        ubus::Message reply = use_cv ? cv_send_and_wait(conn, msg) : conn.send_and_wait(msg);
+        if (reply.is_error())
+            ++errors;
+        auto end = chrono::steady_clock::now ();
+        histogram.record (chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+        start = end;
+    }
+    auto t1 = chrono::steady_clock::now ();
+    allocs = num_allocs - allocs;
+
+    if (errors)
+        cerr << "Error: " << errors << " error replies" << endl;
+
+    auto us = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count () / 1000.0;
+    auto latency = histogram.get ();
+    return {us / num_calls,
+            (double)allocs / num_calls,
+            latency.percentile(50.0) / 1000.0,
+            latency.percentile(99.0) / 1000.0,
+            latency.max() / 1000.0};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void print (const char* name, const result_t& r)
+{
+    cout << name << setprecision(2) << setw(8) << r.us_per_call << " us/call, "
+         << r.allocs_per_call << " allocations/call, "
+         << "p50 " << r.p50_us << " us, p99 " << r.p99_us << " us, max " << r.max_us << " us" << endl;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    unsigned num_calls = argc > 1 ? (unsigned) atoi(argv[1]) : 20000;
+    unsigned spin_usec = argc > 2 ? (unsigned) atoi(argv[2]) : 50;
+
+    const char* bus_address = getenv ("DBUS_SESSION_BUS_ADDRESS");
+    if (!bus_address) {
+        cerr << "DBUS_SESSION_BUS_ADDRESS not set" << endl;
+        return 1;
+    }
+
+    ubus::Connection server;
+    ubus::Connection client;
+    if (server.connect(bus_address, DBUS_TIMEOUT_USE_DEFAULT, true, false) ||
+        client.connect(bus_address, DBUS_TIMEOUT_USE_DEFAULT, true, false))
+    {
+        cerr << "Unable to connect to " << bus_address << endl;
+        return 1;
+    }
+
+    ubus::CallbackObjectHandler echo (server);
+    echo.set_message_cb ([&server](ubus::Message& msg)->bool {
+            ubus::Message reply (msg, false);
+            server.send (reply);
+            return true;
+        });
+    echo.register_opath (object_path);
+
+    // Warm up
+    run (client, server.unique_name(), num_calls/10 + 1, false);
+
+    auto cv_result   = run (client, server.unique_name(), num_calls, true);
+    auto sync_result = run (client, server.unique_name(), num_calls, false);
+
+    server.busy_poll (spin_usec);
+    client.busy_poll (spin_usec);
+    run (client, server.unique_name(), num_calls/10 + 1, false);
+    auto spin_result = run (client, server.unique_name(), num_calls, false);
+    auto spin_stats = client.dispatch_stats ();
+
+    cout << "Round trips: " << num_calls << endl;
+    cout << fixed;
+    print ("condition variable:  ", cv_result);
+    print ("send_and_wait:       ", sync_result);
+    print ("busy poll:           ", spin_result);
+    cout << "busy poll " << spin_usec << " us: " << spin_stats.busy_poll_hits << " hits, "
+         << spin_stats.busy_poll_misses << " misses" << endl;
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <dbus/dbus.h>
+#include <iomultiplex.hpp>
+#include <ultrabus/timer_wheel.hpp>
+
+
+//
+// Microbenchmark of the handling of libdbus timeouts in a connection.
+//
+// Each method call waiting for a reply has a libdbus timeout, by
+// default 25 seconds. A number of calls are kept in flight, and for
+// each reply the timeout of the oldest call is removed and a timeout
+// for a new call is added.
+//
+// Compares the timer wheel used by ultrabus::Connection with the
+// previous implementation: a std::map from DBusTimeout objects to
+// timer ids in an iomultiplex::timer_set.
+//
+// Usage: bench-timer-wheel [calls in flight] [number of calls] [timeout in ms]
+//
+
+
+namespace ubus = ultrabus;
+using namespace std;
+
+
+//
+// Count heap allocations
+//
+static std::atomic<uint64_t> num_allocs {0};
+
+void* operator new (std::size_t size)
+{
+    ++num_allocs;
+    void* p = malloc (size ? size : 1);
+    if (!p)
+        throw std::bad_alloc ();
+    return p;
+}
+void operator delete (void* p) noexcept
+{
+    free (p);
+}
+void operator delete (void* p, std::size_t) noexcept
+{
+    free (p);
+}
+
+
+struct result_t {
+    double ns_per_call;
+    double allocs_per_call;
+};
+
+
+//
+// Fake timeout objects, never dereferenced
+//
+static DBusTimeout* fake_timeout (unsigned n)
+{
+    return reinterpret_cast<DBusTimeout*> (static_cast<uintptr_t>(n + 1) << 4);
+}
+
+
+//
+// Current time in milliseconds
+//
+static uint64_t now_ms ()
+{
+    return chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count ();
+}
+
+
+//------------------------------------------------------------------------------
+// The timeout handling previously used by ultrabus::Connection.
+//------------------------------------------------------------------------------
+static result_t bench_timer_set (unsigned in_flight, unsigned num_calls, int interval)
+{
+    iomultiplex::default_iohandler ioh;
+    iomultiplex::timer_set timers (ioh);
+    std::mutex m;
+    std::map<DBusTimeout*, long> timeouts;
+    unsigned next = 0;
+
+    auto add = [&]{
+        std::lock_guard<std::mutex> lock (m);
+        auto* timeout = fake_timeout (next++);
+        auto entry = timeouts.emplace(timeout, -1).first;
+        entry->second = timers.set (interval, [&timeouts, timeout](iomultiplex::timer_set&, long)
+            {
+                timeouts.erase (timeout);
+            });
+    };
+    auto remove = [&](unsigned n){
+        std::lock_guard<std::mutex> lock (m);
+        auto entry = timeouts.find (fake_timeout(n));
+        if (entry != timeouts.end()) {
+            timers.cancel (entry->second);
+            timeouts.erase (entry);
+        }
+    };
+
+    for (unsigned i=0; i<in_flight; ++i)
+        add ();
+
+    uint64_t allocs = num_allocs;
+    auto t0 = chrono::steady_clock::now ();
+    for (unsigned i=0; i<num_calls; ++i) {
+        remove (i);
+        add ();
+    }
+    auto t1 = chrono::steady_clock::now ();
+    allocs = num_allocs - allocs;
+
+    timers.clear ();
+
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count ();
+    return {(double)ns / num_calls, (double)allocs / num_calls};
+}
+
+
+//------------------------------------------------------------------------------
+// The timer wheel, the timer entries are attached to the libdbus
+// timeout objects and allocated once per timeout object.
+//------------------------------------------------------------------------------
+static result_t bench_timer_wheel (unsigned in_flight, unsigned num_calls, int interval)
+{
+    ubus::timer_wheel wheel (now_ms());
+    std::mutex m;
+    std::vector<ubus::timer_wheel::entry> entries (in_flight + num_calls);
+    unsigned next = 0;
+
+    auto add = [&]{
+        std::lock_guard<std::mutex> lock (m);
+        auto now = now_ms ();
+        wheel.advance (now);
+        wheel.add (entries[next++], now + interval + 1);
+    };
+    auto remove = [&](unsigned n){
+        std::lock_guard<std::mutex> lock (m);
+        wheel.cancel (entries[n]);
+    };
+
+    for (unsigned i=0; i<in_flight; ++i)
+        add ();
+
+    uint64_t allocs = num_allocs;
+    auto t0 = chrono::steady_clock::now ();
+    for (unsigned i=0; i<num_calls; ++i) {
+        remove (i);
+        add ();
+    }
+    auto t1 = chrono::steady_clock::now ();
+    allocs = num_allocs - allocs;
+
+    wheel.clear ();
+
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count ();
+    return {(double)ns / num_calls, (double)allocs / num_calls};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    unsigned in_flight = argc > 1 ? (unsigned) atoi(argv[1]) : 10000;
+    unsigned num_calls = argc > 2 ? (unsigned) atoi(argv[2]) : 200000;
+    int interval       = argc > 3 ? atoi(argv[3]) : 25000;
+
+    cout << "Calls in flight: " << in_flight << ", number of calls: " << num_calls
+         << ", timeout: " << interval << " ms" << endl;
+
+    auto set_result   = bench_timer_set (in_flight, num_calls, interval);
+    auto wheel_result = bench_timer_wheel (in_flight, num_calls, interval);
+
+    cout << fixed << setprecision(1);
+    cout << "std::map + timer_set: " << setw(10) << set_result.ns_per_call << " ns/call, "
+         << setprecision(2) << set_result.allocs_per_call << " allocations/call" << endl;
+    cout << setprecision(1);
+    cout << "timer_wheel:          " << setw(10) << wheel_result.ns_per_call << " ns/call, "
+         << setprecision(2) << wheel_result.allocs_per_call << " allocations/call" << endl;
+
+    return 0;
+}
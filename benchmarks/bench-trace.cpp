@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <ultrabus/trace_buffer.hpp>
+
+
+//
+// Microbenchmark of the trace buffer.
+//
+// A number of threads record trace events as fast as they can,
+// with tracing disabled and enabled. A separate thread dumps the
+// trace buffers while the events are recorded, to show the cost
+// for the recording threads of a concurrent reader.
+//
+// Usage: bench-trace [number of threads] [events per thread]
+//
+
+
+namespace ubus = ultrabus;
+using namespace std;
+
+
+//------------------------------------------------------------------------------
+// Return the elapsed time in nanoseconds divided by the total number
+// of recorded events, i.e. the inverse of the aggregated event rate
+//------------------------------------------------------------------------------
+static double bench (unsigned num_threads, unsigned num_events, bool with_reader)
+{
+    std::atomic_bool start {false};
+    std::atomic_bool done {false};
+    std::vector<std::thread> threads;
+
+    for (unsigned t=0; t<num_threads; ++t) {
+        threads.emplace_back ([&]{
+            while (!start)
+                std::this_thread::yield ();
+            for (unsigned i=0; i<num_events; ++i)
+                ubus::trace_buffer::record (ubus::trace_event::send, &start, i, 1);
+        });
+    }
+
+    std::thread reader;
+    if (with_reader) {
+        reader = std::thread ([&]{
+            while (!done) {
+                ubus::trace_buffer::dump ();
+                std::this_thread::sleep_for (chrono::milliseconds(1));
+            }
+        });
+    }
+
+    auto t0 = chrono::steady_clock::now ();
+    start = true;
+    for (auto& t : threads)
+        t.join ();
+    auto t1 = chrono::steady_clock::now ();
+    done = true;
+    if (reader.joinable())
+        reader.join ();
+
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count ();
+    return (double)ns / ((double)num_threads * num_events);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    unsigned num_threads = argc > 1 ? (unsigned) atoi(argv[1]) : 4;
+    unsigned num_events  = argc > 2 ? (unsigned) atoi(argv[2]) : 2000000;
+
+    cout << "Threads: " << num_threads << ", events per thread: " << num_events
+         << ", ring buffer: " << ubus::trace_buffer::capacity() << " events" << endl;
+    cout << fixed << setprecision(1);
+
+    ubus::trace_buffer::disable ();
+    cout << "Disabled:              " << setw(8) << bench(num_threads, num_events, false) << " ns/event" << endl;
+
+    ubus::trace_buffer::enable ();
+    cout << "Enabled:               " << setw(8) << bench(num_threads, num_events, false) << " ns/event" << endl;
+    cout << "Enabled, with reader:  " << setw(8) << bench(num_threads, num_events, true) << " ns/event" << endl;
+
+    ubus::trace_buffer::disable ();
+    ubus::trace_buffer::clear ();
+    return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstdint>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <ultrabus.hpp>
+
+
+//
+// Benchmark of system calls per message.
+//
+// A child process implements an echo method on its own connection,
+// the parent calls it with a number of calls in flight, using:
+//   - A connection with its own I/O handler.
+//   - A connection driven by an epoll loop in the calling thread.
+//   - A connection driven by ultrabus::UringLoop.
+//
+// The system calls made by the parent process for reading, writing and
+// waiting for I/O are counted by wrapping the libc functions making them.
+// System calls made without the libc wrappers, like the futex calls of
+// std::mutex and std::condition_variable, are not counted.
+//
+// Run this against a local dbus-daemon, for example:
+//
+//   dbus-run-session -- ./bench-uring [number of calls] [calls in flight]
+//
+// The bus address is taken from DBUS_SESSION_BUS_ADDRESS.
+//
+
+
+namespace ubus = ultrabus;
+using namespace std;
+
+
+static constexpr const char* object_path = "/se/ultramarin/ultrabus/bench";
+static constexpr const char* iface_name  = "se.ultramarin.ultrabus.bench";
+
+
+//
+// Count system calls made by the libc wrappers below
+//
+static std::atomic<uint64_t> num_syscalls {0};
+
+template<typename F>
+static F next_symbol (F& f, const char* name)
+{
+    if (!f)
+        f = reinterpret_cast<F> (dlsym(RTLD_NEXT, name));
+    return f;
+}
+
+#define COUNT_SYSCALL(ret, name, params, args)              \
+    extern "C" ret name params                              \
+    {                                                       \
+        static ret (*real) params = nullptr;                \
+        num_syscalls.fetch_add (1, std::memory_order_relaxed); \
+        return next_symbol(real, #name) args;               \
+    }
+
+COUNT_SYSCALL (ssize_t, read,    (int fd, void* buf, size_t n), (fd, buf, n))
+COUNT_SYSCALL (ssize_t, write,   (int fd, const void* buf, size_t n), (fd, buf, n))
+COUNT_SYSCALL (ssize_t, readv,   (int fd, const struct iovec* iov, int n), (fd, iov, n))
+COUNT_SYSCALL (ssize_t, writev,  (int fd, const struct iovec* iov, int n), (fd, iov, n))
+COUNT_SYSCALL (ssize_t, recv,    (int fd, void* buf, size_t n, int flags), (fd, buf, n, flags))
+COUNT_SYSCALL (ssize_t, send,    (int fd, const void* buf, size_t n, int flags), (fd, buf, n, flags))
+COUNT_SYSCALL (ssize_t, recvmsg, (int fd, struct msghdr* msg, int flags), (fd, msg, flags))
+COUNT_SYSCALL (ssize_t, sendmsg, (int fd, const struct msghdr* msg, int flags), (fd, msg, flags))
+COUNT_SYSCALL (int, poll,        (struct pollfd* fds, nfds_t n, int timeout), (fds, n, timeout))
+COUNT_SYSCALL (int, ppoll,       (struct pollfd* fds, nfds_t n, const struct timespec* ts, const sigset_t* mask),
+                                 (fds, n, ts, mask))
+COUNT_SYSCALL (int, epoll_wait,  (int epfd, struct epoll_event* ev, int n, int timeout), (epfd, ev, n, timeout))
+COUNT_SYSCALL (int, epoll_pwait, (int epfd, struct epoll_event* ev, int n, int timeout, const sigset_t* mask),
+                                 (epfd, ev, n, timeout, mask))
+COUNT_SYSCALL (int, epoll_ctl,   (int epfd, int op, int fd, struct epoll_event* ev), (epfd, op, fd, ev))
+COUNT_SYSCALL (int, sigtimedwait, (const sigset_t* set, siginfo_t* info, const struct timespec* ts),
+                                  (set, info, ts))
+
+// Used by UringLoop for io_uring_enter()
+extern "C" long syscall (long number, ...)
+{
+    static long (*real) (long, ...) = nullptr;
+    va_list ap;
+    va_start (ap, number);
+    long a[6];
+    for (auto& arg : a)
+        arg = va_arg (ap, long);
+    va_end (ap);
+    num_syscalls.fetch_add (1, std::memory_order_relaxed);
+    return next_symbol(real, "syscall") (number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+
+struct result_t {
+    double msgs_per_sec;
+    double syscalls_per_call;
+    unsigned errors;
+};
+
+
+//------------------------------------------------------------------------------
+// Make calls with 'window' calls in flight. Each reply sends the next call.
+// 'wait' runs the event loop until 'done' returns true.
+//------------------------------------------------------------------------------
+template<typename Wait>
+static result_t run (ubus::Connection& conn,
+                     const std::string& dest,
+                     unsigned num_calls,
+                     unsigned window,
+                     Wait wait)
+{
+    std::atomic<unsigned> sent {0};
+    std::atomic<unsigned> replies {0};
+    std::atomic<unsigned> errors {0};
+
+    std::function<void (ubus::Message&)> on_reply;
+    auto send_next = [&]() {
+        if (sent.fetch_add(1) < num_calls) {
+            ubus::Message msg (dest, object_path, iface_name, "Echo");
+            conn.send (msg, [&on_reply](ubus::Message& reply) { on_reply(reply); });
+        }
+    };
+    on_reply = [&](ubus::Message& reply) {
+        if (reply.is_error())
+            ++errors;
+        ++replies;
+        send_next ();
+    };
+
+    uint64_t syscalls = num_syscalls;
+    auto t0 = chrono::steady_clock::now ();
+    for (unsigned i=0; i<window; ++i)
+        send_next ();
+    wait ([&]{ return replies >= num_calls; });
+    auto t1 = chrono::steady_clock::now ();
+    syscalls = num_syscalls - syscalls;
+
+    double sec = chrono::duration<double>(t1 - t0).count ();
+    return {num_calls / sec, (double)syscalls / num_calls, errors};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void print (const char* name, const result_t& r)
+{
+    cout << name << setprecision(0) << setw(10) << r.msgs_per_sec << " calls/s, "
+         << setprecision(2) << setw(6) << r.syscalls_per_call << " system calls/call";
+    if (r.errors)
+        cout << " (" << r.errors << " errors)";
+    cout << endl;
+}
+
+
+//------------------------------------------------------------------------------
+// Echo server, runs in the child process until 'quit_fd' is closed.
+//------------------------------------------------------------------------------
+static int echo_server (const char* bus_address, int name_fd, int quit_fd)
+{
+    ubus::Connection server;
+    if (server.connect(bus_address, DBUS_TIMEOUT_USE_DEFAULT, true, false))
+        return 1;
+
+    ubus::CallbackObjectHandler echo (server);
+    echo.set_message_cb ([&server](ubus::Message& msg)->bool {
+            ubus::Message reply (msg, false);
+            server.send (reply);
+            return true;
+        });
+    echo.register_opath (object_path);
+
+    auto name = server.unique_name () + "\n";
+    if (::write(name_fd, name.data(), name.size()) != (ssize_t) name.size())
+        return 1;
+    close (name_fd);
+
+    char c;
+    while (::read(quit_fd, &c, 1) > 0)
+        ;
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    unsigned num_calls = argc > 1 ? (unsigned) atoi(argv[1]) : 100000;
+    unsigned window    = argc > 2 ? (unsigned) atoi(argv[2]) : 16;
+    if (!window)
+        window = 1;
+
+    const char* bus_address = getenv ("DBUS_SESSION_BUS_ADDRESS");
+    if (!bus_address) {
+        cerr << "DBUS_SESSION_BUS_ADDRESS not set" << endl;
+        return 1;
+    }
+
+    // Start the echo server before any threads are created
+    int name_pipe[2];
+    int quit_pipe[2];
+    if (pipe(name_pipe) || pipe(quit_pipe)) {
+        perror ("pipe");
+        return 1;
+    }
+    auto pid = fork ();
+    if (pid < 0) {
+        perror ("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        close (name_pipe[0]);
+        close (quit_pipe[1]);
+        _exit (echo_server(bus_address, name_pipe[1], quit_pipe[0]));
+    }
+    close (name_pipe[1]);
+    close (quit_pipe[0]);
+
+    std::string server_name;
+    char c;
+    while (::read(name_pipe[0], &c, 1) == 1 && c != '\n')
+        server_name.push_back (c);
+    close (name_pipe[0]);
+    if (server_name.empty()) {
+        cerr << "Echo server failed" << endl;
+        waitpid (pid, nullptr, 0);
+        return 1;
+    }
+
+    cout << "Calls: " << num_calls << ", in flight: " << window << endl;
+    cout << fixed;
+
+    // Connection with its own I/O handler
+    {
+        ubus::Connection conn;
+        if (conn.connect(bus_address, DBUS_TIMEOUT_USE_DEFAULT, true, false)) {
+            cerr << "Unable to connect to " << bus_address << endl;
+            return 1;
+        }
+        std::mutex m;
+        std::condition_variable cv;
+        auto wait = [&](std::function<bool()> done) {
+            // Replies are handled by the I/O thread
+            std::unique_lock<std::mutex> lock (m);
+            while (!done())
+                cv.wait_for (lock, chrono::milliseconds(1));
+        };
+        run (conn, server_name, num_calls/10 + 1, window, wait); // Warm up
+        print ("I/O handler: ", run(conn, server_name, num_calls, window, wait));
+    }
+
+    // Connection driven by an epoll loop
+    {
+        int epfd = epoll_create1 (EPOLL_CLOEXEC);
+        ubus::Connection conn (ubus::Connection::external_loop);
+        conn.on_watch_change ([epfd](int fd, uint32_t events) {
+                epoll_event ev;
+                ev.events = events;
+                ev.data.fd = fd;
+                if (!events)
+                    epoll_ctl (epfd, EPOLL_CTL_DEL, fd, nullptr);
+                else if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) && errno == ENOENT)
+                    epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev);
+            });
+        if (conn.connect(bus_address, DBUS_TIMEOUT_USE_DEFAULT, true, false)) {
+            cerr << "Unable to connect to " << bus_address << endl;
+            return 1;
+        }
+        auto wait = [&](std::function<bool()> done) {
+            epoll_event events[16];
+            while (!done()) {
+                int n = epoll_wait (epfd, events, 16, conn.next_timeout());
+                for (int i=0; i<n; ++i)
+                    conn.process_ready (events[i].data.fd, events[i].events);
+                if (conn.next_timeout() == 0)
+                    conn.process_timeouts ();
+            }
+        };
+        run (conn, server_name, num_calls/10 + 1, window, wait); // Warm up
+        print ("epoll loop:  ", run(conn, server_name, num_calls, window, wait));
+        conn.disconnect ();
+        close (epfd);
+    }
+
+    // Connection driven by io_uring
+    try {
+        ubus::UringLoop uring;
+        ubus::Connection conn (ubus::Connection::external_loop);
+        uring.add (conn);
+        if (conn.connect(bus_address, DBUS_TIMEOUT_USE_DEFAULT, true, false)) {
+            cerr << "Unable to connect to " << bus_address << endl;
+            return 1;
+        }
+        auto wait = [&](std::function<bool()> done) {
+            while (!done())
+                uring.run_once ();
+        };
+        run (conn, server_name, num_calls/10 + 1, window, wait); // Warm up
+        auto before = uring.stats ();
+        auto result = run (conn, server_name, num_calls, window, wait);
+        auto after = uring.stats ();
+        print ("io_uring:    ", result);
+        cout << "             " << setprecision(2)
+             << (double)(after.enter_calls - before.enter_calls) / num_calls << " io_uring_enter/call, "
+             << (double)(after.submissions - before.submissions) / num_calls << " requests/call, "
+             << (double)(after.completions - before.completions) / num_calls << " completions/call"
+             << endl;
+        conn.disconnect ();
+        uring.remove (conn);
+    }
+    catch (std::system_error& e) {
+        cout << "io_uring:    not available (" << e.what() << ")" << endl;
+    }
+
+    close (quit_pipe[1]);
+    waitpid (pid, nullptr, 0);
+    return 0;
+}
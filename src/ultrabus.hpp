@@ -27,6 +27,7 @@ namespace ultrabus {
 
 #include <ultrabus/types.hpp>
 #include <ultrabus/retvalue.hpp>
+#include <ultrabus/coroutine.hpp>
 #include <ultrabus/dbus_type_base.hpp>
 #include <ultrabus/dbus_type.hpp>
 #include <ultrabus/dbus_basic.hpp>
@@ -34,14 +35,25 @@ namespace ultrabus {
 #include <ultrabus/dbus_array.hpp>
 #include <ultrabus/dbus_struct.hpp>
 #include <ultrabus/dbus_variant.hpp>
+#include <ultrabus/dbus_traits.hpp>
+#include <ultrabus/fixed_array_view.hpp>
 #include <ultrabus/Properties.hpp>
 #include <ultrabus/MessageParamIterator.hpp>
 #include <ultrabus/Message.hpp>
+#include <ultrabus/thread_options.hpp>
+#include <ultrabus/WorkerPool.hpp>
+#include <ultrabus/trace_buffer.hpp>
+#include <ultrabus/latency_histogram.hpp>
 #include <ultrabus/Connection.hpp>
+#include <ultrabus/ConnectionPool.hpp>
+#include <ultrabus/UringLoop.hpp>
+#include <ultrabus/StartupBuilder.hpp>
+#include <ultrabus/Server.hpp>
 #include <ultrabus/MessageHandler.hpp>
 #include <ultrabus/CallbackMessageHandler.hpp>
 #include <ultrabus/ObjectHandler.hpp>
 #include <ultrabus/CallbackObjectHandler.hpp>
+#include <ultrabus/StatsObjectHandler.hpp>
 #include <ultrabus/ObjectProxy.hpp>
 #include <ultrabus/utils.hpp>
 #include <ultrabus/org_freedesktop_DBus.hpp>
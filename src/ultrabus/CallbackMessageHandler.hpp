@@ -53,7 +53,9 @@ namespace ultrabus {
         /**
          * Destructor.
          */
-        virtual ~CallbackMessageHandler () = default;
+        virtual ~CallbackMessageHandler () {
+            finish_jobs ();
+        }
 
         /**
          * Set a callback to be called for incomming
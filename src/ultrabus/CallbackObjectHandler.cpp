@@ -46,6 +46,7 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     CallbackObjectHandler::~CallbackObjectHandler ()
     {
+        finish_jobs ();
         on_message_cb = nullptr;
     }
 
@@ -17,23 +17,293 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <ultrabus/Connection.hpp>
-#include <condition_variable>
+#include <ultrabus/trace_buffer.hpp>
+#include <system_error>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <unordered_map>
+#include <list>
+#include <string_view>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 
-//#define TRACE_DEBUG
+namespace ultrabus {
+
 
-#ifdef TRACE_DEBUG
-#  include <cstdio>
-#  include <unistd.h>
-#  include <sys/types.h>
-#  define DBG_LOG(format, ...) fprintf(stderr, "[%d] %s:%s:%d: " format "\n", \
-                                       (int)gettid(), __FILE__, __FUNCTION__, __LINE__, ## __VA_ARGS__)
-#else
-#  define DBG_LOG(format, ...)
-#endif
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    static void futex_wait (std::atomic<uint32_t>& word, uint32_t value)
+    {
+        syscall (SYS_futex, reinterpret_cast<uint32_t*>(&word),
+                 FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+    }
 
 
-namespace ultrabus {
+    //--------------------------------------------------------------------------
+    // Wait at most 'msec' milliseconds for the futex word to change.
+    //--------------------------------------------------------------------------
+    static void futex_wait (std::atomic<uint32_t>& word, uint32_t value, unsigned msec)
+    {
+        struct timespec ts;
+        ts.tv_sec = msec / 1000;
+        ts.tv_nsec = (msec % 1000) * 1000000L;
+        syscall (SYS_futex, reinterpret_cast<uint32_t*>(&word),
+                 FUTEX_WAIT_PRIVATE, value, &ts, nullptr, 0);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    static void futex_wake (std::atomic<uint32_t>& word)
+    {
+        syscall (SYS_futex, reinterpret_cast<uint32_t*>(&word),
+                 FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Current time in milliseconds, the time unit of the timeout timer wheel
+    //--------------------------------------------------------------------------
+    static uint64_t now_ms ()
+    {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Current time in nanoseconds, the time unit of the statistics
+    //--------------------------------------------------------------------------
+    static uint64_t now_ns ()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Size in bytes of a message on the wire
+    //--------------------------------------------------------------------------
+    static uint64_t message_size (DBusMessage* msg)
+    {
+        char* buf = nullptr;
+        int len = 0;
+        if (!dbus_message_marshal(msg, &buf, &len))
+            return 0;
+        dbus_free (buf);
+        return (uint64_t) len;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // The two ends of a loopback connection.
+    // A message is delivered to the other end with the mutex locked,
+    // so an end is never disconnected while a message is delivered to it.
+    //--------------------------------------------------------------------------
+    struct loopback_link {
+        std::mutex mutex;
+        Connection* ends[2] {nullptr, nullptr};
+    };
+
+
+    //--------------------------------------------------------------------------
+    // State of one end of a loopback connection
+    //--------------------------------------------------------------------------
+    struct Connection::loopback_t {
+        loopback_t (std::shared_ptr<loopback_link> l, unsigned e)
+            : link (std::move(l)),
+              end (e)
+        {
+            static std::atomic<unsigned> loopback_id {0};
+            name = ":loopback." + std::to_string (++loopback_id);
+        }
+
+        std::shared_ptr<loopback_link> link;
+        unsigned end;
+        std::string name;
+        std::atomic<uint32_t> last_serial {0};
+        std::atomic_bool peer_closed {false};
+
+        // Incoming messages, put here by the other end
+        mpsc_queue inbox;
+
+        // Registered message filters and object paths.
+        // The list of filters is replaced, not modified, when a
+        // filter is added or removed, so the I/O handler can call
+        // the filters without holding the mutex.
+        struct filter_t {
+            DBusHandleMessageFunction function;
+            void* data;
+        };
+        struct object_t {
+            const DBusObjectPathVTable* vtable;
+            void* data;
+            bool fallback;
+        };
+        std::mutex reg_mutex;
+        std::shared_ptr<const std::vector<filter_t>> filters {std::make_shared<std::vector<filter_t>>()};
+        std::map<std::string, object_t> objects;
+
+        // Pending method calls, only accessed in the context of the I/O handler
+        struct call_t : public timer_wheel::entry {
+            uint32_t serial;
+            uint64_t sent_at;
+            pending_msg_cb_t reply_cb;
+        };
+        std::unordered_map<uint32_t, call_t> calls;
+        timer_wheel timeouts {now_ms()};
+        long timer_id {-1};    // Timer id, -1 if not armed
+        uint64_t armed_at {0}; // Time the timer is armed for
+
+        // Assign a serial number and sender to a message not sent before,
+        // and lock it like libdbus does when a message is sent on a bus.
+        uint32_t prepare (DBusMessage* m) {
+            auto serial = dbus_message_get_serial (m);
+            if (serial == 0) {
+                do {
+                    serial = ++last_serial;
+                }while (serial == 0);
+                dbus_message_set_serial (m, serial);
+                dbus_message_set_sender (m, name.c_str());
+                dbus_message_lock (m);
+            }
+            return serial;
+        }
+    };
+
+
+    //--------------------------------------------------------------------------
+    // Latency of the methods handled by a connection.
+    // The method and the time of each received method call are kept
+    // until a reply is sent, in the order they were received.
+    // Calls without a reply are dropped after a minute.
+    //--------------------------------------------------------------------------
+    struct Connection::method_tracker {
+        static constexpr std::size_t max_methods = 1024;
+        static constexpr std::size_t max_calls = 65536;
+        static constexpr uint64_t max_call_age = 60000000000ULL; // nanoseconds
+
+        struct method_t {
+            std::string interface;
+            std::string method;
+            std::atomic<uint64_t> errors {0};
+            latency_histogram latency;
+        };
+        // Ordered by interface and method, looked up by string views
+        struct method_less {
+            using is_transparent = void;
+            template<typename A, typename B>
+            bool operator() (const A& a, const B& b) const {
+                int cmp = std::string_view(a.first).compare (b.first);
+                return cmp ? cmp < 0 : std::string_view(a.second) < std::string_view(b.second);
+            }
+        };
+        using method_key = std::pair<std::string, std::string>;
+
+        struct call_key {
+            std::string sender;
+            uint32_t serial;
+            bool operator== (const call_key& rhs) const {
+                return serial == rhs.serial && sender == rhs.sender;
+            }
+        };
+        struct call_key_hash {
+            std::size_t operator() (const call_key& key) const {
+                return WorkerPool::key(key.sender.c_str()) ^
+                    ((std::size_t)key.serial * 0x9e3779b97f4a7c15ULL);
+            }
+        };
+        struct call_t {
+            uint64_t received_at;
+            method_t* m;
+            const call_key* key; // Key in the calls map
+        };
+
+        std::mutex mutex;
+        std::map<method_key, std::unique_ptr<method_t>, method_less> methods;
+        std::list<call_t> call_order; // Oldest call first
+        std::unordered_map<call_key, std::list<call_t>::iterator, call_key_hash> calls;
+
+        void call_received (DBusMessage* msg) {
+            auto* sender = dbus_message_get_sender (msg);
+            auto now = now_ns ();
+
+            std::lock_guard<std::mutex> lock (mutex);
+            drop_old_calls (now);
+            if (calls.size() >= max_calls)
+                return;
+            auto* m = method (msg);
+            if (!m)
+                return;
+            auto result = calls.emplace (call_key{sender ? sender : "",
+                                                  dbus_message_get_serial(msg)},
+                                         call_order.end());
+            if (!result.second)
+                return;
+            call_order.push_back (call_t{now, m, &result.first->first});
+            result.first->second = std::prev (call_order.end());
+        }
+
+        void reply_sent (DBusMessage* reply) {
+            auto* destination = dbus_message_get_destination (reply);
+            call_key key {destination ? destination : "",
+                          dbus_message_get_reply_serial(reply)};
+            bool error = dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR;
+            call_t call;
+            {
+                std::lock_guard<std::mutex> lock (mutex);
+                auto entry = calls.find (key);
+                if (entry == calls.end())
+                    return;
+                call = *entry->second;
+                call_order.erase (entry->second);
+                calls.erase (entry);
+            }
+            // Not a method handled by the connection
+            if (error && dbus_message_is_error(reply, DBUS_ERROR_UNKNOWN_METHOD))
+                return;
+            call.m->latency.record (now_ns() - call.received_at);
+            if (error)
+                call.m->errors.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        // Called with the mutex locked
+        method_t* method (DBusMessage* msg) {
+            auto* iface = dbus_message_get_interface (msg);
+            auto* member = dbus_message_get_member (msg);
+            std::pair<std::string_view, std::string_view> key {iface ? iface : "",
+                                                               member ? member : ""};
+            auto entry = methods.find (key);
+            if (entry != methods.end())
+                return entry->second.get ();
+            if (methods.size() >= max_methods)
+                return nullptr;
+            auto* m = new method_t;
+            m->interface = key.first;
+            m->method = key.second;
+            methods.emplace (method_key(m->interface, m->method), std::unique_ptr<method_t>(m));
+            return m;
+        }
+
+        // Called with the mutex locked
+        void drop_old_calls (uint64_t now) {
+            while (!call_order.empty() &&
+                   now - call_order.front().received_at > max_call_age)
+            {
+                calls.erase (*call_order.front().key);
+                call_order.pop_front ();
+            }
+        }
+    };
 
 
     //--------------------------------------------------------------------------
@@ -43,8 +313,16 @@ namespace ultrabus {
           private_connection {false},
           ioh (new iomultiplex::default_iohandler(SIGRTMIN)),
           internal_io_handler {true},
+          send_queue_signaled {false},
+          wakeup_fd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
           io_timers (new iomultiplex::timer_set(*ioh))
     {
+        if (wakeup_fd < 0) {
+            auto errnum = errno;
+            delete io_timers;
+            delete ioh;
+            throw std::system_error (errnum, std::generic_category());
+        }
         dbus_threads_init_default ();
     }
 
@@ -56,8 +334,34 @@ namespace ultrabus {
           private_connection {false},
           ioh (&io_handler),
           internal_io_handler {false},
+          send_queue_signaled {false},
+          wakeup_fd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
           io_timers (new iomultiplex::timer_set(*ioh))
     {
+        if (wakeup_fd < 0) {
+            auto errnum = errno;
+            delete io_timers;
+            throw std::system_error (errnum, std::generic_category());
+        }
+        dbus_threads_init_default ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    Connection::Connection (external_loop_t)
+        : conn {nullptr},
+          private_connection {false},
+          ioh (nullptr),
+          internal_io_handler {false},
+          send_queue_signaled {false},
+          wakeup_fd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+          io_timers (nullptr)
+    {
+        if (wakeup_fd < 0) {
+            auto errnum = errno;
+            throw std::system_error (errnum, std::generic_category());
+        }
         dbus_threads_init_default ();
     }
 
@@ -67,9 +371,13 @@ namespace ultrabus {
     Connection::~Connection ()
     {
         disconnect ();
+        // Messages queued after disconnect() handed the send
+        // queue to the I/O handler gets an error reply.
+        drain_send_queue ();
         delete io_timers;
         if (internal_io_handler)
             delete ioh;
+        close (wakeup_fd);
     }
 
 
@@ -95,226 +403,1855 @@ namespace ultrabus {
         if (!conn)
             return -1;
 
-        dbus_connection_set_exit_on_disconnect (conn, exit_on_disconnect);
+        dbus_connection_set_exit_on_disconnect (conn, exit_on_disconnect);
+
+        start_message_dispatcher ();
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int Connection::connect (const std::string& bus_address,
+                             const int timeout,
+                             const bool private_connection,
+                             const bool exit_on_disconnect)
+    {
+        if (open_bus(bus_address, private_connection, exit_on_disconnect))
+            return -1;
+
+        // Register the connection with the bus
+        //
+        Message hello_msg (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "Hello");
+        Message reply (static_cast<DBusMessage*>(nullptr));
+        if (ioh) {
+            reply = send_and_wait (hello_msg, timeout);
+        }else{
+            // An external event loop isn't run until connect()
+            // returns, let libdbus block for the reply.
+            auto* r = dbus_connection_send_with_reply_and_block (conn, hello_msg.handle(),
+                                                                 timeout, nullptr);
+            if (!r) {
+                disconnect ();
+                return -1;
+            }
+            reply = Message (r);
+            reply.dec_ref (); // ref count increased in Message constructor
+        }
+        if (!set_unique_name(reply)) {
+            disconnect ();
+            return -1;
+        }
+
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Connect to a bus address without registering with the bus
+    //--------------------------------------------------------------------------
+    int Connection::open_bus (const std::string& bus_address,
+                              const bool private_connection,
+                              const bool exit_on_disconnect)
+    {
+        if (is_connected()) {
+            // TBD
+            return -1;
+        }
+
+        this->private_connection = private_connection;
+
+        if (private_connection)
+            conn = dbus_connection_open_private (bus_address.c_str(), nullptr);
+        else
+            conn = dbus_connection_open (bus_address.c_str(), nullptr);
+        if (!conn)
+            return -1;
+
+        dbus_connection_set_exit_on_disconnect (conn, exit_on_disconnect);
+
+        start_message_dispatcher ();
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Set the unique bus name from the reply to Hello
+    //--------------------------------------------------------------------------
+    bool Connection::set_unique_name (Message& hello_reply)
+    {
+        if (!conn || hello_reply.is_error())
+            return false;
+
+        dbus_basic id_arg ("");
+        if (!hello_reply.get_args(&id_arg, nullptr) || id_arg.str().empty())
+            return false;
+        dbus_bus_set_unique_name (conn, id_arg.str().c_str());
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int Connection::connect_peer (const std::string& address,
+                                  const bool exit_on_disconnect)
+    {
+        if (is_connected())
+            return -1;
+
+        auto* c = dbus_connection_open_private (address.c_str(), nullptr);
+        if (!c)
+            return -1;
+
+        auto result = attach (c, exit_on_disconnect);
+        if (result)
+            dbus_connection_close (c);
+        dbus_connection_unref (c);
+        return result;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int Connection::attach (DBusConnection* connection,
+                            const bool exit_on_disconnect)
+    {
+        if (is_connected() || !connection)
+            return -1;
+
+        private_connection = true;
+        conn = dbus_connection_ref (connection);
+
+        dbus_connection_set_exit_on_disconnect (conn, exit_on_disconnect);
+
+        start_message_dispatcher ();
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int Connection::connect_loopback (Connection& peer)
+    {
+        if (&peer == this || is_connected() || peer.is_connected())
+            return -1;
+
+        // Release what is left of a connection closed by the other end
+        disconnect ();
+        peer.disconnect ();
+
+        auto link = std::make_shared<loopback_link> ();
+        std::atomic_store (&loop, std::make_shared<loopback_t>(link, 0));
+        std::atomic_store (&peer.loop, std::make_shared<loopback_t>(link, 1));
+        {
+            std::lock_guard<std::mutex> lock (link->mutex);
+            link->ends[0] = this;
+            link->ends[1] = &peer;
+        }
+
+        start_message_dispatcher ();
+        peer.start_message_dispatcher ();
+        return 0;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    bool Connection::is_connected () const
+    {
+        auto l = loop_ref ();
+        if (l)
+            return !l->peer_closed;
+        return conn!=nullptr && dbus_connection_get_is_connected(conn)==TRUE;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::disconnect ()
+    {
+        if (!conn && !loop_ref())
+            return;
+
+        trace_buffer::record (trace_event::disconnect, this);
+
+        // Let the thread running the I/O handler send the queued messages
+        // and fail the pending calls. If it doesn't pick up the request
+        // in time it has most likely stopped, then the request is
+        // withdrawn and it is done below instead.
+        bool io_handled = false;
+        if (io_context_elsewhere()) {
+            io_handled = true;
+            fail_calls_request.store (fail_calls_requested, std::memory_order_release);
+            uint64_t value = 1; // Always write, the queue may already be signaled
+            if (write(wakeup_fd, &value, sizeof(value)) < 0)
+                trace_buffer::record (trace_event::error, this, 0, errno);
+            auto deadline = now_ms() + disconnect_wait_ms;
+            uint32_t state;
+            while ((state = fail_calls_request.load(std::memory_order_acquire)) != 0) {
+                if (state == fail_calls_requested) {
+                    auto now = now_ms ();
+                    if (now >= deadline) {
+                        if (fail_calls_request.compare_exchange_strong(state, 0)) {
+                            io_handled = false;
+                            break;
+                        }
+                        continue; // Picked up by the I/O handler right now
+                    }
+                    futex_wait (fail_calls_request, state, deadline - now);
+                }else{
+                    // The I/O handler is failing the calls, it won't take long
+                    futex_wait (fail_calls_request, state);
+                }
+            }
+        }
+
+        // Stop the internal I/O handler before the connection is released
+        if (internal_io_handler) {
+            ioh->stop ();
+            if (!ioh->same_context())
+                ioh->join ();
+        }
+        {
+            // A new thread may run the I/O handler when reconnected
+            std::lock_guard<std::mutex> lock (io_thread_mutex);
+            io_thread_known = false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            wakeup_conn.reset ();
+            if (ext_active) {
+                ext_active = false;
+                ext_update (wakeup_fd);
+            }
+        }
+
+        if (conn) {
+            dbus_connection_remove_filter (conn, dbus_stats_filter_cb, this);
+            if (private_connection && dbus_connection_get_is_connected(conn))
+                dbus_connection_close (conn);
+            dbus_connection_unref (conn);
+            conn = nullptr;
+        }
+        if (loop)
+            loop_close ();
+
+        // Unless done by the thread running the I/O handler, no
+        // thread runs it any more, or this is its context.
+        if (!io_handled)
+            fail_pending_calls ();
+
+        {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            io_watches.clear ();
+            if (io_timers)
+                io_timers->clear ();
+            io_timeouts.clear ();
+            io_timeout_timer = -1;
+            ext_watches.clear ();
+            for (auto& entry : ext_interest) {
+                if (ext_watch_cb)
+                    ext_watch_cb (entry.first, 0);
+            }
+            ext_interest.clear ();
+        }
+        ext_batch_deadline = 0;
+
+        // Messages still in the send queue gets an error reply
+        if (!io_handled)
+            drain_send_queue ();
+        dispatch_pending = false;
+        dispatch_deferred_at = std::chrono::steady_clock::time_point ();
+        dispatch_backlog_active = false;
+
+        // Wake up anyone waiting for the connection to be writable
+        set_writable ();
+
+        private_connection = false;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string Connection::unique_name () const
+    {
+        const char* id = nullptr;
+        auto l = loop_ref ();
+        if (conn)
+            id = dbus_bus_get_unique_name (conn);
+        else if (l)
+            id = l->name.c_str ();
+        return std::string (id ? id : "");
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    int Connection::send (const Message& msg)
+    {
+        if (wm_reject && wm_above) {
+            errno = EAGAIN;
+            return -1;
+        }
+        auto l = loop_ref ();
+        if (!conn && !l) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        if (batching()) {
+            queue_request (new send_request(msg, nullptr, DBUS_TIMEOUT_USE_DEFAULT));
+            return 0;
+        }
+        if (l) {
+            if (loop_send(*l, msg)) {
+                errno = l->peer_closed ? ENOTCONN : ENOMEM;
+                return -1;
+            }
+            return 0;
+        }
+
+        uint32_t serial = 0;
+        if (dbus_connection_send(conn,
+                                 const_cast<Message&>(msg).handle(),
+                                 &serial))
+        {
+            trace_buffer::record (trace_event::send, this, serial,
+                                  dbus_message_get_type(const_cast<Message&>(msg).handle()));
+            count_sent (const_cast<Message&>(msg).handle());
+            check_watermarks ();
+            return 0;
+        }else{
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    int Connection::send (const Message& msg,
+                          reply_cb_t reply_cb,
+                          int timeout)
+    {
+        if (!reply_cb)
+            return send (msg);
+        if (!conn && !loop_ref()) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        if (wm_reject && wm_above) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        // Make sure we post the message in the scope of the worker thread
+        //
+        if (io_context() && !batching()) {
+            if (send_with_reply(msg, reply_cb, timeout)) {
+                errno = is_connected() ? ENOMEM : ENOTCONN;
+                return -1;
+            }
+        }else{
+            queue_request (new send_request(msg, std::move(reply_cb), timeout));
+        }
+        return 0;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    Message Connection::send_error (int errnum)
+    {
+        switch (errnum) {
+        case EAGAIN:
+            return Message::create_error ("se.ultramarin.ultrabus.Error.EAGAIN",
+                                          "Outgoing queue is above the high watermark");
+        case ENOTCONN:
+            return Message::create_error (DBUS_ERROR_DISCONNECTED, "Not connected");
+        default:
+            return Message::create_error ("se.ultramarin.ultrabus.Error.ENOMEM",
+                                          "Unable to allocate memory for DBus message");
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::begin_batch ()
+    {
+        ++batch_depth;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::flush ()
+    {
+        int depth = batch_depth.load ();
+        while (depth > 0 && !batch_depth.compare_exchange_weak(depth, depth-1))
+            ;
+        if (depth > 1)
+            return; // Still in an outer batch
+
+        if (io_context())
+            drain_send_queue ();
+        else if (!send_queue.empty())
+            wakeup_io_handler ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::batch_window (unsigned max_delay, std::size_t max_messages)
+    {
+        batch_max_delay = max_delay;
+        batch_max_msgs = max_messages;
+        if (max_messages == 0 && !send_queue.empty())
+            wakeup_io_handler (); // Don't keep messages queued from an old window
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    Connection::batch_stats_t Connection::batch_stats () const
+    {
+        batch_stats_t stats;
+        stats.messages = stat_batch_msgs;
+        stats.flushes  = stat_batch_flushes;
+        return stats;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::dispatch_budget (unsigned max_messages, unsigned max_usec)
+    {
+        dispatch_max_msgs = max_messages;
+        dispatch_max_usec = max_usec;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::busy_poll (unsigned usec)
+    {
+        busy_poll_usec = usec;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    Connection::dispatch_stats_t Connection::dispatch_stats () const
+    {
+        dispatch_stats_t stats;
+        stats.messages          = stat_dispatch_msgs;
+        stats.passes            = stat_dispatch_passes;
+        stats.deferred          = stat_dispatch_deferred;
+        stats.max_pass_messages = stat_dispatch_max_msgs;
+        stats.total_pass_usec   = stat_dispatch_total_usec;
+        stats.max_pass_usec     = stat_dispatch_max_usec;
+        stats.max_defer_usec    = stat_dispatch_max_defer_usec;
+        stats.backlog           = stat_dispatch_backlog;
+        stats.max_backlog       = stat_dispatch_max_backlog;
+        stats.busy_poll_hits    = stat_busy_poll_hits;
+        stats.busy_poll_misses  = stat_busy_poll_misses;
+        return stats;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    const Connection::message_stats_t& Connection::stats_t::type (int message_type) const
+    {
+        switch (message_type) {
+        case DBUS_MESSAGE_TYPE_METHOD_CALL:
+            return method_calls;
+        case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+            return method_returns;
+        case DBUS_MESSAGE_TYPE_ERROR:
+            return errors;
+        case DBUS_MESSAGE_TYPE_SIGNAL:
+            return signals;
+        default:
+            throw std::out_of_range ("Invalid message type");
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    Connection::stats_t Connection::stats () const
+    {
+        stats_t stats;
+        message_stats_t* types[4] = {
+            &stats.method_calls, &stats.method_returns, &stats.errors, &stats.signals
+        };
+        for (int i=0; i<4; ++i) {
+            types[i]->sent          = stat_msgs[i].sent.load (std::memory_order_relaxed);
+            types[i]->received      = stat_msgs[i].received.load (std::memory_order_relaxed);
+            types[i]->dispatch_time = stat_msgs[i].dispatch_time.get ();
+        }
+        stats.method_returns.round_trip = stat_return_time.get ();
+        stats.errors.round_trip         = stat_error_time.get ();
+
+        stats.bytes_sent     = stat_bytes_sent.load (std::memory_order_relaxed);
+        stats.bytes_received = stat_bytes_received.load (std::memory_order_relaxed);
+        stats.pending_calls  = stat_pending.load (std::memory_order_relaxed);
+        stats.timeouts       = stat_timeouts.load (std::memory_order_relaxed);
+        stats.batch          = batch_stats ();
+        stats.dispatch       = dispatch_stats ();
+        stats.cpu_messages.reserve (stat_cpu_msgs.size());
+        for (auto& count : stat_cpu_msgs)
+            stats.cpu_messages.push_back (count.load(std::memory_order_relaxed));
+        return stats;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::reset_stats ()
+    {
+        for (auto& m : stat_msgs) {
+            m.sent = 0;
+            m.received = 0;
+            m.dispatch_time.reset ();
+        }
+        stat_return_time.reset ();
+        stat_error_time.reset ();
+        stat_bytes_sent = 0;
+        stat_bytes_received = 0;
+        stat_timeouts = 0;
+        for (auto& count : stat_cpu_msgs)
+            count = 0;
+
+        if (track_methods_flag.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock (methods->mutex);
+            for (auto& entry : methods->methods) {
+                entry.second->errors = 0;
+                entry.second->latency.reset ();
+            }
+        }
+
+        stat_batch_msgs = 0;
+        stat_batch_flushes = 0;
+        stat_dispatch_msgs = 0;
+        stat_dispatch_passes = 0;
+        stat_dispatch_deferred = 0;
+        stat_dispatch_max_msgs = 0;
+        stat_dispatch_total_usec = 0;
+        stat_dispatch_max_usec = 0;
+        stat_dispatch_max_defer_usec = 0;
+        stat_dispatch_backlog = 0;
+        stat_dispatch_max_backlog = 0;
+        stat_busy_poll_hits = 0;
+        stat_busy_poll_misses = 0;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::count_bytes (bool enable)
+    {
+        stat_count_bytes = enable;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::track_methods (bool enable)
+    {
+        if (enable) {
+            std::lock_guard<std::mutex> lock (method_tracker_mutex);
+            if (!methods)
+                methods.reset (new method_tracker);
+        }
+        track_methods_flag.store (enable, std::memory_order_release);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::vector<Connection::method_stats_t> Connection::method_stats () const
+    {
+        std::vector<method_stats_t> result;
+        {
+            std::lock_guard<std::mutex> lock (method_tracker_mutex);
+            if (!methods)
+                return result;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock (methods->mutex);
+            result.reserve (methods->methods.size());
+            for (auto& entry : methods->methods) {
+                auto& m = *entry.second;
+                auto latency = m.latency.get ();
+                // Skip methods not handled by the connection
+                if (!latency.count())
+                    continue;
+                result.push_back ({m.interface,
+                                   m.method,
+                                   m.errors.load(std::memory_order_relaxed),
+                                   std::move(latency)});
+            }
+        }
+        std::sort (result.begin(), result.end(),
+                   [](const method_stats_t& a, const method_stats_t& b) {
+                       return a.interface != b.interface ?
+                           a.interface < b.interface : a.method < b.method;
+                   });
+        return result;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::size_t Connection::outgoing_size () const
+    {
+        if (!conn)
+            return 0;
+        return (std::size_t) dbus_connection_get_outgoing_size (conn);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::size_t Connection::outgoing_queued () const
+    {
+        return send_queue_size;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::outgoing_watermarks (std::size_t high,
+                                          std::size_t low,
+                                          watermark_cb_t cb,
+                                          bool reject)
+    {
+        {
+            std::lock_guard<std::mutex> lock (wm_mutex);
+            wm_cb = std::move (cb);
+        }
+        wm_low = low < high ? low : high;
+        wm_high = high;
+        wm_reject = reject;
+        check_watermarks ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::on_writable (std::function<void ()> cb)
+    {
+        if (cb && !add_writable_waiter(std::move(cb)))
+            cb ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    bool Connection::add_writable_waiter (std::function<void ()>&& cb)
+    {
+        std::lock_guard<std::mutex> lock (wm_mutex);
+        if (!wm_above)
+            return false;
+        writable_waiters.emplace_back (std::move(cb));
+        return true;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::check_watermarks ()
+    {
+        std::size_t high = wm_high;
+        if (!high) {
+            if (wm_above)
+                set_writable ();
+            return;
+        }
+
+        auto size = outgoing_size ();
+        if (!wm_above) {
+            if (size > high) {
+                watermark_cb_t cb;
+                {
+                    std::lock_guard<std::mutex> lock (wm_mutex);
+                    if (wm_above.exchange(true))
+                        return;
+                    cb = wm_cb;
+                }
+                if (cb)
+                    cb (true);
+            }
+        }
+        else if (size <= wm_low) {
+            set_writable ();
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::set_writable ()
+    {
+        watermark_cb_t cb;
+        std::vector<std::function<void ()>> waiters;
+        {
+            std::lock_guard<std::mutex> lock (wm_mutex);
+            if (!wm_above.exchange(false))
+                return;
+            cb = wm_cb;
+            waiters.swap (writable_waiters);
+        }
+        if (cb)
+            cb (false);
+        for (auto& waiter : waiters)
+            waiter ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::count_sent (DBusMessage* msg, bool loopback)
+    {
+        auto type = dbus_message_get_type (msg);
+        if (type > 0 && type <= 4)
+            stat_msgs[type-1].sent.fetch_add (1, std::memory_order_relaxed);
+        if ((type == DBUS_MESSAGE_TYPE_METHOD_RETURN || type == DBUS_MESSAGE_TYPE_ERROR) &&
+            track_methods_flag.load(std::memory_order_acquire))
+        {
+            methods->reply_sent (msg);
+        }
+        if (!loopback && stat_count_bytes.load(std::memory_order_relaxed))
+            stat_bytes_sent.fetch_add (message_size(msg), std::memory_order_relaxed);
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Count a received message, and remember its type for
+    // the dispatch time. Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::count_received (DBusMessage* msg)
+    {
+        auto type = dbus_message_get_type (msg);
+        if (type <= 0 || type > 4)
+            return;
+        dispatch_msg_type = type;
+        stat_msgs[type-1].received.fetch_add (1, std::memory_order_relaxed);
+        auto cpu = thread_options::current_cpu ();
+        if (cpu >= 0 && (std::size_t)cpu < stat_cpu_msgs.size())
+            stat_cpu_msgs[cpu].fetch_add (1, std::memory_order_relaxed);
+        if (type == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+            !dbus_message_get_no_reply(msg) &&
+            track_methods_flag.load(std::memory_order_acquire))
+        {
+            methods->call_received (msg);
+        }
+        if (!loop && stat_count_bytes.load(std::memory_order_relaxed))
+            stat_bytes_received.fetch_add (message_size(msg), std::memory_order_relaxed);
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Count a reply to a pending call.
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::count_reply (DBusMessage* reply, uint64_t sent_at)
+    {
+        count_received (reply);
+        auto rtt = now_ns() - sent_at;
+        if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+            stat_error_time.record (rtt);
+            if (dbus_message_is_error(reply, DBUS_ERROR_NO_REPLY))
+                stat_timeouts.fetch_add (1, std::memory_order_relaxed);
+        }else{
+            stat_return_time.record (rtt);
+        }
+        update_pending ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::update_pending ()
+    {
+        std::size_t pending = pending_calls.size ();
+        if (loop)
+            pending += loop->calls.size ();
+        stat_pending.store (pending, std::memory_order_relaxed);
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Give the pending calls a Disconnected error reply.
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::fail_pending_calls ()
+    {
+        std::vector<pending_msg_cb_t> callbacks;
+        pending_calls.take_all (callbacks);
+        update_pending ();
+
+        for (auto& cb : callbacks) {
+            if (!cb)
+                continue;
+            auto reply = Message::create_error (DBUS_ERROR_DISCONNECTED, "Connection is closed");
+            cb (reply);
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::executor (std::shared_ptr<WorkerPool> pool, dispatch_order order)
+    {
+        std::lock_guard<std::mutex> lock (executor_mutex);
+        executor_pool = std::move (pool);
+        executor_order = order;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::shared_ptr<WorkerPool> Connection::executor () const
+    {
+        std::lock_guard<std::mutex> lock (executor_mutex);
+        return executor_pool;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::size_t Connection::executor_key (Message& msg) const
+    {
+        if (executor_order == dispatch_order::path)
+            return WorkerPool::key (dbus_message_get_path(msg.handle()));
+        else
+            return WorkerPool::key (dbus_message_get_sender(msg.handle()));
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    int Connection::io_thread_options (const thread_options& options)
+    {
+        if (externally_driven())
+            return -1; // The application owns the thread
+
+        std::lock_guard<std::mutex> lock (io_thread_mutex);
+        io_thread_opts = options;
+        io_thread_errno = 0;
+        if (!io_thread_known)
+            return 0; // Applied by init_io_thread()
+        if (io_thread_opts.apply(io_thread)) {
+            io_thread_errno = errno;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    int Connection::io_thread_error () const
+    {
+        return io_thread_errno;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::on_watch_change (watch_cb_t cb)
+    {
+        std::lock_guard<std::mutex> lock (io_mutex);
+        ext_watch_cb = std::move (cb);
+        if (ext_watch_cb) {
+            for (auto& entry : ext_interest)
+                ext_watch_cb (entry.first, entry.second);
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::vector<Connection::watch_t> Connection::watches () const
+    {
+        std::vector<watch_t> result;
+        std::lock_guard<std::mutex> lock (io_mutex);
+        result.reserve (ext_interest.size());
+        for (auto& entry : ext_interest)
+            result.push_back ({entry.first, entry.second});
+        return result;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    int Connection::next_timeout () const
+    {
+        uint64_t next;
+        {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            next = io_timeouts.next_expiry ();
+        }
+        if (loop)
+            next = std::min (next, loop->timeouts.next_expiry());
+        uint64_t batch = ext_batch_deadline;
+        if (batch)
+            next = std::min (next, batch);
+
+        if (next == timer_wheel::no_expiry)
+            return -1;
+        auto now = now_ms ();
+        if (next <= now)
+            return 0;
+        return (int) std::min<uint64_t> (next - now, INT_MAX);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::process_ready (int fd, uint32_t events)
+    {
+        ext_thread = std::this_thread::get_id ();
+
+        if (fd == wakeup_fd) {
+            if (events & (POLLIN | POLLERR | POLLHUP))
+                process_wakeup ();
+            return;
+        }
+
+        // Find the watches first, libdbus may add and remove
+        // watches when a watch is handled. There is normally
+        // one watch for reading and one for writing per fd.
+        struct {
+            DBusWatch* watch;
+            unsigned condition;
+        } ready[4];
+        std::size_t num_ready = 0;
+        {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            for (auto& entry : ext_watches) {
+                if (entry.second != fd || !dbus_watch_get_enabled(entry.first))
+                    continue;
+                auto flags = dbus_watch_get_flags (entry.first);
+                unsigned condition = 0;
+                if ((flags & DBUS_WATCH_READABLE) && (events & POLLIN))
+                    condition |= DBUS_WATCH_READABLE;
+                if ((flags & DBUS_WATCH_WRITABLE) && (events & POLLOUT))
+                    condition |= DBUS_WATCH_WRITABLE;
+                if (events & POLLERR)
+                    condition |= DBUS_WATCH_ERROR;
+                if (events & POLLHUP)
+                    condition |= DBUS_WATCH_HANGUP;
+                if (condition && num_ready < sizeof(ready)/sizeof(ready[0]))
+                    ready[num_ready++] = {entry.first, condition};
+            }
+        }
+
+        bool readable = false;
+        bool writable = false;
+        for (std::size_t i=0; i<num_ready; ++i) {
+            {
+                std::lock_guard<std::mutex> lock (io_mutex);
+                if (ext_watches.find(ready[i].watch) == ext_watches.end())
+                    continue; // Removed when another watch was handled
+            }
+            if (ready[i].condition & DBUS_WATCH_WRITABLE) {
+                trace_buffer::record (trace_event::watch_tx, this, 0, fd);
+                writable = true;
+            }else{
+                trace_buffer::record (trace_event::watch_rx, this, 0, fd);
+                readable = true;
+            }
+            dbus_watch_handle (ready[i].watch, ready[i].condition);
+        }
+
+        if (writable)
+            check_watermarks ();
+        if (readable)
+            dispatch_messages ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::process_timeouts ()
+    {
+        ext_thread = std::this_thread::get_id ();
+        auto now = now_ms ();
+
+        bool expired;
+        {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            expired = io_timeouts.next_expiry() <= now;
+        }
+        if (expired)
+            on_timeout_timer ();
+
+        if (loop && loop->timeouts.next_expiry() <= now)
+            loop_on_timer ();
+
+        // End of a coalescing window of batched messages
+        uint64_t batch = ext_batch_deadline;
+        if (batch && batch <= now && ext_batch_deadline.compare_exchange_strong(batch, 0))
+            drain_send_queue ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    bool Connection::add_filter (DBusHandleMessageFunction function, void* data)
+    {
+        if (conn)
+            return dbus_connection_add_filter (conn, function, data, nullptr);
+        auto l = loop_ref ();
+        if (!l)
+            return false;
+
+        std::lock_guard<std::mutex> lock (l->reg_mutex);
+        auto filters = std::make_shared<std::vector<loopback_t::filter_t>> (*l->filters);
+        filters->push_back ({function, data});
+        l->filters = std::move (filters);
+        return true;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::remove_filter (DBusHandleMessageFunction function, void* data)
+    {
+        if (conn) {
+            dbus_connection_remove_filter (conn, function, data);
+            return;
+        }
+        auto l = loop_ref ();
+        if (!l)
+            return;
+
+        std::lock_guard<std::mutex> lock (l->reg_mutex);
+        auto filters = std::make_shared<std::vector<loopback_t::filter_t>> (*l->filters);
+        // Remove the most recently added match, like libdbus
+        for (auto i=filters->rbegin(); i!=filters->rend(); ++i) {
+            if (i->function == function && i->data == data) {
+                filters->erase (std::next(i).base());
+                l->filters = std::move (filters);
+                break;
+            }
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    bool Connection::register_object_path (const std::string& path,
+                                           const DBusObjectPathVTable* vtable,
+                                           void* data,
+                                           bool fallback)
+    {
+        if (conn) {
+            if (fallback)
+                return dbus_connection_try_register_fallback (conn, path.c_str(), vtable, data, nullptr);
+            else
+                return dbus_connection_try_register_object_path (conn, path.c_str(), vtable, data, nullptr);
+        }
+        auto l = loop_ref ();
+        if (!l || !vtable || path.empty() || path[0] != '/')
+            return false;
+
+        std::lock_guard<std::mutex> lock (l->reg_mutex);
+        return l->objects.emplace(path, loopback_t::object_t{vtable, data, fallback}).second;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::unregister_object_path (const std::string& path)
+    {
+        if (conn) {
+            dbus_connection_unregister_object_path (conn, path.c_str());
+            return;
+        }
+        auto l = loop_ref ();
+        if (!l)
+            return;
+
+        loopback_t::object_t obj;
+        {
+            std::lock_guard<std::mutex> lock (l->reg_mutex);
+            auto entry = l->objects.find (path);
+            if (entry == l->objects.end())
+                return;
+            obj = entry->second;
+            l->objects.erase (entry);
+        }
+        if (obj.vtable->unregister_function)
+            obj.vtable->unregister_function (nullptr, obj.data);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    bool Connection::batching () const
+    {
+        return batch_depth.load() > 0 || batch_max_msgs.load() > 0;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::queue_request (send_request* req, bool bypass_batch)
+    {
+        ++send_queue_size;
+        send_queue.push (req);
+
+        if (bypass_batch) {
+            // Someone is waiting for the reply, send all queued messages now
+            wakeup_io_handler ();
+            return;
+        }
+        if (batch_depth.load() > 0)
+            return; // Sent when the batch is flushed
+
+        std::size_t max_msgs = batch_max_msgs;
+        if (max_msgs > 0) {
+            auto count = ++batch_count;
+            if (count >= max_msgs) {
+                wakeup_io_handler ();
+            }
+            else if (count == 1) {
+                // First message in the coalescing window
+                if (!ioh) {
+                    ext_batch_deadline = now_ms() + batch_max_delay;
+                    ext_poke ();
+                    return;
+                }
+                batch_timer = io_timers->set (batch_max_delay, [this](iomultiplex::timer_set& ts, long timer_id)
+                    {
+                        // Not if the window is already flushed
+                        if (batch_timer.compare_exchange_strong(timer_id, -1))
+                            wakeup_io_handler ();
+                    });
+            }
+            return;
+        }
+
+        wakeup_io_handler ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    int Connection::send_with_reply (const Message& msg,
+                                     pending_msg_cb_t& reply_cb,
+                                     int timeout)
+    {
+        if (loop)
+            return loop_send_with_reply (msg, reply_cb, timeout);
+
+        DBusMessage* m = const_cast<Message&>(msg).handle();
+        bool copied = false;
+
+        // A message that already has a serial number has been sent
+        // before. Send a copy to get a new serial number since the
+        // serial is used as key for the pending call.
+        if (dbus_message_get_serial(m) != 0) {
+            m = dbus_message_copy (m);
+            if (!m)
+                return -1;
+            copied = true;
+        }
+
+        DBusPendingCall* pending = nullptr;
+        auto sent_at = now_ns ();
+        bool result = dbus_connection_send_with_reply (conn, m, &pending, timeout);
+        uint32_t serial = dbus_message_get_serial (m);
+        if (result)
+            count_sent (m);
+        if (copied)
+            dbus_message_unref (m);
+        if (!result || !pending)
+            return -1;
+
+        if (!pending_calls.insert(serial, pending, std::move(reply_cb), sent_at)) {
+            dbus_pending_call_cancel (pending);
+            dbus_pending_call_unref (pending);
+            return -1;
+        }
+        update_pending ();
+        trace_buffer::record (trace_event::send_with_reply, this, serial, timeout);
+        dbus_pending_call_set_notify (pending, dbus_pending_msg_cb, this, nullptr);
+        return 0;
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Check if called in the context of the I/O handler, or
+    // by the thread running an external event loop.
+    //-----------------------------------------------------------------------
+    bool Connection::io_context () const
+    {
+        if (ioh)
+            return ioh->same_context ();
+        return ext_thread.load() == std::this_thread::get_id ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Check if another thread than the caller is known to run the
+    // I/O handler, or the external event loop.
+    //-----------------------------------------------------------------------
+    bool Connection::io_context_elsewhere ()
+    {
+        if (io_context())
+            return false;
+        if (ioh) {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            return io_thread_known.load() && wakeup_conn != nullptr;
+        }
+        std::lock_guard<std::mutex> lock (io_mutex);
+        return ext_thread.load() != std::thread::id() && ext_active;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::wakeup_io_handler ()
+    {
+        // Only the first message put in an empty queue needs to wake up the I/O handler
+        if (!send_queue_signaled.exchange(true)) {
+            uint64_t value = 1;
+            if (write(wakeup_fd, &value, sizeof(value)) < 0)
+                trace_buffer::record (trace_event::error, this, 0, errno);
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::process_wakeup ()
+    {
+        trace_buffer::record (trace_event::wakeup, this);
+
+        if (ioh && !io_thread_known.load(std::memory_order_acquire))
+            init_io_thread ();
+
+        uint64_t value;
+        if (read(wakeup_fd, &value, sizeof(value)) < 0)
+            trace_buffer::record (trace_event::error, this, 0, errno);
+
+        uint32_t requested = fail_calls_requested;
+        if (fail_calls_request.compare_exchange_strong(requested, fail_calls_taken)) {
+            // Requested by disconnect() in another thread
+            drain_send_queue ();
+            fail_pending_calls ();
+            fail_calls_request.store (0, std::memory_order_release);
+            futex_wake (fail_calls_request);
+        }
+
+        // Not signaled when only woken up to see a new timeout
+        if (send_queue_signaled.exchange(false))
+            drain_send_queue ();
+        if (dispatch_pending.exchange(false))
+            dispatch_messages ();
+        if (loop && loop->peer_closed)
+            loop_fail_calls (); // The other end is disconnected
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Remember the thread running the I/O handler, and apply
+    // the thread options. Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::init_io_thread ()
+    {
+        std::lock_guard<std::mutex> lock (io_thread_mutex);
+        io_thread = pthread_self ();
+        io_thread_known.store (true, std::memory_order_release);
+        if (!io_thread_opts.empty() && io_thread_opts.apply(io_thread)) {
+            io_thread_errno = errno;
+            trace_buffer::record (trace_event::error, this, 0, errno);
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::on_wakeup (iomultiplex::io_result_t& ior)
+    {
+        process_wakeup ();
+        busy_poll_spin ();
+
+        std::lock_guard<std::mutex> lock (io_mutex);
+        if (wakeup_conn) {
+            ior.conn.wait_for_rx ([this](iomultiplex::io_result_t& ior)->bool
+                {
+                    if (!ior.errnum)
+                        on_wakeup (ior);
+                    return false;
+                });
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void Connection::drain_send_queue ()
+    {
+        uint64_t count = 0;
+        mpsc_queue::node* node;
+
+        // The coalescing window ends here
+        batch_count = 0;
+        ext_batch_deadline = 0;
+        auto timer_id = batch_timer.exchange (-1);
+        if (timer_id >= 0)
+            io_timers->cancel (timer_id);
+        while ((node = send_queue.pop()) != nullptr) {
+            auto req = static_cast<send_request*> (node);
+            // Requests not allocated by queue_request() are owned by a
+            // thread in send_and_wait() and may be reused as soon as
+            // the reply callback is called.
+            std::unique_ptr<send_request> owner (req->allocated ? req : nullptr);
+            --send_queue_size;
+            ++count;
+            if (!req->reply_cb) {
+                // No reply expected
+                uint32_t serial = 0;
+                if (conn && dbus_connection_send(conn, req->msg.handle(), &serial)) {
+                    trace_buffer::record (trace_event::send, this, serial,
+                                          dbus_message_get_type(req->msg.handle()));
+                    count_sent (req->msg.handle());
+                }
+                else if (loop)
+                    loop_send (*loop, req->msg);
+            }
+            else if (!conn && !loop) {
+                auto reply = Message::create_error (DBUS_ERROR_DISCONNECTED,
+                                                    "Not connected");
+                auto cb = std::move (req->reply_cb);
+                cb (reply);
+            }
+            else if (send_with_reply(req->msg, req->reply_cb, req->timeout)) {
+                auto reply = Message::create_error ("se.ultramarin.ultrabus.Error.ENOMEM",
+                                                    "Unable to allocate memory for DBus message");
+                auto cb = std::move (req->reply_cb);
+                cb (reply);
+            }
+        }
+
+        if (count) {
+            stat_batch_msgs += count;
+            ++stat_batch_flushes;
+            check_watermarks ();
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::dispatch_messages ()
+    {
+        if (!conn && !loop)
+            return;
+
+        using namespace std::chrono;
+        unsigned max_msgs = dispatch_max_msgs.load (std::memory_order_relaxed);
+        unsigned max_usec = dispatch_max_usec.load (std::memory_order_relaxed);
+        auto start = steady_clock::now ();
+
+        if (dispatch_deferred_at != steady_clock::time_point()) {
+            // Continue a pass stopped by the dispatch budget
+            uint64_t defer_usec = duration_cast<microseconds>(start - dispatch_deferred_at).count ();
+            dispatch_deferred_at = steady_clock::time_point ();
+            if (defer_usec > stat_dispatch_max_defer_usec.load(std::memory_order_relaxed))
+                stat_dispatch_max_defer_usec.store (defer_usec, std::memory_order_relaxed);
+        }
+
+        trace_buffer::record (trace_event::dispatch_begin, this);
+        uint64_t count = 0;
+        bool data_remains = false;
+        bool more;
+        if (conn)
+            more = dbus_connection_get_dispatch_status(conn) == DBUS_DISPATCH_DATA_REMAINS;
+        else
+            more = !loop->inbox.empty ();
+        // The end of one message is the start of the next,
+        // one clock read per message is enough for the budget
+        // and the dispatch time statistics.
+        auto end = start;
+        // A message handler may disconnect the connection
+        while (more && (conn || loop)) {
+            if ((max_msgs && count >= max_msgs) ||
+                (max_usec && end-start >= microseconds(max_usec)))
+            {
+                data_remains = true;
+                break;
+            }
+            dispatch_msg_type = 0; // Set by count_received()
+            if (conn)
+                more = dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS;
+            else
+                more = loop_dispatch ();
+            auto now = steady_clock::now ();
+            if (dispatch_msg_type) {
+                stat_msgs[dispatch_msg_type-1].dispatch_time.record (
+                        duration_cast<nanoseconds>(now - end).count());
+            }
+            end = now;
+            ++count;
+        }
+
+        trace_buffer::record (trace_event::dispatch_end, this, 0, count);
+        uint64_t usec = duration_cast<microseconds>(end - start).count ();
+        stat_dispatch_msgs.fetch_add (count, std::memory_order_relaxed);
+        stat_dispatch_passes.fetch_add (1, std::memory_order_relaxed);
+        stat_dispatch_total_usec.fetch_add (usec, std::memory_order_relaxed);
+        if (count > stat_dispatch_max_msgs.load(std::memory_order_relaxed))
+            stat_dispatch_max_msgs.store (count, std::memory_order_relaxed);
+        if (usec > stat_dispatch_max_usec.load(std::memory_order_relaxed))
+            stat_dispatch_max_usec.store (usec, std::memory_order_relaxed);
+
+        // The length of the incoming queue isn't known, the backlog
+        // of a deferred pass is counted as the next passes drain it.
+        if (dispatch_backlog_active) {
+            dispatch_backlog_count += count;
+            if (!data_remains) {
+                dispatch_backlog_active = false;
+                stat_dispatch_backlog.store (dispatch_backlog_count, std::memory_order_relaxed);
+                if (dispatch_backlog_count > stat_dispatch_max_backlog.load(std::memory_order_relaxed))
+                    stat_dispatch_max_backlog.store (dispatch_backlog_count, std::memory_order_relaxed);
+            }
+        }
+        else if (data_remains) {
+            dispatch_backlog_active = true;
+            dispatch_backlog_count = 0;
+        }
+
+        if (data_remains) {
+            // Let the I/O handler take care of other events
+            // before the rest of the messages are dispatched.
+            stat_dispatch_deferred.fetch_add (1, std::memory_order_relaxed);
+            dispatch_deferred_at = end;
+            dispatch_pending = true;
+            wakeup_io_handler ();
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Spin with non-blocking reads until a message is received, or
+    // the busy poll time has passed. Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::busy_poll_spin ()
+    {
+        unsigned usec = busy_poll_usec.load (std::memory_order_relaxed);
+        if (!usec || !conn || !ioh || dispatch_pending.load(std::memory_order_relaxed))
+            return;
+
+        auto deadline = std::chrono::steady_clock::now () + std::chrono::microseconds (usec);
+        do {
+            // Send messages queued while spinning
+            if (send_queue_signaled.exchange(false))
+                drain_send_queue ();
+
+            // Read without blocking, returns false when disconnected
+            if (!dbus_connection_read_write(conn, 0))
+                return;
+            if (dbus_connection_get_dispatch_status(conn) == DBUS_DISPATCH_DATA_REMAINS) {
+                stat_busy_poll_hits.fetch_add (1, std::memory_order_relaxed);
+                dispatch_messages ();
+                // Spin again after the I/O handler has
+                // taken care of other pending events.
+                wakeup_io_handler ();
+                return;
+            }
+        } while (std::chrono::steady_clock::now() < deadline);
+
+        stat_busy_poll_misses.fetch_add (1, std::memory_order_relaxed);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    Message Connection::send_and_wait (const Message& msg, int timeout)
+    {
+        // The reply is handled by the I/O handler, it can't wait for it
+        if (io_context()) {
+            return Message::create_error ("se.ultramarin.ultrabus.Error.EDEADLK",
+                                          "Synchronous call in the context of the I/O handler");
+        }
+
+        // Reused by every call from the same thread
+        struct waiter_t {
+            send_request req;
+            std::atomic<uint32_t> done {0};
+            Message reply {static_cast<DBusMessage*>(nullptr)};
+        };
+        static thread_local waiter_t waiter;
+
+        waiter_t* w = &waiter;
+        w->done.store (0, std::memory_order_relaxed);
+        pending_msg_cb_t reply_cb = [w](Message& r)
+            {
+                // Save the reply and wake up the waiting thread
+                w->reply = std::move (r);
+                w->done.store (1, std::memory_order_release);
+                futex_wake (w->done);
+            };
+
+        // Send the message, not held back by a batch
+        if (!conn && !loop_ref())
+            return send_error (ENOTCONN);
+        w->req.msg = Message (const_cast<Message&>(msg).handle()); // Shared, not copied
+        w->req.reply_cb = std::move (reply_cb);
+        w->req.timeout = timeout;
+        queue_request (&w->req, true);
+
+        // Wait for the message reply
+        while (w->done.load(std::memory_order_acquire) == 0)
+            futex_wait (w->done, 0);
 
-        start_message_dispatcher ();
-        return 0;
+        w->req.msg = Message (static_cast<DBusMessage*>(nullptr));
+        return std::move (w->reply);
     }
 
 
-    //--------------------------------------------------------------------------
-    //--------------------------------------------------------------------------
-    int Connection::connect (const std::string& bus_address,
-                             const int timeout,
-                             const bool private_connection,
-                             const bool exit_on_disconnect)
+    //-----------------------------------------------------------------------
+    // The loopback state may be replaced by another thread than the
+    // caller, a snapshot keeps it alive while in use.
+    //-----------------------------------------------------------------------
+    std::shared_ptr<Connection::loopback_t> Connection::loop_ref () const
     {
-        if (is_connected()) {
-            // TBD
-            return -1;
-        }
+        return std::atomic_load (&loop);
+    }
 
-        DBG_LOG ("Connect to bus %s", bus_address.c_str());
 
-        this->private_connection = private_connection;
+    //-----------------------------------------------------------------------
+    // Put a message in the incoming queue of the other end.
+    // May be called in the context of any thread.
+    //-----------------------------------------------------------------------
+    int Connection::loop_send (loopback_t& l, const Message& msg)
+    {
+        auto* m = const_cast<Message&>(msg).handle ();
+        if (!m)
+            return -1;
 
-        // Connect to the bus
-        //
-        if (private_connection)
-            conn = dbus_connection_open_private (bus_address.c_str(), nullptr);
-        else
-            conn = dbus_connection_open (bus_address.c_str(), nullptr);
-        if (!conn)
+        auto& link = *l.link;
+        std::lock_guard<std::mutex> lock (link.mutex);
+        auto* peer = link.ends[l.end ^ 1];
+        if (!peer || !link.ends[l.end])
             return -1;
 
-        dbus_connection_set_exit_on_disconnect (conn, exit_on_disconnect);
+        auto serial = l.prepare (m);
+        trace_buffer::record (trace_event::send, this, serial, dbus_message_get_type(m));
+        count_sent (m, true);
+        peer->loop->inbox.push (new send_request(msg, nullptr, DBUS_TIMEOUT_USE_DEFAULT));
+        peer->dispatch_pending = true;
+        peer->wakeup_io_handler ();
+        return 0;
+    }
 
-        DBG_LOG ("Start message dispatcher");
-        start_message_dispatcher ();
 
-        // Register the connection with the bus
-        //
-        DBG_LOG ("Register the connection with the bus");
-        Message hello_msg (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "Hello");
-        auto reply = send_and_wait (hello_msg, timeout);
-        if (reply.is_error()) {
-            DBG_LOG ("Error registering the connection with the bus: %s - %s",
-                     reply.error_name().c_str(), reply.error_msg().c_str());
-            disconnect ();
+    //-----------------------------------------------------------------------
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    int Connection::loop_send_with_reply (const Message& msg,
+                                          pending_msg_cb_t& reply_cb,
+                                          int timeout)
+    {
+        Message call (const_cast<Message&>(msg).handle()); // Shared, not copied
+        if (!call.handle())
             return -1;
+
+        // A message that already has a serial number has been sent
+        // before. Send a copy to get a new serial number since the
+        // serial is used as key for the pending call.
+        if (dbus_message_get_serial(call.handle()) != 0) {
+            auto* copy = dbus_message_copy (call.handle());
+            if (!copy)
+                return -1;
+            call = Message (copy);
+            call.dec_ref (); // ref count increased in Message constructor
         }
 
-        // Set the unique bus id
-        //
-        dbus_basic id_arg ("");
-        if (reply.get_args(&id_arg, nullptr) && !id_arg.str().empty()) {
-            DBG_LOG ("Got unique bus name: %s", id_arg.str().c_str());
-            dbus_bus_set_unique_name (conn, id_arg.str().c_str());
-        }else{
-            DBG_LOG ("Error registering the connection with the bus: "
-                     "Invalid reply parameter when expecting a bus ID");
-            disconnect ();
+        auto serial = loop->prepare (call.handle());
+        auto result = loop->calls.try_emplace (serial);
+        if (!result.second)
             return -1;
+        trace_buffer::record (trace_event::send_with_reply, this, serial, timeout);
+        auto& pending = result.first->second;
+        pending.serial = serial;
+        pending.sent_at = now_ns ();
+        pending.reply_cb = std::move (reply_cb);
+        update_pending ();
+
+        if (timeout != DBUS_TIMEOUT_INFINITE) {
+            if (timeout < 0)
+                timeout = 25000; // Default timeout in libdbus
+            auto now = now_ms ();
+            loop->timeouts.advance (now);
+            loop->timeouts.add (pending, now + timeout + 1);
+            loop_arm_timer ();
         }
 
+        if (loop_send(*loop, call)) {
+            // The other end is disconnected
+            auto cb = std::move (pending.reply_cb);
+            loop->timeouts.cancel (pending);
+            loop->calls.erase (serial);
+            update_pending ();
+            auto reply = Message::create_error (DBUS_ERROR_DISCONNECTED, "Connection is closed");
+            cb (reply);
+        }
         return 0;
     }
 
 
     //-----------------------------------------------------------------------
+    // Dispatch one incoming message on a loopback connection.
+    // Return true if there are more messages to dispatch.
+    // Called in the context of the I/O handler
     //-----------------------------------------------------------------------
-    bool Connection::is_connected () const
+    bool Connection::loop_dispatch ()
     {
-        return conn!=nullptr && dbus_connection_get_is_connected(conn)==TRUE;
+        auto* node = loop->inbox.pop ();
+        bool more = !loop->inbox.empty ();
+        if (node) {
+            auto* req = static_cast<send_request*> (node);
+            Message msg (std::move(req->msg));
+            delete req;
+            loop_handle_message (msg);
+        }
+        return more;
     }
 
 
     //-----------------------------------------------------------------------
+    // Route an incoming message the same way as libdbus:
+    // replies to pending calls, the Peer interface, message
+    // filters, and last the handler of the object path.
     //-----------------------------------------------------------------------
-    void Connection::disconnect ()
+    void Connection::loop_handle_message (Message& msg)
     {
-        if (!conn)
-            return;
-
-        if (private_connection && dbus_connection_get_is_connected(conn))
-            dbus_connection_close (conn);
-        dbus_connection_unref (conn);
+        auto* m = msg.handle ();
+        auto type = dbus_message_get_type (m);
+
+        if (type == DBUS_MESSAGE_TYPE_METHOD_RETURN || type == DBUS_MESSAGE_TYPE_ERROR) {
+            auto entry = loop->calls.find (dbus_message_get_reply_serial(m));
+            if (entry != loop->calls.end()) {
+                trace_buffer::record (trace_event::reply, this, entry->first, type);
+                auto cb = std::move (entry->second.reply_cb);
+                auto sent_at = entry->second.sent_at;
+                loop->timeouts.cancel (entry->second);
+                loop->calls.erase (entry);
+                count_reply (m, sent_at);
+                cb (msg);
+                return;
+            }
+        }
+        count_received (m);
 
-        pending_msg_mutex.lock ();
-        for (auto& e : pending_messages)
-            dbus_pending_call_unref (e.first);
-        pending_messages.clear ();
-        pending_msg_mutex.unlock ();
+        bool no_reply = dbus_message_get_no_reply (m);
+        if (type == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+            dbus_message_has_interface(m, DBUS_INTERFACE_PEER))
+        {
+            if (dbus_message_has_member(m, "Ping")) {
+                if (!no_reply)
+                    loop_send (*loop, Message(msg, false));
+                return;
+            }
+            if (dbus_message_has_member(m, "GetMachineId")) {
+                auto* id = dbus_get_local_machine_id ();
+                if (id && !no_reply) {
+                    Message reply (msg, false);
+                    reply << std::string (id);
+                    loop_send (*loop, reply);
+                }
+                dbus_free (id);
+                return;
+            }
+        }
 
+        std::shared_ptr<const std::vector<loopback_t::filter_t>> filters;
         {
-            std::lock_guard<std::mutex> lock (io_mutex);
-            io_watches.clear ();
-            io_timers->clear ();
-            io_timeouts.clear ();
+            std::lock_guard<std::mutex> lock (loop->reg_mutex);
+            filters = loop->filters;
         }
-        if (internal_io_handler) {
-            ioh->stop ();
-            ioh->join ();
+        for (auto& filter : *filters) {
+            if (filter.function(nullptr, m, filter.data) == DBUS_HANDLER_RESULT_HANDLED)
+                return;
+            if (!loop)
+                return; // Disconnected by the filter
         }
 
-        conn = nullptr;
-        private_connection = false;
+        auto* path = dbus_message_get_path (m);
+        if (path) {
+            // The handler of the object path, or of the
+            // closest parent path registered as a fallback
+            loopback_t::object_t obj {nullptr, nullptr, false};
+            {
+                std::lock_guard<std::mutex> lock (loop->reg_mutex);
+                std::string p (path);
+                auto entry = loop->objects.find (p);
+                if (entry != loop->objects.end())
+                    obj = entry->second;
+                while (!obj.vtable && p.size() > 1) {
+                    auto pos = p.rfind ('/');
+                    p.resize (pos ? pos : 1);
+                    entry = loop->objects.find (p);
+                    if (entry != loop->objects.end() && entry->second.fallback)
+                        obj = entry->second;
+                }
+            }
+            if (obj.vtable && obj.vtable->message_function &&
+                obj.vtable->message_function(nullptr, m, obj.data) == DBUS_HANDLER_RESULT_HANDLED)
+            {
+                return;
+            }
+        }
+
+        if (type == DBUS_MESSAGE_TYPE_METHOD_CALL && !no_reply && loop) {
+            // Same error reply as libdbus sends for unhandled method calls
+            std::string err_msg = "Method \"";
+            err_msg += msg.name ();
+            err_msg += "\" with signature \"";
+            err_msg += msg.signature ();
+            err_msg += "\" on interface \"";
+            err_msg += msg.interface ();
+            err_msg += "\" doesn't exist\n";
+            loop_send (*loop, Message(msg, true, DBUS_ERROR_UNKNOWN_METHOD, err_msg));
+        }
     }
 
 
     //-----------------------------------------------------------------------
+    // Pending calls on a loopback connection get an error
+    // reply when the connection is closed.
     //-----------------------------------------------------------------------
-    std::string Connection::unique_name () const
+    void Connection::loop_fail_calls ()
     {
-        const char* id = nullptr;
-        if (conn)
-            id = dbus_bus_get_unique_name (conn);
-        return std::string (id ? id : "");
+        std::vector<pending_msg_cb_t> callbacks;
+        callbacks.reserve (loop->calls.size());
+        for (auto& entry : loop->calls) {
+            loop->timeouts.cancel (entry.second);
+            callbacks.emplace_back (std::move(entry.second.reply_cb));
+        }
+        loop->calls.clear ();
+        update_pending ();
+
+        for (auto& cb : callbacks) {
+            auto reply = Message::create_error (DBUS_ERROR_DISCONNECTED, "Connection is closed");
+            cb (reply);
+        }
     }
 
 
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
-    int Connection::send (const Message& msg)
+    void Connection::loop_close ()
     {
-        uint32_t serial = 0;
-        if (dbus_connection_send(conn,
-                                 const_cast<Message&>(msg).handle(),
-                                 &serial))
         {
-            return 0;
-        }else{
-            return -1;
+            auto& link = *loop->link;
+            std::lock_guard<std::mutex> lock (link.mutex);
+            link.ends[loop->end] = nullptr;
+            auto* peer = link.ends[loop->end ^ 1];
+            if (peer) {
+                peer->loop->peer_closed = true;
+                peer->wakeup_io_handler ();
+            }
+        }
+        loop->peer_closed = true;
+
+        // Drop the messages not yet dispatched
+        mpsc_queue::node* node;
+        while ((node = loop->inbox.pop()) != nullptr)
+            delete static_cast<send_request*> (node);
+
+        loop_fail_calls ();
+
+        std::map<std::string, loopback_t::object_t> objects;
+        {
+            std::lock_guard<std::mutex> lock (loop->reg_mutex);
+            objects.swap (loop->objects);
         }
+        for (auto& entry : objects) {
+            if (entry.second.vtable->unregister_function)
+                entry.second.vtable->unregister_function (nullptr, entry.second.data);
+        }
+
+        if (loop->timer_id >= 0)
+            io_timers->cancel (loop->timer_id);
+        std::atomic_store (&loop, std::shared_ptr<loopback_t>());
     }
 
 
     //-----------------------------------------------------------------------
+    // Arm a timer for the next event in the timer wheel
+    // of pending calls on a loopback connection.
     //-----------------------------------------------------------------------
-    int Connection::send (const Message& msg,
-                          std::function<void (ultrabus::Message&)> reply_cb,
-                          int timeout)
+    void Connection::loop_arm_timer ()
     {
-        if (!reply_cb)
-            return send (msg);
+        auto next = loop->timeouts.next_expiry ();
+        if (next == timer_wheel::no_expiry)
+            return; // A timer already armed is left to expire
+        if (!ioh) {
+            ext_poke (); // Read by next_timeout()
+            return;
+        }
 
-        // Make sure we post the message in the scope of the worker thread
-        //
-        if (io_handler().same_context()) {
-            bool result;
-            DBusPendingCall* pending = nullptr;
-            std::lock_guard<std::mutex> lock (pending_msg_mutex);
-            result = dbus_connection_send_with_reply (conn,
-                                                      const_cast<Message&>(msg).handle(),
-                                                      &pending,
-                                                      timeout);
-            if (!result || !pending)
-                return -1;
-            pending_messages.emplace (pending, reply_cb);
-            dbus_pending_call_set_notify (pending, dbus_pending_msg_cb, this, nullptr);
-        }else{
-            io_timers->set (0, [this, msg, reply_cb, timeout](iomultiplex::timer_set& ts,
-                                                              long timer_id)
-                {
-                    bool result;
-                    DBusPendingCall* pending = nullptr;
-                    std::unique_lock<std::mutex> lock (pending_msg_mutex);
-                    result = dbus_connection_send_with_reply (conn,
-                                                              const_cast<Message&>(msg).handle(),
-                                                              &pending,
-                                                              timeout);
-                    if (!result || !pending) {
-                        // Return an error response
-                        Message reply (dbus_message_new(DBUS_MESSAGE_TYPE_ERROR));
-                        reply.dec_ref (); // ref count increased in Message constructor
-                        reply.error_name ("se.ultramarin.ultrabus.Error.ENOMEM");
-                        reply << std::string("Unable to allocate memory for DBus message");
-                        lock.unlock ();
-                        reply_cb (reply);
-                        return;
-                    }
-                    pending_messages.emplace (pending, reply_cb);
-                    dbus_pending_call_set_notify (pending, dbus_pending_msg_cb, this, nullptr);
-                });
+        if (loop->timer_id >= 0) {
+            if (loop->armed_at <= next)
+                return; // Rearmed when it expires
+            io_timers->cancel (loop->timer_id);
         }
-        return 0;
+
+        auto now = loop->timeouts.now ();
+        loop->armed_at = next;
+        loop->timer_id = io_timers->set (next > now ? next - now : 0,
+                                         [this](iomultiplex::timer_set& ts, long timer_id)
+            {
+                loop_on_timer ();
+            });
     }
 
 
     //-----------------------------------------------------------------------
+    // Called in the context of the I/O handler
     //-----------------------------------------------------------------------
-    Message Connection::send_and_wait (const Message& msg, int timeout)
+    void Connection::loop_on_timer ()
     {
-        std::condition_variable cv;
-        std::mutex m;
-        volatile bool got_reply = false;
-        Message reply;
-
-        // Send the message
-        auto result = send (msg, [&](Message& r)
-            {
-                // Save the reply and notify the waiting thread
-                std::unique_lock<std::mutex> lock (m);
-                reply = std::move (r);
-                got_reply = true;
-                cv.notify_one ();
-            },
-            timeout);
-
-        if (result) {
-            // Failed to send the message, return an error reply
-            Message reply (dbus_message_new(DBUS_MESSAGE_TYPE_ERROR));
-            reply.dec_ref (); // ref count increased in Message constructor
-            reply.error_name ("se.ultramarin.ultrabus.Error.ENOMEM");
-            reply << std::string("Unable to allocate memory for DBus message");
-            return reply;
+        if (!loop)
+            return;
+        loop->timer_id = -1;
+        loop->timeouts.advance (now_ms());
+
+        timer_wheel::entry* e;
+        while ((e = loop->timeouts.pop_expired()) != nullptr) {
+            auto entry = loop->calls.find (static_cast<loopback_t::call_t*>(e)->serial);
+            trace_buffer::record (trace_event::timeout, this, entry->first);
+            auto cb = std::move (entry->second.reply_cb);
+            auto sent_at = entry->second.sent_at;
+            loop->calls.erase (entry);
+            auto reply = Message::create_error (DBUS_ERROR_NO_REPLY,
+                                                "Did not receive a reply. Possible causes include: "
+                                                "the remote application did not send a reply, "
+                                                "the message bus security policy blocked the reply, "
+                                                "the reply timeout expired, or the network "
+                                                "connection was broken.");
+            count_reply (reply.handle(), sent_at);
+            cb (reply);
+            if (!loop)
+                return; // Disconnected by the callback
         }
-
-        // Wait for the message reply
-        std::unique_lock<std::mutex> lock (m);
-        while (!got_reply)
-            cv.wait (lock, [&got_reply]{return got_reply;});
-        return reply;
+        loop_arm_timer ();
     }
 
 
@@ -322,12 +2259,35 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void Connection::start_message_dispatcher ()
     {
-        if (!conn)
+        if (!conn && !loop)
             return;
 
+        trace_buffer::record (trace_event::connect, this, 0, loop ? 1 : 0);
+
         if (internal_io_handler)
             ioh->run (true); // Start I/O worker thread
 
+        {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            if (ioh) {
+                wakeup_conn.reset (new iomultiplex::fd_connection(*ioh, wakeup_fd, true));
+                wakeup_conn->wait_for_rx ([this](iomultiplex::io_result_t& ior)->bool
+                    {
+                        if (!ior.errnum)
+                            on_wakeup (ior);
+                        return false;
+                    });
+            }else{
+                ext_active = true;
+                ext_update (wakeup_fd);
+            }
+        }
+        if (ioh)
+            wakeup_io_handler (); // Let the I/O handler find its thread
+
+        if (!conn)
+            return; // Loopback connection
+
         dbus_connection_set_dispatch_status_function (conn,
                                                       dbus_dispatch_status_cb,
                                                       this,
@@ -344,6 +2304,11 @@ namespace ultrabus {
                                                dbus_toggled_timeout_cb,
                                                this,
                                                nullptr);
+
+        // Added before any message handler, so it is the first
+        // filter to see each message that isn't a reply to a
+        // pending call.
+        dbus_connection_add_filter (conn, dbus_stats_filter_cb, this, nullptr);
     }
 
 
@@ -351,17 +2316,23 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void Connection::on_dispatch_status (DBusDispatchStatus status)
     {
-        switch (status) {
-        case DBUS_DISPATCH_DATA_REMAINS:
-            DBG_LOG ("Status: DBUS_DISPATCH_DATA_REMAINS");
-            break;
-        case DBUS_DISPATCH_COMPLETE:
-            DBG_LOG ("Status: DBUS_DISPATCH_COMPLETE");
-            break;
-        case DBUS_DISPATCH_NEED_MEMORY:
-            DBG_LOG ("Status: DBUS_DISPATCH_NEED_MEMORY");
-            break;
-        }
+        // In the context of the I/O handler, incoming messages are
+        // dispatched by dispatch_messages() when a watch is handled.
+        // Messages queued by libdbus in other threads, like when
+        // blocking for a pending call, need the I/O handler woken up.
+        if (status == DBUS_DISPATCH_DATA_REMAINS && !io_context())
+            schedule_dispatch ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Let the I/O handler dispatch incoming messages.
+    // May be called in the context of any thread.
+    //-----------------------------------------------------------------------
+    void Connection::schedule_dispatch ()
+    {
+        if (!dispatch_pending.exchange(true))
+            wakeup_io_handler ();
     }
 
 
@@ -369,11 +2340,11 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void Connection::on_watch_rx_ready (iomultiplex::io_result_t& ior, DBusWatch* watch)
     {
-        DBG_LOG ("RX ready");
+        trace_buffer::record (trace_event::watch_rx, this, 0, dbus_watch_get_unix_fd(watch));
 
         dbus_watch_handle (watch, DBUS_WATCH_READABLE);
-        while (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
-            ;
+        dispatch_messages ();
+        busy_poll_spin ();
 
         std::lock_guard<std::mutex> lock (io_mutex);
         if (io_watches.find(watch) == io_watches.end())
@@ -396,9 +2367,10 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void Connection::on_watch_tx_ready (iomultiplex::io_result_t& ior, DBusWatch* watch)
     {
-        DBG_LOG ("TX ready");
+        trace_buffer::record (trace_event::watch_tx, this, 0, dbus_watch_get_unix_fd(watch));
 
         dbus_watch_handle (watch, DBUS_WATCH_WRITABLE);
+        check_watermarks ();
 
         std::lock_guard<std::mutex> lock (io_mutex);
         if (io_watches.find(watch) == io_watches.end())
@@ -422,26 +2394,36 @@ namespace ultrabus {
     void Connection::dbus_pending_msg_cb (DBusPendingCall* pending, void* data)
     {
         Connection* self = static_cast<Connection*> (data);
-        pending_msg_cb_t callback = nullptr;
 
-        {
-            std::lock_guard<std::mutex> lock (self->pending_msg_mutex);
-            auto entry = self->pending_messages.find (pending);
-            if (entry == self->pending_messages.end())
-                return;
+        // The reply, or the error reply generated by libdbus
+        // on timeout, has the serial of the method call as
+        // reply serial.
+        Message reply (dbus_pending_call_steal_reply(pending));
+        reply.dec_ref (); // ref count increased in Message constructor
 
-            callback = entry->second;
-            self->pending_messages.erase (entry);
-        }
+        DBusPendingCall* entry = nullptr;
+        pending_msg_cb_t callback;
+        uint64_t sent_at = 0;
+        if (!self->pending_calls.take(reply.reply_serial(), entry, callback, &sent_at))
+            return;
 
-        if (callback) {
-            Message reply (dbus_pending_call_steal_reply(pending));
-            reply.dec_ref (); // ref count increased in Message constructor
-            dbus_pending_call_unref (pending);
+        dbus_pending_call_unref (entry);
+        self->count_reply (reply.handle(), sent_at);
+        trace_buffer::record (trace_event::reply, self, reply.reply_serial(),
+                              dbus_message_get_type(reply.handle()));
+        if (callback)
             callback (reply);
-        }else{
-            dbus_pending_call_unref (pending);
-        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    DBusHandlerResult Connection::dbus_stats_filter_cb (DBusConnection* c,
+                                                        DBusMessage* msg,
+                                                        void* data)
+    {
+        static_cast<Connection*>(data)->count_received (msg);
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
 
@@ -460,15 +2442,20 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     dbus_bool_t Connection::dbus_add_watch_cb (DBusWatch* watch, void* data)
     {
-        DBG_LOG ("Add watch");
-
         int fd = dbus_watch_get_unix_fd (watch);
         if (fd < 0)
             return true;
 
         Connection* self = static_cast<Connection*> (data);
+        trace_buffer::record (trace_event::watch_add, self, 0, fd);
         std::lock_guard<std::mutex> lock (self->io_mutex);
 
+        if (!self->ioh) {
+            self->ext_watches[watch] = fd;
+            self->ext_update (fd);
+            return true;
+        }
+
         auto entry = self->io_watches.find (watch);
         if (entry == self->io_watches.end())
             entry = self->io_watches.emplace(watch, iomultiplex::fd_connection(*self->ioh, fd, true)).first;
@@ -502,14 +2489,20 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void Connection::dbus_remove_watch_cb (DBusWatch* watch, void* data)
     {
-        DBG_LOG ("Remove watch");
-
         Connection* self = static_cast<Connection*> (data);
+        trace_buffer::record (trace_event::watch_remove, self, 0, dbus_watch_get_unix_fd(watch));
 
         std::lock_guard<std::mutex> lock (self->io_mutex);
         auto entry = self->io_watches.find (watch);
         if (entry != self->io_watches.end())
             self->io_watches.erase (entry);
+
+        auto ext_entry = self->ext_watches.find (watch);
+        if (ext_entry != self->ext_watches.end()) {
+            int fd = ext_entry->second;
+            self->ext_watches.erase (ext_entry);
+            self->ext_update (fd);
+        }
     }
 
 
@@ -520,6 +2513,13 @@ namespace ultrabus {
         Connection* self = static_cast<Connection*> (data);
 
         std::lock_guard<std::mutex> lock (self->io_mutex);
+        if (!self->ioh) {
+            auto ext_entry = self->ext_watches.find (watch);
+            if (ext_entry != self->ext_watches.end())
+                self->ext_update (ext_entry->second);
+            return;
+        }
+
         auto entry = self->io_watches.find (watch);
         if (entry == self->io_watches.end())
             return;
@@ -528,9 +2528,7 @@ namespace ultrabus {
         bool enabled = dbus_watch_get_enabled (watch);
         auto flags = dbus_watch_get_flags (watch);
         if (enabled) {
-            DBG_LOG ("Toggle watch - enable");
             if (flags & DBUS_WATCH_READABLE) {
-                DBG_LOG ("    Enble watch for RX");
                 fdc.wait_for_rx ([self, watch](iomultiplex::io_result_t& ior)->bool
                     {
                         if (!ior.errnum)
@@ -539,7 +2537,6 @@ namespace ultrabus {
                     });
             }
             if (flags & DBUS_WATCH_WRITABLE) {
-                DBG_LOG ("    Enble watch for TX");
                 fdc.wait_for_tx ([self, watch](iomultiplex::io_result_t& ior)->bool
                     {
                         if (!ior.errnum)
@@ -548,13 +2545,6 @@ namespace ultrabus {
                     });
             }
         }else{
-#ifdef TRACE_DEBUG
-            DBG_LOG ("Toggle watch - disable");
-            if (flags & DBUS_WATCH_READABLE)
-                DBG_LOG ("    Disable watch for RX");
-            if (flags & DBUS_WATCH_WRITABLE)
-                DBG_LOG ("    Disable watch for TX");
-#endif
             fdc.cancel ((flags & DBUS_WATCH_READABLE),  // Cancel RX if readable
                         (flags & DBUS_WATCH_WRITABLE),
                         false); // Cancel TX if readable
@@ -563,44 +2553,169 @@ namespace ultrabus {
 
 
     //-----------------------------------------------------------------------
+    // Called with io_mutex locked
     //-----------------------------------------------------------------------
-    dbus_bool_t Connection::dbus_add_timeout_cb (DBusTimeout* timeout, void* data)
+    void Connection::schedule_timeout (io_timeout_t& t)
     {
-        DBG_LOG ("Add timer");
-        Connection* self = static_cast<Connection*> (data);
-        std::lock_guard<std::mutex> lock (self->io_mutex);
+        auto interval = dbus_timeout_get_interval (t.timeout);
+        if (dbus_timeout_get_enabled(t.timeout) && interval >= 0) {
+            trace_buffer::record (trace_event::timeout_add, this, 0, interval);
+            auto now = now_ms ();
+            io_timeouts.advance (now);
+            // Plus one tick since the current time is truncated to milliseconds
+            io_timeouts.add (t, now + interval + 1);
+            arm_timeout_timer ();
+        }else{
+            trace_buffer::record (trace_event::timeout_remove, this);
+            io_timeouts.cancel (t);
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Called with io_mutex locked
+    //-----------------------------------------------------------------------
+    void Connection::arm_timeout_timer ()
+    {
+        auto next = io_timeouts.next_expiry ();
+        if (next == timer_wheel::no_expiry)
+            return; // A timer already armed is left to expire
 
-        auto entry = self->io_timeouts.find (timeout);
-        if (entry == self->io_timeouts.end()) {
-            entry = self->io_timeouts.emplace(timeout, -1).first;
+        if (!ioh) {
+            ext_poke (); // Read by next_timeout()
+            return;
         }
-        long& timer_id = entry->second;
 
-        if (dbus_timeout_get_enabled(timeout)) {
-            if (timer_id >= 0) {
-                self->io_timers->cancel (timer_id);
-                timer_id = -1;
-            }
-            auto interval = dbus_timeout_get_interval (timeout);
-            if (interval >= 0) {
-                DBG_LOG ("Set timer: %d", interval);
-                timer_id = self->io_timers->set (interval,
-                                                 [self, timeout](iomultiplex::timer_set& ts, long timer_id)
-                    {
-                        // Timer expiration callback
-                        DBG_LOG ("timed out");
-                        dbus_timeout_handle (timeout);
-                        while (dbus_connection_dispatch(self->conn) == DBUS_DISPATCH_DATA_REMAINS)
-                            ;
-                    });
+        if (io_timeout_timer >= 0) {
+            if (io_timeout_armed_at <= next)
+                return; // Rearmed when it expires
+            io_timers->cancel (io_timeout_timer);
+        }
+
+        auto now = io_timeouts.now ();
+        io_timeout_armed_at = next;
+        io_timeout_timer = io_timers->set (next > now ? next - now : 0,
+                                           [this](iomultiplex::timer_set& ts, long timer_id)
+            {
+                on_timeout_timer ();
+            });
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Called in the context of the I/O handler
+    //-----------------------------------------------------------------------
+    void Connection::on_timeout_timer ()
+    {
+        {
+            std::lock_guard<std::mutex> lock (io_mutex);
+            io_timeout_timer = -1;
+            io_timeouts.advance (now_ms());
+        }
+
+        // Handle the expired timeouts one at a time, libdbus
+        // may add and remove timeouts when a timeout is handled.
+        while (true) {
+            DBusTimeout* timeout;
+            {
+                std::lock_guard<std::mutex> lock (io_mutex);
+                auto* t = static_cast<io_timeout_t*> (io_timeouts.pop_expired());
+                if (!t) {
+                    arm_timeout_timer ();
+                    break;
+                }
+                timeout = t->timeout;
             }
+            trace_buffer::record (trace_event::timeout, this);
+            dbus_timeout_handle (timeout);
+        }
+
+        dispatch_messages ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Return the events to wait for on a file descriptor
+    // watched by an external event loop.
+    // Called with io_mutex locked
+    //-----------------------------------------------------------------------
+    uint32_t Connection::ext_events (int fd) const
+    {
+        if (fd == wakeup_fd)
+            return ext_active ? POLLIN : 0;
+
+        uint32_t events = 0;
+        for (auto& entry : ext_watches) {
+            if (entry.second != fd || !dbus_watch_get_enabled(entry.first))
+                continue;
+            auto flags = dbus_watch_get_flags (entry.first);
+            if (flags & DBUS_WATCH_READABLE)
+                events |= POLLIN;
+            if (flags & DBUS_WATCH_WRITABLE)
+                events |= POLLOUT;
+        }
+        return events;
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Tell the external event loop if the events to
+    // wait for on a file descriptor has changed.
+    // Called with io_mutex locked
+    //-----------------------------------------------------------------------
+    void Connection::ext_update (int fd)
+    {
+        auto events = ext_events (fd);
+        auto entry = ext_interest.find (fd);
+        if (entry == ext_interest.end()) {
+            if (!events)
+                return;
+            ext_interest.emplace (fd, events);
+        }
+        else if (entry->second == events) {
+            return;
+        }
+        else if (events) {
+            entry->second = events;
         }else{
-            if (timer_id >= 0) {
-                self->io_timers->cancel (timer_id);
-                timer_id = -1;
-            }
-            DBG_LOG ("Cancel timer");
+            ext_interest.erase (entry);
+        }
+        if (ext_watch_cb)
+            ext_watch_cb (fd, events);
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Wake up an external event loop to read a new timeout
+    // with next_timeout(), unless called by the event loop.
+    //-----------------------------------------------------------------------
+    void Connection::ext_poke ()
+    {
+        if (io_context())
+            return;
+        uint64_t value = 1;
+        if (write(wakeup_fd, &value, sizeof(value)) < 0)
+            trace_buffer::record (trace_event::error, this, 0, errno);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    dbus_bool_t Connection::dbus_add_timeout_cb (DBusTimeout* timeout, void* data)
+    {
+        Connection* self = static_cast<Connection*> (data);
+        std::lock_guard<std::mutex> lock (self->io_mutex);
+
+        auto* t = static_cast<io_timeout_t*> (dbus_timeout_get_data(timeout));
+        if (!t) {
+            t = new (std::nothrow) io_timeout_t;
+            if (!t)
+                return false;
+            t->self = self;
+            t->timeout = timeout;
+            dbus_timeout_set_data (timeout, t, dbus_free_timeout_data);
         }
+        self->schedule_timeout (*t);
 
         return true;
     }
@@ -610,17 +2725,13 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void Connection::dbus_remove_timeout_cb (DBusTimeout* timeout, void* data)
     {
-        DBG_LOG ("Remove timer");
         Connection* self = static_cast<Connection*> (data);
+        trace_buffer::record (trace_event::timeout_remove, self);
 
         std::lock_guard<std::mutex> lock (self->io_mutex);
-        auto entry = self->io_timeouts.find (timeout);
-        if (entry != self->io_timeouts.end()) {
-            long& timer_id = entry->second;
-            if (timer_id >= 0)
-                self->io_timers->cancel (timer_id);
-            self->io_timeouts.erase (entry);
-        }
+        auto* t = static_cast<io_timeout_t*> (dbus_timeout_get_data(timeout));
+        if (t)
+            self->io_timeouts.cancel (*t);
     }
 
 
@@ -628,40 +2739,27 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void Connection::dbus_toggled_timeout_cb (DBusTimeout* timeout, void* data)
     {
-        DBG_LOG ("Toggle timer");
         Connection* self = static_cast<Connection*> (data);
 
         std::lock_guard<std::mutex> lock (self->io_mutex);
-        auto entry = self->io_timeouts.find (timeout);
-        if (entry == self->io_timeouts.end())
-            return;
-        long& timer_id = entry->second;
+        auto* t = static_cast<io_timeout_t*> (dbus_timeout_get_data(timeout));
+        if (t)
+            self->schedule_timeout (*t);
+    }
 
-        // Cancel the timer if it is active
-        if (timer_id >= 0) {
-            self->io_timers->cancel (timer_id);
-            timer_id = -1;
-        }
 
-        if (dbus_timeout_get_enabled(timeout)) {
-            auto interval = dbus_timeout_get_interval (timeout);
-            DBG_LOG ("Enable timer, interval: %d", (int)interval);
-            if (interval >= 0) {
-                timer_id = self->io_timers->set (interval,
-                                                 [self, timeout](iomultiplex::timer_set& ts, long timer_id)
-                    {
-                        // Timer expiration callback
-                        DBG_LOG ("timed out");
-                        dbus_timeout_handle (timeout);
-                        while (dbus_connection_dispatch(self->conn) == DBUS_DISPATCH_DATA_REMAINS)
-                            ;
-                    });
-            }
-        }else{
-            // Timer already cancelled above
-            DBG_LOG ("Cancel timer");
+    //-----------------------------------------------------------------------
+    // Called by libdbus when a DBusTimeout object is freed
+    //-----------------------------------------------------------------------
+    void Connection::dbus_free_timeout_data (void* data)
+    {
+        auto* t = static_cast<io_timeout_t*> (data);
+        if (t->active()) {
+            // Normally removed by dbus_remove_timeout_cb() before it is freed
+            std::lock_guard<std::mutex> lock (t->self->io_mutex);
+            t->self->io_timeouts.cancel (*t);
         }
+        delete t;
     }
 
-
 }
@@ -20,10 +20,24 @@
 #define ULTRABUS_CONNECTION_HPP
 
 #include <ultrabus/Message.hpp>
+#include <ultrabus/mpsc_queue.hpp>
+#include <ultrabus/pending_call_table.hpp>
+#include <ultrabus/timer_wheel.hpp>
+#include <ultrabus/latency_histogram.hpp>
+#include <ultrabus/WorkerPool.hpp>
+#include <ultrabus/thread_options.hpp>
+#include <ultrabus/coroutine.hpp>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cerrno>
+#include <chrono>
 #include <string>
 #include <mutex>
+#include <thread>
 #include <map>
+#include <vector>
 #include <dbus/dbus.h>
 #include <iomultiplex.hpp>
 
@@ -36,6 +50,210 @@ namespace ultrabus {
      */
     class Connection {
     public:
+        /**
+         * Callback called with a message reply.
+         * Callbacks capturing up to 48 bytes, like a
+         * <code>std::function</code> object and a couple
+         * of pointers, are stored without heap allocation.
+         */
+        using reply_cb_t = pending_call_table::callback_t;
+
+        /**
+         * Callback called when the size of the outgoing
+         * queue crosses a watermark.
+         * @param above <code>true</code> when the size has risen above
+         *              the high watermark, <code>false</code> when it
+         *              has fallen to the low watermark.
+         * @see outgoing_watermarks
+         */
+        using watermark_cb_t = std::function<void (bool above)>;
+
+        /**
+         * How incoming messages are ordered when
+         * message handlers are run by an executor.
+         * @see executor
+         */
+        enum class dispatch_order {
+            sender, /**< Messages from the same sender are handled in order. */
+            path    /**< Messages to the same object path are handled in order. */
+        };
+
+        /**
+         * Tag type of the constructor creating a connection
+         * driven by an external event loop.
+         * @see external_loop
+         */
+        struct external_loop_t {
+            explicit external_loop_t () = default;
+        };
+
+        /**
+         * Tag selecting the constructor creating a connection
+         * driven by an external event loop.
+         */
+        static constexpr external_loop_t external_loop {};
+
+        /**
+         * A file descriptor watched by an external event loop.
+         * The events have the same values for <code>poll()</code>
+         * and <code>epoll()</code>.
+         */
+        struct watch_t {
+            int fd;          /**< The file descriptor. */
+            uint32_t events; /**< Events to wait for, <code>POLLIN</code> and/or <code>POLLOUT</code>. */
+        };
+
+        /**
+         * Callback called when the events to wait for on a file
+         * descriptor change, on a connection driven by an
+         * external event loop.
+         * @param fd The file descriptor.
+         * @param events The events to wait for, <code>POLLIN</code>
+         *               and/or <code>POLLOUT</code>, or 0 when the
+         *               file descriptor shall no longer be watched.
+         * @see on_watch_change
+         */
+        using watch_cb_t = std::function<void (int fd, uint32_t events)>;
+
+        /**
+         * Statistics of batched outgoing messages.
+         */
+        struct batch_stats_t {
+            uint64_t messages; /**< Number of messages handed to libdbus by the I/O handler's send queue. */
+            uint64_t flushes;  /**< Number of times the send queue was flushed. */
+
+            /**
+             * Return the average number of messages per flush.
+             */
+            double messages_per_flush () const {
+                return flushes ? (double)messages / (double)flushes : 0.0;
+            }
+        };
+
+        /**
+         * Statistics of dispatched incoming messages.
+         */
+        struct dispatch_stats_t {
+            uint64_t messages;          /**< Number of dispatched messages. */
+            uint64_t passes;            /**< Number of dispatch passes. */
+            uint64_t deferred;          /**< Number of passes stopped by the dispatch
+                                             budget with messages left to dispatch. */
+            uint64_t max_pass_messages; /**< Maximum number of messages dispatched in one pass. */
+            uint64_t total_pass_usec;   /**< Total time in microseconds spent in dispatch passes. */
+            uint64_t max_pass_usec;     /**< Longest dispatch pass in microseconds. */
+            uint64_t max_defer_usec;    /**< Longest time in microseconds a deferred
+                                             message waited for the next pass. */
+            uint64_t backlog;           /**< Number of messages left to dispatch when
+                                             the last deferred pass was stopped, counted
+                                             as the following passes dispatched them
+                                             until the incoming queue was empty. libdbus
+                                             doesn't expose the length of its incoming
+                                             queue, so messages received meanwhile are
+                                             included. */
+            uint64_t max_backlog;       /**< Largest backlog of a deferred pass. */
+            uint64_t busy_poll_hits;    /**< Number of busy polls that found a message. */
+            uint64_t busy_poll_misses;  /**< Number of busy polls that timed out. */
+
+            /**
+             * Return the average number of messages per dispatch pass.
+             */
+            double messages_per_pass () const {
+                return passes ? (double)messages / (double)passes : 0.0;
+            }
+        };
+
+        /**
+         * Statistics of one type of message.
+         */
+        struct message_stats_t {
+            uint64_t sent;     /**< Number of sent messages. */
+            uint64_t received; /**< Number of received messages. Error replies
+                                    generated by libdbus when a method call
+                                    times out are counted as received. */
+
+            /**
+             * Time in nanoseconds from a received message was
+             * dispatched until the message handlers returned.
+             * When the message handlers are run by an executor,
+             * this is the time to route the message to the executor.
+             */
+            latency_histogram::snapshot dispatch_time;
+
+            /**
+             * Time in nanoseconds from a method call was handed to
+             * libdbus until the reply was received. Only used for
+             * method returns and errors replying to method calls
+             * sent with a reply callback.
+             */
+            latency_histogram::snapshot round_trip;
+        };
+
+        /**
+         * Statistics of a connection.
+         * @see stats
+         */
+        struct stats_t {
+            message_stats_t method_calls;   /**< Method call messages. */
+            message_stats_t method_returns; /**< Method return messages. */
+            message_stats_t errors;         /**< Error messages. */
+            message_stats_t signals;        /**< Signal messages. */
+
+            uint64_t bytes_sent;     /**< Size in bytes of the sent messages, if enabled
+                                          by <code>count_bytes()</code>. */
+            uint64_t bytes_received; /**< Size in bytes of the received messages, if enabled
+                                          by <code>count_bytes()</code>. */
+            uint64_t pending_calls;  /**< Number of method calls waiting for a reply. */
+            uint64_t timeouts;       /**< Number of method calls that got no reply in time. */
+
+            batch_stats_t batch;       /**< Statistics of batched outgoing messages. */
+            dispatch_stats_t dispatch; /**< Statistics of dispatch passes. */
+
+            /**
+             * Number of received messages processed on each CPU core,
+             * indexed by CPU number. Messages are counted on the core
+             * running the I/O handler when the message is read, the
+             * core running a message handler is found in the trace
+             * records.
+             */
+            std::vector<uint64_t> cpu_messages;
+
+            /**
+             * Return the statistics of a message type.
+             * @param message_type A message type, like
+             *                     <code>DBUS_MESSAGE_TYPE_SIGNAL</code>.
+             * @throw std::out_of_range If the message type is invalid.
+             */
+            const message_stats_t& type (int message_type) const;
+
+            /**
+             * Return the round trip time of all method calls,
+             * replied by method returns or errors.
+             */
+            latency_histogram::snapshot round_trip () const {
+                auto rt = method_returns.round_trip;
+                rt += errors.round_trip;
+                return rt;
+            }
+        };
+
+        /**
+         * Statistics of a method handled by the connection.
+         * @see track_methods
+         */
+        struct method_stats_t {
+            std::string interface; /**< Interface name. */
+            std::string method;    /**< Method name. */
+            uint64_t errors;       /**< Number of calls replied with an error. */
+
+            /**
+             * Time in nanoseconds from a method call was received
+             * until the reply was sent, including the time in the
+             * queue of an executor. The count is the number of
+             * replied calls.
+             */
+            latency_histogram::snapshot latency;
+        };
+
         /**
          * Default constructor.
          * Creates a connection object that uses an internal I/O handler.
@@ -49,6 +267,29 @@ namespace ultrabus {
          */
         Connection (iomultiplex::iohandler_base& io_handler);
 
+        /**
+         * Constructor.
+         * Creates a connection object without an I/O handler. The
+         * connection is driven by an external event loop, like the
+         * epoll loop of an application, in the context of the
+         * thread running the loop:
+         * <pre>
+         * ultrabus::Connection conn (ultrabus::Connection::external_loop);
+         * conn.on_watch_change ([epfd](int fd, uint32_t events) {
+         *     // Add, modify or delete fd in the epoll set
+         * });
+         * conn.connect ();
+         * while (running) {
+         *     int n = epoll_wait (epfd, ev, max_events, conn.next_timeout());
+         *     for (int i=0; i<n; ++i)
+         *         conn.process_ready (ev[i].data.fd, ev[i].events);
+         *     conn.process_timeouts ();
+         * }
+         * </pre>
+         * @see process_ready
+         */
+        Connection (external_loop_t);
+
         /**
          * Destructor.
          * Close the connection and free resources.
@@ -81,6 +322,68 @@ namespace ultrabus {
                      const bool private_connection=false,
                      const bool exit_on_disconnect=true);
 
+        /**
+         * Connect directly to a peer, without a bus daemon.
+         * The connection isn't registered with a bus, it has no unique
+         * bus name and the bus daemon methods and match rules are not
+         * available. Messages are routed by object path, the
+         * destination of method calls is ignored by the peer.
+         * @param address The address of the peer, normally the address
+         *                of a <code>Server</code>, like
+         *                <code>unix:path=/run/example.socket</code>.
+         * @param exit_on_disconnect If <code>true</code>, the process will
+         *                           exit if the connection is disconnected.
+         * @return 0 on success, -1 on failure.
+         * @see Server
+         */
+        int connect_peer (const std::string& address,
+                          const bool exit_on_disconnect=false);
+
+        /**
+         * Use a connection opened with the libdbus API.
+         * The connection must be a private connection. A reference
+         * to the DBusConnection is taken, and the connection is
+         * closed when this object is disconnected.
+         * This is used by <code>Server</code> for new peer connections.
+         * @param connection A private libdbus connection.
+         * @param exit_on_disconnect If <code>true</code>, the process will
+         *                           exit if the connection is disconnected.
+         * @return 0 on success, -1 on failure.
+         */
+        int attach (DBusConnection* connection,
+                    const bool exit_on_disconnect=false);
+
+        /**
+         * Connect two connection objects in the same process to each other.
+         * Messages sent on one connection are received by the other
+         * without a socket or a bus daemon. The messages are not marshalled,
+         * the receiving side gets the same message object as the sender,
+         * with its reference counter increased.<br/>
+         * Message handlers, object handlers, and object proxies work as on a
+         * peer connection: messages are routed by object path, the
+         * destination of method calls is ignored, match rules are not
+         * used and all signals are received by the message handlers.
+         * Each side gets a unique name of the form
+         * <code>:loopback.N</code>, used as sender of its messages.
+         * <pre>
+         * ultrabus::Connection service;
+         * ultrabus::Connection client;
+         * client.connect_loopback (service);
+         * </pre>
+         * @param peer The connection at the other end. Neither connection
+         *             may be connected.
+         * @return 0 on success, -1 on failure.
+         */
+        int connect_loopback (Connection& peer);
+
+        /**
+         * Return <code>true</code> if this is one end of a loopback
+         * connection made by <code>connect_loopback()</code>.
+         */
+        bool is_loopback () const {
+            return loop_ref () != nullptr;
+        }
+
         /**
          * Return true if connected to a bus.
          */
@@ -88,6 +391,16 @@ namespace ultrabus {
 
         /**
          * Disconnect from the bus.
+         * Messages queued by other threads are sent, and method
+         * calls waiting for a reply get a
+         * <code>org.freedesktop.DBus.Error.Disconnected</code> error
+         * reply, in the context of the I/O handler. If another thread
+         * runs the I/O handler, or the external event loop, this
+         * method waits up to one second for that thread to handle it.
+         * If the I/O handler, or the external event loop, has already
+         * stopped the pending calls are instead failed, and queued
+         * messages get an error reply, in the context of the caller
+         * when the wait times out.
          */
         void disconnect ();
 
@@ -101,32 +414,563 @@ namespace ultrabus {
 
         /**
          * Send a message on the bus.
+         * If called from any other thread than the I/O handler's,
+         * the message is put in a lock-free queue that the
+         * I/O handler drains the next time it is woken up.
+         * The message object is not copied, only its reference
+         * counter is increased, so it must not be modified after
+         * this call.<br/>
+         * The reply callback is called in the context of the I/O handler.
          * @param msg The DBus message to send.
          * @param reply_cb A callback called when a message reply is received.
          * @param timeout The maximum time in milliseconds to wait for a message reply.
-         * @return 0 on success, -1 on failure.
+         * @return 0 on success, -1 on failure with <code>errno</code>
+         *         set to <code>ENOTCONN</code> if not connected,
+         *         <code>EAGAIN</code> if rejected by the outgoing
+         *         watermarks, or <code>ENOMEM</code>.
+         * @see send_error
          */
         int send (const Message& msg,
-                  std::function<void (ultrabus::Message&)> reply_cb,
+                  reply_cb_t reply_cb,
                   int timeout=DBUS_TIMEOUT_USE_DEFAULT);
 
         /**
          * Send a message on the bus without caring about a message reply.
          * @param msg The DBus message to send.
-         * @return 0 on success, -1 on failure.
+         * @return 0 on success, -1 on failure with <code>errno</code>
+         *         set like by <code>send(msg, reply_cb, timeout)</code>.
          */
         int send (const Message& msg);
 
+        /**
+         * Create the error reply for a message that couldn't be sent.
+         * @param errnum The <code>errno</code> value set by <code>send()</code>.
+         * @return A <code>org.freedesktop.DBus.Error.Disconnected</code>
+         *         error for <code>ENOTCONN</code>,
+         *         <code>se.ultramarin.ultrabus.Error.EAGAIN</code> for
+         *         <code>EAGAIN</code>, otherwise
+         *         <code>se.ultramarin.ultrabus.Error.ENOMEM</code>.
+         */
+        static Message send_error (int errnum);
+
         /**
          * Send a message on the bus and wait for a reply.
+         * The calling thread blocks on a per-thread futex until the
+         * reply is received, no memory is allocated on the heap
+         * by the library for the round trip.<br/>
+         * Don't call this method in the context of the connection's
+         * I/O handler, the reply would never be received. If called
+         * there, an error reply is returned at once.<br/>
+         * A batch doesn't hold back the message, the messages queued
+         * in the batch so far are sent together with it.
          * @param msg The DBus message to send.
          * @param timeout The maximum time in milliseconds to wait for a message reply.
          * @return A message reply.
          */
         Message send_and_wait (const Message& msg, int timeout=DBUS_TIMEOUT_USE_DEFAULT);
 
+#ifdef ULTRABUS_HAVE_COROUTINES
+        /**
+         * Awaitable message reply.
+         * Returned by <code>async_send()</code>.
+         */
+        class reply_awaitable {
+        public:
+            reply_awaitable (Connection& connection, const Message& msg, int timeout)
+                : conn {connection},
+                  msg {const_cast<Message&>(msg).handle()}, // Shared, not copied
+                  timeout {timeout},
+                  reply {static_cast<DBusMessage*>(nullptr)}
+            {
+            }
+
+            bool await_ready () const noexcept {
+                return false;
+            }
+
+            bool await_suspend (std::coroutine_handle<> h) {
+                // The coroutine may be resumed, and this object destroyed,
+                // before send() returns.
+                Message m (std::move(msg));
+                auto* result = &reply;
+                if (conn.send(m, [result, h](Message& r) {
+                            *result = std::move (r);
+                            h.resume ();
+                        },
+                        timeout) == 0)
+                {
+                    return true;
+                }
+                reply = send_error (errno);
+                return false;
+            }
+
+            Message await_resume () {
+                return std::move (reply);
+            }
+
+        private:
+            Connection& conn;
+            Message msg;
+            int timeout;
+            Message reply;
+        };
+
+        /**
+         * Send a message on the bus and await the reply in a coroutine.
+         * The coroutine is resumed in the context of the I/O handler
+         * when the reply is received.
+         * <pre>
+         * ultrabus::task<> call (ultrabus::Connection& conn, ultrabus::Message& msg)
+         * {
+         *     auto reply = co_await conn.async_send (msg);
+         *     ...
+         * }
+         * </pre>
+         * @param msg The DBus message to send. The message is
+         *            not copied, it must not be modified after
+         *            this call.
+         * @param timeout The maximum time in milliseconds to wait for a message reply.
+         * @return An awaitable object resulting in the message reply.
+         *         If the message can't be sent, an error reply is
+         *         returned without suspending the coroutine.
+         */
+        reply_awaitable async_send (const Message& msg, int timeout=DBUS_TIMEOUT_USE_DEFAULT) {
+            return reply_awaitable (*this, msg, timeout);
+        }
+#endif
+
+        /**
+         * Start batching outgoing messages.
+         * Messages sent after this call are queued and not handed
+         * to libdbus until <code>flush()</code> is called.
+         * Calls to <code>begin_batch()</code> can be nested, the
+         * messages are sent when the outermost batch is flushed.
+         * Note that the batch is for the connection, not the
+         * calling thread, messages sent from other threads
+         * during a batch are also queued.<br/>
+         * Synchronous calls, <code>send_and_wait()</code> and the
+         * proxy methods using it, are not held back by a batch:
+         * the messages queued so far are sent together with the call,
+         * from any thread.
+         */
+        void begin_batch ();
+
+        /**
+         * End a batch started with <code>begin_batch()</code>.
+         * All queued messages are sent back-to-back by the I/O handler
+         * in a single pass.
+         */
+        void flush ();
+
+        /**
+         * Set an automatic coalescing window for outgoing messages.
+         * When enabled, outgoing messages are queued and sent
+         * either when <code>max_messages</code> messages are queued,
+         * or <code>max_delay</code> milliseconds after the first
+         * message in the window was queued.
+         * @param max_delay The maximum time in milliseconds a
+         *                  message is held in the queue.
+         * @param max_messages The maximum number of messages to hold
+         *                     in the queue. 0 disables the coalescing
+         *                     window.
+         */
+        void batch_window (unsigned max_delay, std::size_t max_messages);
+
+        /**
+         * Return statistics of batched outgoing messages.
+         */
+        batch_stats_t batch_stats () const;
+
+        /**
+         * Return the number of bytes in the outgoing queue
+         * of libdbus, not yet written to the socket.
+         */
+        std::size_t outgoing_size () const;
+
+        /**
+         * Return the number of messages sent from other threads, or
+         * batched, that the I/O handler hasn't yet handed to libdbus.
+         */
+        std::size_t outgoing_queued () const;
+
+        /**
+         * Set watermarks for the size of the outgoing queue.
+         * A peer, or a bus, that doesn't read messages as fast as
+         * they are sent makes the outgoing queue in libdbus grow
+         * without limit. With watermarks set, the connection is
+         * considered not writable when the number of bytes in the
+         * outgoing queue rises above the high watermark, and writable
+         * again when it falls to the low watermark.<br/>
+         * The callback is called in the context of the thread
+         * detecting the change, normally the I/O handler.
+         * @param high The high watermark in bytes, 0 to disable the watermarks.
+         * @param low The low watermark in bytes.
+         * @param cb A callback called when a watermark is crossed, or
+         *           <code>nullptr</code>.
+         * @param reject If <code>true</code>, <code>send()</code> fails
+         *               with <code>errno</code> set to <code>EAGAIN</code>
+         *               while the connection isn't writable.
+         */
+        void outgoing_watermarks (std::size_t high,
+                                  std::size_t low,
+                                  watermark_cb_t cb=nullptr,
+                                  bool reject=false);
+
+        /**
+         * Return <code>false</code> if the size of the outgoing queue
+         * is above the high watermark.
+         * @see outgoing_watermarks
+         */
+        bool writable () const {
+            return !wm_above.load ();
+        }
+
+        /**
+         * Call a function once when the connection is writable.
+         * If the connection is writable, the function is called
+         * immediately. Otherwise it is called when the size of
+         * the outgoing queue has fallen to the low watermark,
+         * normally in the context of the I/O handler, or when
+         * the connection is disconnected.
+         * @param cb The function to call.
+         * @see outgoing_watermarks
+         */
+        void on_writable (std::function<void ()> cb);
+
+#ifdef ULTRABUS_HAVE_COROUTINES
+        /**
+         * Awaitable returned by <code>async_writable()</code>.
+         */
+        class writable_awaitable {
+        public:
+            explicit writable_awaitable (Connection& connection) : conn {connection} {
+            }
+            bool await_ready () const noexcept {
+                return conn.writable ();
+            }
+            bool await_suspend (std::coroutine_handle<> h) {
+                return conn.add_writable_waiter ([h]{ h.resume(); });
+            }
+            void await_resume () const noexcept {
+            }
+        private:
+            Connection& conn;
+        };
+
+        /**
+         * Suspend a coroutine until the connection is writable.
+         * <pre>
+         * for (auto& signal : signals) {
+         *     co_await conn.async_writable ();
+         *     conn.send (signal);
+         * }
+         * </pre>
+         * @see on_writable
+         */
+        writable_awaitable async_writable () {
+            return writable_awaitable (*this);
+        }
+#endif
+
+        /**
+         * Set a budget for dispatching incoming messages.
+         * By default, all incoming messages are dispatched each time
+         * the connection is readable. A peer flooding the connection
+         * with messages can then starve timers and other file
+         * descriptors handled by the same I/O handler.<br/>
+         * With a dispatch budget, the I/O handler stops dispatching
+         * messages when the budget is spent and continues with the
+         * remaining messages after handling other pending events.
+         * @param max_messages The maximum number of messages to
+         *                     dispatch in one pass, 0 for no limit.
+         * @param max_usec The maximum time in microseconds to spend
+         *                 dispatching messages in one pass,
+         *                 0 for no limit.
+         */
+        void dispatch_budget (unsigned max_messages, unsigned max_usec=0);
+
+        /**
+         * Enable busy polling, trading CPU time for latency.
+         * After handling incoming messages, or sending messages
+         * queued by other threads, the I/O handler spins on the
+         * connection with non-blocking reads for up to
+         * <code>usec</code> microseconds waiting for the next message,
+         * instead of going back to wait for the socket to be readable.
+         * A message found while spinning is dispatched directly,
+         * and the I/O handler then handles other pending events
+         * before it spins again. If no message arrives in time,
+         * the I/O handler waits for readiness notification as usual.<br/>
+         * The I/O handler keeps a CPU core busy while spinning,
+         * and other connections and timers handled by the same
+         * I/O handler wait. Use it with a dedicated I/O thread,
+         * pinned with <code>io_thread_options()</code>.<br/>
+         * Busy polling isn't done on loopback connections or on
+         * connections driven by an external event loop.
+         * @param usec The maximum time in microseconds to spin,
+         *             0 to disable busy polling (the default).
+         */
+        void busy_poll (unsigned usec);
+
+        /**
+         * Return statistics of dispatched incoming messages.
+         */
+        dispatch_stats_t dispatch_stats () const;
+
+        /**
+         * Return a snapshot of the connection statistics.
+         * The counters are updated with relaxed atomic operations,
+         * a snapshot taken while messages are sent or received
+         * isn't necessarily consistent between counters.
+         * <pre>
+         * auto stats = conn.stats ();
+         * auto p99 = stats.round_trip().percentile (99.0);
+         * </pre>
+         */
+        stats_t stats () const;
+
+        /**
+         * Reset the statistics counters and histograms,
+         * including the batch and dispatch statistics.
+         * The number of pending calls is not reset.
+         */
+        void reset_stats ();
+
+        /**
+         * Enable or disable counting of sent and received bytes.
+         * libdbus doesn't expose the size of a message, so the
+         * size is found by marshalling a copy of each message.
+         * This costs about 100 nanoseconds per message and is
+         * disabled by default. Messages on loopback connections
+         * are never marshalled and are not counted.
+         */
+        void count_bytes (bool enable);
+
+        /**
+         * Enable or disable latency statistics of the methods handled
+         * by this connection, returned by <code>method_stats()</code>.
+         * Received method calls are paired with the replies sent on
+         * the connection, so the latency includes handlers replying
+         * asynchronously. Tracking costs a hash table insert and
+         * lookup, under a mutex, per method call. At most 1024
+         * methods are tracked.
+         */
+        void track_methods (bool enable);
+
+        /**
+         * Return the latency statistics of the methods handled by
+         * this connection, sorted by interface and method name.
+         * @see track_methods
+         */
+        std::vector<method_stats_t> method_stats () const;
+
+        /**
+         * Set an executor running the message handlers.
+         * By default, the message handlers are called in the context
+         * of the I/O handler, and a slow handler delays all other
+         * messages on the connection. With an executor, the I/O
+         * handler only reads and routes the messages, and the
+         * handlers are called by the worker threads of the executor.<br/>
+         * Messages with the same sender, or to the same object path,
+         * are handled in the order they were received. Messages
+         * from different senders may be handled concurrently,
+         * even by the same handler object.<br/>
+         * Method calls and signals to objects registered by an
+         * ObjectHandler, and signals to a MessageHandler, are handled
+         * by the executor. Signals are still passed on to other handlers.
+         * Method calls to a MessageHandler are still handled by
+         * the I/O handler since the result of the message
+         * filter decides how libdbus continues to route the message.<br/>
+         * <b>Note:</b> Classes derived from ObjectHandler or
+         * MessageHandler with state used by the message handler
+         * should call <code>finish_jobs()</code> in their destructor.
+         * A handler destroyed in the context of the I/O handler
+         * can't wait for its messages being handled by the executor,
+         * since they may be waiting for the I/O handler.
+         * @param pool The executor, or <code>nullptr</code> to call
+         *             the handlers in the context of the I/O handler.
+         *             The same executor can be shared by several
+         *             connections.
+         * @param order How to order the incoming messages.
+         */
+        void executor (std::shared_ptr<WorkerPool> pool,
+                       dispatch_order order=dispatch_order::sender);
+
+        /**
+         * Return the executor running the message handlers,
+         * or <code>nullptr</code> if the message handlers
+         * are called by the I/O handler.
+         */
+        std::shared_ptr<WorkerPool> executor () const;
+
+        /**
+         * Return the key used to order a message in the executor.
+         * Messages with the same key are handled in order.
+         */
+        std::size_t executor_key (Message& msg) const;
+
+        /**
+         * Set the CPU affinity, scheduling policy and name of the
+         * thread running the I/O handler, to keep bus traffic on
+         * dedicated CPU cores. The worker threads of an executor
+         * are set up when the WorkerPool is created.<br/>
+         * If the I/O handler isn't running yet, the options are
+         * applied by the I/O handler when the connection is
+         * connected, and a failure is reported by
+         * <code>io_thread_error()</code>. The options are kept
+         * and applied again if the connection is reconnected.<br/>
+         * With an I/O handler given to the constructor, the options
+         * apply to the thread running that I/O handler, affecting
+         * everything else it handles.
+         * <pre>
+         * ultrabus::thread_options opts;
+         * opts.cpus = {3};
+         * opts.name = "dbus-io";
+         * conn.io_thread_options (opts);
+         * conn.connect ();
+         * </pre>
+         * @param options The thread options.
+         * @return 0 on success. -1 if the options can't be
+         *         applied and <code>errno</code> is set, or if
+         *         the connection is driven by an external event loop.
+         * @see stats_t::cpu_messages
+         */
+        int io_thread_options (const thread_options& options);
+
+        /**
+         * Return the error of the last attempt to apply the I/O
+         * thread options, like when they are applied by the I/O
+         * handler after <code>connect()</code>.
+         * @return 0 if the options were applied, or not applied yet.
+         *         Otherwise the <code>errno</code> value of the failure.
+         * @see io_thread_options
+         */
+        int io_thread_error () const;
+
+        /**
+         * Return <code>true</code> if the connection is driven
+         * by an external event loop instead of an I/O handler.
+         * @see Connection(external_loop_t)
+         */
+        bool externally_driven () const {
+            return ioh == nullptr;
+        }
+
+        /**
+         * Set a callback called when the events to wait for on a
+         * file descriptor change, on a connection driven by an
+         * external event loop. The callback is called with the
+         * current watches when it is set.<br/>
+         * The callback may be called by any thread using the
+         * connection. It shall only update the interest set of
+         * the event loop, like <code>epoll_ctl()</code>, and
+         * must not call methods of this connection.<br/>
+         * When the connection is disconnected, or destroyed, the
+         * callback is called with no events for each watched
+         * file descriptor.
+         * @param cb The callback, or <code>nullptr</code>.
+         */
+        void on_watch_change (watch_cb_t cb);
+
+        /**
+         * Return the file descriptors to watch and the events to
+         * wait for, on a connection driven by an external event loop.
+         * For a <code>poll()</code> loop that doesn't keep an
+         * interest set between calls.
+         * @return The watches, empty if the connection isn't
+         *         connected or has an I/O handler.
+         */
+        std::vector<watch_t> watches () const;
+
+        /**
+         * Return the time until <code>process_timeouts()</code>
+         * shall be called, on a connection driven by an external
+         * event loop. The value can be used as timeout of
+         * <code>poll()</code> and <code>epoll_wait()</code>.<br/>
+         * Call it again after each call to <code>process_ready()</code>
+         * and <code>process_timeouts()</code>. When another thread
+         * adds an earlier timeout, a watched file descriptor
+         * becomes readable.
+         * @return Milliseconds until the next timeout, 0 if a
+         *         timeout has expired, or -1 if there are no timeouts.
+         */
+        int next_timeout () const;
+
+        /**
+         * Handle events on a watched file descriptor, on a
+         * connection driven by an external event loop.
+         * Outgoing messages are written, incoming messages are read
+         * and the message handlers are called, or passed to the executor.<br/>
+         * The thread calling <code>process_ready()</code> and
+         * <code>process_timeouts()</code> is the context of the
+         * I/O handler: messages it sends are written directly, and
+         * it must not call <code>send_and_wait()</code>. The methods
+         * shall only be called by one thread at a time.
+         * @param fd A file descriptor returned by <code>watches()</code>
+         *           or reported by the <code>on_watch_change()</code> callback.
+         * @param events The events on the file descriptor,
+         *               <code>POLLIN</code>, <code>POLLOUT</code>,
+         *               <code>POLLERR</code> and <code>POLLHUP</code>.
+         */
+        void process_ready (int fd, uint32_t events);
+
+        /**
+         * Handle expired timeouts, on a connection
+         * driven by an external event loop.
+         * @see next_timeout
+         */
+        void process_timeouts ();
+
+        /**
+         * Add a message filter.
+         * Same as <code>dbus_connection_add_filter()</code>, but also
+         * works on loopback connections. Used by MessageHandler.
+         * @param function The filter function. It is called with a
+         *                 <code>nullptr</code> DBusConnection on
+         *                 loopback connections.
+         * @param data User data passed to the filter function.
+         * @return <code>false</code> on failure.
+         */
+        bool add_filter (DBusHandleMessageFunction function, void* data);
+
+        /**
+         * Remove a message filter added by <code>add_filter()</code>.
+         * @param function The filter function.
+         * @param data The user data of the filter.
+         */
+        void remove_filter (DBusHandleMessageFunction function, void* data);
+
+        /**
+         * Register a handler for an object path.
+         * Same as <code>dbus_connection_try_register_object_path()</code>
+         * and <code>dbus_connection_try_register_fallback()</code>, but
+         * also works on loopback connections. Used by ObjectHandler.
+         * @param path The object path.
+         * @param vtable The functions handling the object path. The
+         *               vtable must be valid until the object path
+         *               is unregistered.
+         * @param data User data passed to the vtable functions.
+         * @param fallback If <code>true</code>, the handler also gets
+         *                 messages to object paths below <code>path</code>
+         *                 that have no handler of their own.
+         * @return <code>false</code> if the object path is already
+         *         registered, or on failure.
+         */
+        bool register_object_path (const std::string& path,
+                                   const DBusObjectPathVTable* vtable,
+                                   void* data,
+                                   bool fallback=false);
+
+        /**
+         * Unregister an object path registered by <code>register_object_path()</code>.
+         * @param path The object path.
+         */
+        void unregister_object_path (const std::string& path);
+
         /**
          * Return the iohandler_base used by the connection object.
+         * Must not be called on a connection driven by an
+         * external event loop, it has no I/O handler.
          */
         iomultiplex::iohandler_base& io_handler () {
             return *ioh;
@@ -135,6 +979,8 @@ namespace ultrabus {
         /**
          * Return get DBus connection object.
          * Use this method if you're using the DBus api calls directly.
+         * Loopback connections have no DBus connection object,
+         * <code>nullptr</code> is returned.
          */
         DBusConnection* handle () {
             return conn;
@@ -142,6 +988,10 @@ namespace ultrabus {
 
 
     private:
+        friend class StartupBuilder;
+        friend class MessageHandler;
+        friend class ObjectHandler;
+
         // libdbus-1 connection object
         DBusConnection* conn;
         bool private_connection;
@@ -150,27 +1000,204 @@ namespace ultrabus {
         iomultiplex::iohandler_base* ioh;
         bool internal_io_handler;
 
-        // Pending messages
-        using pending_msg_cb_t = std::function<void (Message&)>;
-        std::mutex pending_msg_mutex;
-        std::map<DBusPendingCall*, pending_msg_cb_t> pending_messages;
+        // Pending method calls, keyed by message serial.
+        // Only accessed in the context of the I/O handler.
+        using pending_msg_cb_t = reply_cb_t;
+        pending_call_table pending_calls;
+        std::atomic<uint32_t> fail_calls_request {0}; // Set by disconnect(), cleared by the I/O handler
+        static constexpr uint32_t fail_calls_requested = 1;
+        static constexpr uint32_t fail_calls_taken = 2; // The I/O handler is failing the calls
+        static constexpr unsigned disconnect_wait_ms = 1000; // Max time to wait for the I/O handler
+
+        // Messages sent from other threads than the I/O handler
+        struct send_request : public mpsc_queue::node {
+            send_request ()
+                : msg (static_cast<DBusMessage*>(nullptr)),
+                  timeout (DBUS_TIMEOUT_USE_DEFAULT),
+                  allocated (false) {
+            }
+            send_request (const Message& m, pending_msg_cb_t&& cb, int t)
+                : msg (const_cast<Message&>(m).handle()), // Shared, not copied
+                  reply_cb (std::move(cb)),
+                  timeout (t),
+                  allocated (true) {
+            }
+            Message msg;
+            pending_msg_cb_t reply_cb;
+            int timeout;
+            bool allocated; // Deleted by the I/O handler when sent
+        };
+        mpsc_queue send_queue;
+        std::atomic_bool send_queue_signaled;
+        int wakeup_fd;
+        std::unique_ptr<iomultiplex::fd_connection> wakeup_conn;
+
+        std::atomic<std::size_t> send_queue_size {0};
+
+        // Outgoing queue watermarks
+        std::atomic<std::size_t> wm_high {0};
+        std::atomic<std::size_t> wm_low {0};
+        std::atomic_bool wm_reject {false};
+        std::atomic_bool wm_above {false};
+        std::mutex wm_mutex;
+        watermark_cb_t wm_cb;
+        std::vector<std::function<void ()>> writable_waiters;
+
+        // Batching of outgoing messages
+        std::atomic_int batch_depth {0};
+        std::atomic<unsigned> batch_max_delay {0};
+        std::atomic<std::size_t> batch_max_msgs {0};
+        std::atomic<std::size_t> batch_count {0};
+        std::atomic<long> batch_timer {-1}; // Timer ending the coalescing window, -1 if none
+        std::atomic<uint64_t> stat_batch_msgs {0};
+        std::atomic<uint64_t> stat_batch_flushes {0};
+
+        // Dispatch budget and statistics
+        std::atomic<unsigned> dispatch_max_msgs {0};
+        std::atomic<unsigned> dispatch_max_usec {0};
+        std::atomic_bool dispatch_pending {false};
+        std::chrono::steady_clock::time_point dispatch_deferred_at;
+        std::atomic<uint64_t> stat_dispatch_msgs {0};
+        std::atomic<uint64_t> stat_dispatch_passes {0};
+        std::atomic<uint64_t> stat_dispatch_deferred {0};
+        std::atomic<uint64_t> stat_dispatch_max_msgs {0};
+        std::atomic<uint64_t> stat_dispatch_total_usec {0};
+        std::atomic<uint64_t> stat_dispatch_max_usec {0};
+        std::atomic<uint64_t> stat_dispatch_max_defer_usec {0};
+        std::atomic<uint64_t> stat_dispatch_backlog {0};
+        std::atomic<uint64_t> stat_dispatch_max_backlog {0};
+        bool dispatch_backlog_active {false}; // Counting the backlog of a deferred pass
+        uint64_t dispatch_backlog_count {0};
+
+        // Busy polling
+        std::atomic<unsigned> busy_poll_usec {0};
+        std::atomic<uint64_t> stat_busy_poll_hits {0};
+        std::atomic<uint64_t> stat_busy_poll_misses {0};
+
+        // Message statistics, indexed by message type - 1
+        struct message_counters_t {
+            std::atomic<uint64_t> sent {0};
+            std::atomic<uint64_t> received {0};
+            latency_histogram dispatch_time;
+        };
+        message_counters_t stat_msgs[4];
+        latency_histogram stat_return_time;
+        latency_histogram stat_error_time;
+        std::atomic<uint64_t> stat_bytes_sent {0};
+        std::atomic<uint64_t> stat_bytes_received {0};
+        std::atomic<uint64_t> stat_pending {0};
+        std::atomic<uint64_t> stat_timeouts {0};
+        std::atomic_bool stat_count_bytes {false};
+        int dispatch_msg_type {0}; // Type of the message being dispatched, 0 if none
+        // Received messages per CPU core
+        std::vector<std::atomic<uint64_t>> stat_cpu_msgs =
+            std::vector<std::atomic<uint64_t>> (thread_options::cpu_count());
+
+        // Thread running the I/O handler, found the first
+        // time the I/O handler handles a wakeup.
+        std::mutex io_thread_mutex;
+        thread_options io_thread_opts;
+        pthread_t io_thread;
+        std::atomic_bool io_thread_known {false};
+        std::atomic_int io_thread_errno {0}; // Failure to apply io_thread_opts
+
+        // Latency of handled methods. Allocated the first time
+        // it is enabled, and kept until the object is destroyed.
+        struct method_tracker;
+        std::atomic_bool track_methods_flag {false};
+        mutable std::mutex method_tracker_mutex;
+        std::unique_ptr<method_tracker> methods;
+
+        // Executor running the message handlers
+        mutable std::mutex executor_mutex;
+        std::shared_ptr<WorkerPool> executor_pool;
+        std::atomic<dispatch_order> executor_order {dispatch_order::sender};
 
         // DBus I/O
-        std::mutex io_mutex;
+        mutable std::mutex io_mutex;
         iomultiplex::timer_set* io_timers;
-        std::map<DBusTimeout*, long> io_timeouts;
         std::map<DBusWatch*, iomultiplex::fd_connection> io_watches;
 
+        // libdbus timeouts are kept in a timer wheel with millisecond
+        // ticks, attached to the DBusTimeout objects with
+        // dbus_timeout_set_data(). A single timer in the I/O handler
+        // is armed for the next event in the timer wheel.
+        struct io_timeout_t : public timer_wheel::entry {
+            Connection* self;
+            DBusTimeout* timeout;
+        };
+        timer_wheel io_timeouts;
+        long io_timeout_timer {-1};       // Timer id, -1 if not armed
+        uint64_t io_timeout_armed_at {0}; // Time the timer is armed for
+
+        // External event loop, used instead of an I/O handler.
+        // The maps are protected by io_mutex.
+        std::atomic<std::thread::id> ext_thread {std::thread::id()}; // Thread running the event loop
+        bool ext_active {false};                      // The wakeup fd is watched
+        watch_cb_t ext_watch_cb;
+        std::map<DBusWatch*, int> ext_watches;        // File descriptor of each libdbus watch
+        std::map<int, uint32_t> ext_interest;         // Events reported to the event loop
+        std::atomic<uint64_t> ext_batch_deadline {0}; // End of the coalescing window in ms, 0 if none
+
+        // State of a loopback connection, nullptr if not a loopback connection.
+        // Only replaced using std::atomic_store(), other threads than the
+        // I/O handler take a snapshot with loop_ref().
+        struct loopback_t;
+        std::shared_ptr<loopback_t> loop;
+
+        int open_bus (const std::string& bus_address,
+                      const bool private_connection,
+                      const bool exit_on_disconnect);
+        bool set_unique_name (Message& hello_reply);
         void start_message_dispatcher ();
+        int send_with_reply (const Message& msg, pending_msg_cb_t& reply_cb, int timeout);
+        bool batching () const;
+        void queue_request (send_request* req, bool bypass_batch=false);
+        bool io_context () const;
+        bool io_context_elsewhere ();
+        void wakeup_io_handler ();
+        void on_wakeup (iomultiplex::io_result_t& ior);
+        void process_wakeup ();
+        void init_io_thread ();
+        void drain_send_queue ();
+        void dispatch_messages ();
+        void busy_poll_spin ();
+        void check_watermarks ();
+        bool add_writable_waiter (std::function<void ()>&& cb);
+        void set_writable ();
+        void count_sent (DBusMessage* msg, bool loopback=false);
+        void count_received (DBusMessage* msg);
+        void count_reply (DBusMessage* reply, uint64_t sent_at);
+        void update_pending ();
+        void fail_pending_calls ();
+
+        std::shared_ptr<loopback_t> loop_ref () const;
+        int loop_send (loopback_t& l, const Message& msg);
+        int loop_send_with_reply (const Message& msg, pending_msg_cb_t& reply_cb, int timeout);
+        bool loop_dispatch ();
+        void loop_handle_message (Message& msg);
+        void loop_fail_calls ();
+        void loop_close ();
+        void loop_arm_timer ();
+        void loop_on_timer ();
 
         void on_dispatch_status (DBusDispatchStatus status);
+        void schedule_dispatch ();
         void on_watch_rx_ready (iomultiplex::io_result_t& ior, DBusWatch* watch);
         void on_watch_tx_ready (iomultiplex::io_result_t& ior, DBusWatch* watch);
+        void schedule_timeout (io_timeout_t& t);
+        void arm_timeout_timer ();
+        void on_timeout_timer ();
+
+        uint32_t ext_events (int fd) const;
+        void ext_update (int fd);
+        void ext_poke ();
 
         // Static callbacks called from libdbus-1
         //
         static void dbus_pending_msg_cb (DBusPendingCall* pending, void* data);
         static void dbus_dispatch_status_cb (DBusConnection* c, DBusDispatchStatus status, void* data);
+        static DBusHandlerResult dbus_stats_filter_cb (DBusConnection* c, DBusMessage* msg, void* data);
 
         static dbus_bool_t dbus_add_watch_cb (DBusWatch* watch, void* data);
         static void dbus_remove_watch_cb (DBusWatch* watch, void* data);
@@ -179,6 +1206,7 @@ namespace ultrabus {
         static dbus_bool_t dbus_add_timeout_cb (DBusTimeout* timeout, void* data);
         static void dbus_remove_timeout_cb (DBusTimeout* timeout, void* data);
         static void dbus_toggled_timeout_cb (DBusTimeout* timeout, void* data);
+        static void dbus_free_timeout_data (void* data);
     };
 
 
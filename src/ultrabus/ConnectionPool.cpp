@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/ConnectionPool.hpp>
+#include <ultrabus/WorkerPool.hpp>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+
+
+namespace ultrabus {
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    ConnectionPool::ConnectionPool (unsigned size)
+    {
+        if (size == 0)
+            size = std::max (std::thread::hardware_concurrency(), 1u);
+
+        connections.reserve (size);
+        for (unsigned i=0; i<size; ++i)
+            connections.emplace_back (new Connection);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    ConnectionPool::~ConnectionPool ()
+    {
+        disconnect ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int ConnectionPool::connect (const DBusBusType type,
+                                 const bool exit_on_disconnect)
+    {
+        for (auto& c : connections) {
+            if (c->connect(type, true, exit_on_disconnect)) {
+                disconnect ();
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int ConnectionPool::connect (const std::string& bus_address,
+                                 const int timeout,
+                                 const bool exit_on_disconnect)
+    {
+        for (auto& c : connections) {
+            if (c->connect(bus_address, timeout, true, exit_on_disconnect)) {
+                disconnect ();
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    bool ConnectionPool::is_connected () const
+    {
+        for (auto& c : connections) {
+            if (!c->is_connected())
+                return false;
+        }
+        return !connections.empty ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void ConnectionPool::disconnect ()
+    {
+        for (auto& c : connections)
+            c->disconnect ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    Connection& ConnectionPool::select (const Message& msg)
+    {
+        auto* dbmsg = const_cast<Message&>(msg).handle ();
+        auto key = WorkerPool::key (dbus_message_get_destination(dbmsg)) * 31 +
+            WorkerPool::key (dbus_message_get_path(dbmsg));
+        return *connections[key % connections.size()];
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int ConnectionPool::send (const Message& msg,
+                              Connection::reply_cb_t reply_cb,
+                              int timeout)
+    {
+        return select(msg).send (msg, std::move(reply_cb), timeout);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int ConnectionPool::send (const Message& msg)
+    {
+        return select(msg).send (msg);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    Message ConnectionPool::send_and_wait (const Message& msg, int timeout)
+    {
+        return select(msg).send_and_wait (msg, timeout);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::future<Message> ConnectionPool::send_async (const Message& msg, int timeout)
+    {
+        auto promise = std::make_shared<std::promise<Message>> ();
+        auto future = promise->get_future ();
+
+        if (select(msg).send(msg,
+                             [promise](Message& reply) {
+                                 promise->set_value (std::move(reply));
+                             },
+                             timeout))
+        {
+            promise->set_value (Connection::send_error(errno));
+        }
+        return future;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::vector<Message> ConnectionPool::send_and_wait (const std::vector<Message>& messages,
+                                                        int timeout)
+    {
+        std::vector<std::future<Message>> futures;
+        futures.reserve (messages.size());
+        for (auto& msg : messages)
+            futures.emplace_back (send_async(msg, timeout));
+
+        std::vector<Message> replies;
+        replies.reserve (futures.size());
+        for (auto& f : futures)
+            replies.emplace_back (f.get());
+        return replies;
+    }
+
+
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_CONNECTIONPOOL_HPP
+#define ULTRABUS_CONNECTIONPOOL_HPP
+
+#include <ultrabus/Message.hpp>
+#include <ultrabus/Connection.hpp>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <dbus/dbus.h>
+
+
+namespace ultrabus {
+
+
+    /**
+     * A pool of private connections to the same bus.
+     * Each connection has its own socket and its own I/O handler
+     * thread. Outgoing messages are distributed over the connections
+     * by hashing the destination and object path of the message, so
+     * messages to the same object are sent, and replied to, in order
+     * on the same connection while messages to different objects
+     * are handled in parallel.<br/>
+     * Each connection in the pool has its own unique bus name.
+     * Signal handlers and objects should normally be registered on
+     * a separate connection, or on a specific connection in the pool.
+     */
+    class ConnectionPool {
+    public:
+        /**
+         * Constructor.
+         * @param size The number of connections in the pool. If 0,
+         *             the number of connections is the number of
+         *             available CPU cores.
+         */
+        explicit ConnectionPool (unsigned size=0);
+
+        /**
+         * Destructor.
+         * Disconnect all connections in the pool.
+         */
+        ~ConnectionPool ();
+
+        ConnectionPool (const ConnectionPool&) = delete;
+        ConnectionPool& operator= (const ConnectionPool&) = delete;
+
+        /**
+         * Connect all connections in the pool to a well known bus.
+         * @param type The DBus to connect to, DBUS_BUS_SESSION or DBUS_BUS_SYSTEM.
+         * @param exit_on_disconnect If <code>true</code>, the process will
+         *                           exit if a connection is disconnected.
+         * @return 0 on success, -1 on failure. On failure,
+         *         no connection in the pool is connected.
+         */
+        int connect (const DBusBusType type=DBUS_BUS_SESSION,
+                     const bool exit_on_disconnect=true);
+
+        /**
+         * Connect all connections in the pool to a specific bus address.
+         * @param bus_address The address of the bus to connect to.
+         * @param timeout Timeout in milliseconds when connecting to the bus.
+         * @param exit_on_disconnect If <code>true</code>, the process will
+         *                           exit if a connection is disconnected.
+         * @return 0 on success, -1 on failure. On failure,
+         *         no connection in the pool is connected.
+         */
+        int connect (const std::string& bus_address,
+                     const int timeout=DBUS_TIMEOUT_USE_DEFAULT,
+                     const bool exit_on_disconnect=true);
+
+        /**
+         * Return true if all connections in the pool are connected.
+         */
+        bool is_connected () const;
+
+        /**
+         * Disconnect all connections in the pool.
+         */
+        void disconnect ();
+
+        /**
+         * Return the number of connections in the pool.
+         */
+        unsigned size () const {
+            return (unsigned) connections.size ();
+        }
+
+        /**
+         * Return a connection in the pool.
+         * @param index The index of the connection, 0 to size()-1.
+         */
+        Connection& operator[] (unsigned index) {
+            return *connections[index];
+        }
+
+        /**
+         * Return the connection used to send a message.
+         * Messages with the same destination and
+         * object path use the same connection.
+         * @param msg A DBus message.
+         */
+        Connection& select (const Message& msg);
+
+        /**
+         * Send a message on the bus.
+         * @param msg The DBus message to send.
+         * @param reply_cb A callback called when a message reply is
+         *                 received. It is called in the context of
+         *                 the I/O handler of the connection used to
+         *                 send the message.
+         * @param timeout The maximum time in milliseconds to wait for a message reply.
+         * @return 0 on success, -1 on failure.
+         * @see Connection::send
+         */
+        int send (const Message& msg,
+                  Connection::reply_cb_t reply_cb,
+                  int timeout=DBUS_TIMEOUT_USE_DEFAULT);
+
+        /**
+         * Send a message on the bus without caring about a message reply.
+         * @param msg The DBus message to send.
+         * @return 0 on success, -1 on failure.
+         */
+        int send (const Message& msg);
+
+        /**
+         * Send a message on the bus and wait for a reply.
+         * @param msg The DBus message to send.
+         * @param timeout The maximum time in milliseconds to wait for a message reply.
+         * @return A message reply.
+         * @see Connection::send_and_wait
+         */
+        Message send_and_wait (const Message& msg, int timeout=DBUS_TIMEOUT_USE_DEFAULT);
+
+        /**
+         * Send a message on the bus and return a future message reply.
+         * If the message can't be sent, the future holds the error reply
+         * made by <code>Connection::send_error()</code>, telling why.
+         * @param msg The DBus message to send. The message is
+         *            not copied, it must not be modified after
+         *            this call.
+         * @param timeout The maximum time in milliseconds to wait for a message reply.
+         * @return A future message reply.
+         */
+        std::future<Message> send_async (const Message& msg, int timeout=DBUS_TIMEOUT_USE_DEFAULT);
+
+        /**
+         * Send a number of messages on the bus and wait for all replies.
+         * The messages are sent in parallel over the connections in the pool.
+         * @param messages The DBus messages to send.
+         * @param timeout The maximum time in milliseconds to wait for each message reply.
+         * @return The message replies, in the same order as the messages.
+         */
+        std::vector<Message> send_and_wait (const std::vector<Message>& messages,
+                                            int timeout=DBUS_TIMEOUT_USE_DEFAULT);
+
+
+    private:
+        std::vector<std::unique_ptr<Connection>> connections;
+    };
+
+
+}
+
+#endif
@@ -171,6 +171,19 @@ namespace ultrabus {
     }
 
 
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    Message Message::create_error (const char* error_name,
+                                   const std::string& error_message)
+    {
+        Message reply (dbus_message_new(DBUS_MESSAGE_TYPE_ERROR));
+        reply.dec_ref (); // ref count increased in Message constructor
+        reply.error_name (error_name);
+        reply << error_message;
+        return reply;
+    }
+
+
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
     Message::Message (const Message& message)
@@ -187,7 +200,7 @@ namespace ultrabus {
 
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
-    Message::Message (Message&& message)
+    Message::Message (Message&& message) noexcept
     {
         msg_handle = message.msg_handle;
         message.msg_handle = nullptr;
@@ -229,7 +242,7 @@ namespace ultrabus {
 
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
-    Message& Message::operator= (Message&& message)
+    Message& Message::operator= (Message&& message) noexcept
     {
         if (&message != this) {
             DBusMessage* old_msg_handle = msg_handle;
@@ -250,6 +263,73 @@ namespace ultrabus {
     }
 
 
+    //-----------------------------------------------------------------------
+    // Return true if the array elements are of a fixed size type
+    // that can be appended and read as a whole.
+    //-----------------------------------------------------------------------
+    static bool is_fixed_element (int type_code)
+    {
+        return dbus_type_is_fixed(type_code) && type_code != DBUS_TYPE_UNIX_FD;
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    template<typename T>
+    static void append_fixed_elements (DBusMessageIter& iter,
+                                       const dbus_array& array,
+                                       int type_code,
+                                       T DBusBasicValue::* field)
+    {
+        std::vector<T> values;
+        values.reserve (array.size());
+        for (std::size_t i=0; i<array.size(); ++i) {
+            auto& element = dynamic_cast<dbus_basic&> (const_cast<dbus_array&>(array)[i]);
+            values.push_back (element.get_val().*field);
+        }
+        const T* data = values.data ();
+        dbus_message_iter_append_fixed_array (&iter, type_code, &data, (int) values.size());
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Append all elements of an array of a fixed size type
+    // with one call to libdbus.
+    //-----------------------------------------------------------------------
+    static void append_fixed_array (DBusMessageIter& iter, const dbus_array& array, int type_code)
+    {
+        switch (type_code) {
+        case DBUS_TYPE_BYTE:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::byt);
+            break;
+        case DBUS_TYPE_BOOLEAN:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::bool_val);
+            break;
+        case DBUS_TYPE_INT16:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::i16);
+            break;
+        case DBUS_TYPE_UINT16:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::u16);
+            break;
+        case DBUS_TYPE_INT32:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::i32);
+            break;
+        case DBUS_TYPE_UINT32:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::u32);
+            break;
+        case DBUS_TYPE_INT64:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::i64);
+            break;
+        case DBUS_TYPE_UINT64:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::u64);
+            break;
+        case DBUS_TYPE_DOUBLE:
+            append_fixed_elements (iter, array, type_code, &DBusBasicValue::dbl);
+            break;
+        }
+    }
+
+
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
     static void append_dbus_type_base_impl (DBusMessageIter& iter, const dbus_type_base& arg)
@@ -279,13 +359,18 @@ namespace ultrabus {
             }else{
                 arg_array = dynamic_cast<dbus_array const*> (&arg);
             }
-            if (!arg_array->element_signature().empty()) {
+            auto element_sig = arg_array->element_signature ();
+            if (!element_sig.empty()) {
                 DBusMessageIter sub_iter;
                 dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
-                                                  arg_array->element_signature().c_str(), &sub_iter);
-                for (std::size_t i=0; i<arg_array->size(); ++i) {
-                    auto& sub_arg = const_cast<dbus_array&>(*arg_array)[i];
-                    append_dbus_type_base_impl (sub_iter, sub_arg);
+                                                  element_sig.c_str(), &sub_iter);
+                if (element_sig.size() == 1 && is_fixed_element(element_sig[0])) {
+                    append_fixed_array (sub_iter, *arg_array, element_sig[0]);
+                }else{
+                    for (std::size_t i=0; i<arg_array->size(); ++i) {
+                        auto& sub_arg = const_cast<dbus_array&>(*arg_array)[i];
+                        append_dbus_type_base_impl (sub_iter, sub_arg);
+                    }
                 }
                 dbus_message_iter_close_container (&iter, &sub_iter);
             }
@@ -325,7 +410,62 @@ namespace ultrabus {
 
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
-    static dbus_type_ptr arguments_get_arg_impl (ultrabus::MessageParamIterator& iter)
+    template<typename T>
+    static void add_fixed_elements (dbus_array& array, ultrabus::MessageParamIterator& iter)
+    {
+        const T* values = nullptr;
+        int n = iter.fixed_array (&values);
+        for (int i=0; i<n; ++i)
+            array.add (dbus_basic(values[i]));
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Read all elements of an array of a fixed size type
+    // with one call to libdbus.
+    //-----------------------------------------------------------------------
+    static void add_fixed_array (dbus_array& array, ultrabus::MessageParamIterator& iter, int type_code)
+    {
+        switch (type_code) {
+        case DBUS_TYPE_BYTE:
+            add_fixed_elements<uint8_t> (array, iter);
+            break;
+        case DBUS_TYPE_BOOLEAN:
+            {
+                const dbus_bool_t* values = nullptr;
+                int n = iter.fixed_array (&values);
+                for (int i=0; i<n; ++i)
+                    array.add (dbus_basic(values[i] != FALSE));
+            }
+            break;
+        case DBUS_TYPE_INT16:
+            add_fixed_elements<int16_t> (array, iter);
+            break;
+        case DBUS_TYPE_UINT16:
+            add_fixed_elements<uint16_t> (array, iter);
+            break;
+        case DBUS_TYPE_INT32:
+            add_fixed_elements<int32_t> (array, iter);
+            break;
+        case DBUS_TYPE_UINT32:
+            add_fixed_elements<uint32_t> (array, iter);
+            break;
+        case DBUS_TYPE_INT64:
+            add_fixed_elements<int64_t> (array, iter);
+            break;
+        case DBUS_TYPE_UINT64:
+            add_fixed_elements<uint64_t> (array, iter);
+            break;
+        case DBUS_TYPE_DOUBLE:
+            add_fixed_elements<double> (array, iter);
+            break;
+        }
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    static dbus_type_ptr arguments_get_arg_impl (ultrabus::MessageParamIterator& iter, bool borrow)
     {
         DBusBasicValue basic_value;
         dbus_basic*    arg_basic;
@@ -379,16 +519,22 @@ namespace ultrabus {
 
         case DBUS_TYPE_STRING:
             iter.basic_value (&basic_value);
+            if (borrow)
+                return dbus_type_ptr (new dbus_basic(dbus_basic::borrowed, basic_value.str));
             return dbus_type_ptr (new dbus_basic(basic_value.str));
             break;
 
         case DBUS_TYPE_OBJECT_PATH:
             iter.basic_value (&basic_value);
+            if (borrow)
+                return dbus_type_ptr (new dbus_basic(dbus_basic::borrowed, basic_value.str, DBUS_TYPE_OBJECT_PATH));
             return dbus_type_ptr (new dbus_basic(basic_value.str, DBUS_TYPE_OBJECT_PATH));
             break;
 
         case DBUS_TYPE_SIGNATURE:
             iter.basic_value (&basic_value);
+            if (borrow)
+                return dbus_type_ptr (new dbus_basic(dbus_basic::borrowed, basic_value.str, DBUS_TYPE_SIGNATURE));
             return dbus_type_ptr (new dbus_basic(basic_value.str, DBUS_TYPE_SIGNATURE));
             break;
 
@@ -402,15 +548,19 @@ namespace ultrabus {
         case DBUS_TYPE_STRUCT:
             arg_struct = new dbus_struct;
             for (auto sub_iter = iter.iterator(); sub_iter==true; ++sub_iter)
-                arg_struct->add (*arguments_get_arg_impl(sub_iter));
+                arg_struct->add (std::move(*arguments_get_arg_impl(sub_iter, borrow)));
             return dbus_type_ptr (arg_struct);
 
         case DBUS_TYPE_ARRAY:
         {
             auto sub_iter = iter.iterator ();
             dbus_array* arg_array = new dbus_array (sub_iter.signature());
-            for (; sub_iter==true; ++sub_iter)
-                arg_array->add (*arguments_get_arg_impl(sub_iter));
+            if (is_fixed_element(iter.element_type())) {
+                add_fixed_array (*arg_array, sub_iter, iter.element_type());
+            }else{
+                for (; sub_iter==true; ++sub_iter)
+                    arg_array->add (std::move(*arguments_get_arg_impl(sub_iter, borrow)));
+            }
             return dbus_type_ptr (arg_array);
         }
 
@@ -419,10 +569,10 @@ namespace ultrabus {
                 dbus_dict_entry* arg_dict_entry = new dbus_dict_entry;
                 auto sub_iter = iter.iterator ();
                 if (sub_iter == true) {
-                    arg_dict_entry->key (*arguments_get_arg_impl(sub_iter));
+                    arg_dict_entry->key (std::move(*arguments_get_arg_impl(sub_iter, borrow)));
                     ++sub_iter;
                     if (sub_iter == true)
-                        arg_dict_entry->value (*arguments_get_arg_impl(sub_iter));
+                        arg_dict_entry->value (std::move(*arguments_get_arg_impl(sub_iter, borrow)));
                 }
                 return dbus_type_ptr (arg_dict_entry);
             }
@@ -431,7 +581,7 @@ namespace ultrabus {
         case DBUS_TYPE_VARIANT:
             arg_variant = new dbus_variant;
             for (auto sub_iter = iter.iterator(); sub_iter==true; ++sub_iter)
-                arg_variant->value (*arguments_get_arg_impl(sub_iter));
+                arg_variant->value (std::move(*arguments_get_arg_impl(sub_iter, borrow)));
             return dbus_type_ptr (arg_variant);
         }
 
@@ -442,13 +592,21 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
     std::vector<dbus_type_ptr> Message::arguments ()
+    {
+        return arguments (false);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::vector<dbus_type_ptr> Message::arguments (bool borrow_strings)
     {
         std::vector<dbus_type_ptr> args;
 
         ultrabus::MessageParamIterator arg_iter (*this);
 
         for (; arg_iter==true; ++arg_iter) {
-            auto arg_ptr = arguments_get_arg_impl (arg_iter);
+            auto arg_ptr = arguments_get_arg_impl (arg_iter, borrow_strings);
             if (arg_ptr != nullptr) {
                 args.push_back (arg_ptr);
             }
@@ -523,6 +681,70 @@ namespace ultrabus {
     }
 
 
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    static inline std::string_view to_view (const char* str)
+    {
+        return str ? std::string_view(str) : std::string_view();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view Message::destination_view () const
+    {
+        return msg_handle ? to_view(dbus_message_get_destination(msg_handle)) : std::string_view();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view Message::path_view () const
+    {
+        return msg_handle ? to_view(dbus_message_get_path(msg_handle)) : std::string_view();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view Message::interface_view () const
+    {
+        return msg_handle ? to_view(dbus_message_get_interface(msg_handle)) : std::string_view();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view Message::name_view () const
+    {
+        return msg_handle ? to_view(dbus_message_get_member(msg_handle)) : std::string_view();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view Message::error_name_view () const
+    {
+        return msg_handle ? to_view(dbus_message_get_error_name(msg_handle)) : std::string_view();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view Message::sender_view () const
+    {
+        return msg_handle ? to_view(dbus_message_get_sender(msg_handle)) : std::string_view();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view Message::signature_view () const
+    {
+        return msg_handle ? to_view(dbus_message_get_signature(msg_handle)) : std::string_view();
+    }
+
+
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
     std::string Message::destination () const
@@ -27,7 +27,12 @@
 #include <ultrabus/dbus_struct.hpp>
 #include <ultrabus/dbus_variant.hpp>
 #include <ultrabus/Properties.hpp>
+#include <ultrabus/dbus_traits.hpp>
+#include <ultrabus/retvalue.hpp>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <cstring>
 #include <dbus/dbus.h>
 
 
@@ -106,6 +111,16 @@ namespace ultrabus {
             {
             }
 
+        /**
+         * Create an error message that isn't a reply to a received
+         * message, like an error detected locally and passed to
+         * a reply callback instead of a reply from the remote peer.
+         * @param error_name The name of the error.
+         * @param error_message The error description.
+         */
+        static Message create_error (const char* error_name,
+                                     const std::string& error_message);
+
         /**
          * Copy constructor.
          * Create a copy of another message.
@@ -117,7 +132,7 @@ namespace ultrabus {
          * Move constructor.
          * @param message The message to move.
          */
-        Message (Message&& message);
+        Message (Message&& message) noexcept;
 
         /**
          * Destructor.
@@ -144,7 +159,7 @@ namespace ultrabus {
          * Move operator.
          * @param message The message to move.
          */
-        Message& operator= (Message&& message);
+        Message& operator= (Message&& message) noexcept;
 
         /**
          * Return the underlaying DBusMessage handle.
@@ -165,12 +180,54 @@ namespace ultrabus {
             append_arg_impl (arg, args...);
         }
 
+        /**
+         * Add arguments to the message, marshalled directly from
+         * C++ types. The DBus signature is known at compile time,
+         * and the values are appended to the message without creating
+         * any intermediate dbus_type objects.
+         * <pre>
+         * std::vector<double> samples {1.0, 2.5};
+         * msg.write<int32_t, std::string, std::vector<double>> (42, "sensor", samples);
+         * msg.write (uint32_t(1), true);  // Types can be deduced, signature "ub"
+         * </pre>
+         * Arrays of fixed size types, from a <code>std::vector</code>
+         * or a <code>fixed_array_view</code>, are copied as a whole.
+         * The types must have a dbus_traits specialization. Object
+         * paths, signatures, variants and unix file descriptors are
+         * added with <code>append_arg()</code> or <code>operator<<</code>.
+         * @param args The arguments to add.
+         * @return A reference to this message.
+         * @see dbus_traits
+         */
+        template<typename... Ts>
+        Message& write (const Ts&... args) {
+            static_assert (dbus_signature<Ts...>::supported,
+                           "Unsupported argument type in Message::write");
+            DBusMessageIter iter;
+            dbus_message_iter_init_append (msg_handle, &iter);
+            (dbus_traits<std::decay_t<Ts>>::append(iter, args), ...);
+            return *this;
+        }
+
         /**
          * Return the message arguments.
          * @return A vector of shared pointers to the message arguments.
          */
         std::vector<dbus_type_ptr> arguments ();
 
+        /**
+         * Return the message arguments.
+         * @param borrow_strings If <code>true</code>, string, object path
+         *                       and signature values are not copied,
+         *                       the dbus_basic objects point into the
+         *                       message instead. Such values are only
+         *                       valid as long as this message exists.
+         *                       Copies of them own their strings.
+         * @return A vector of shared pointers to the message arguments.
+         * @see dbus_basic::is_borrowed
+         */
+        std::vector<dbus_type_ptr> arguments (bool borrow_strings);
+
         /**
          * Get arguments from the message.
          * Supply a list of pointers to different dbus types that will
@@ -181,6 +238,56 @@ namespace ultrabus {
          */
         bool get_args (dbus_type* arg, ...);
 
+        /**
+         * Read the first arguments of the message as C++ types.
+         * Only the requested arguments are decoded, straight from
+         * the message into the returned tuple. The message may have
+         * more arguments than requested.
+         * <pre>
+         * auto args = reply.read<std::string, uint32_t> ();
+         * if (!args.err())
+         *     std::cout << std::get<0>(args.get()) << std::endl;
+         * </pre>
+         * The types must have a dbus_traits specialization.
+         * The signature of the types is known at compile time, and
+         * checked once against the signature of the message.
+         * Strings read as <code>std::string_view</code> and arrays
+         * read as <code>fixed_array_view</code> are not copied, they
+         * are valid as long as the message exists.
+         * @return A tuple with the arguments. On error the error code
+         *         is -1 and the error description is set. If this is
+         *         an error message, the error name and message are
+         *         returned as the error description.
+         * @see dbus_traits
+         */
+        template<typename... Ts>
+        retvalue<std::tuple<Ts...>> read () const {
+            static_assert (sizeof...(Ts) > 0, "No argument types in Message::read");
+            static_assert (dbus_signature<Ts...>::supported && (!std::is_pointer<Ts>::value && ...),
+                           "Unsupported argument type in Message::read");
+
+            retvalue<std::tuple<Ts...>> retval;
+            if (is_error()) {
+                retval.err (-1, error_name() + std::string(": ") + error_msg());
+                return retval;
+            }
+            using sig = typename dbus_signature<Ts...>::type;
+            const char* msg_sig = msg_handle ? dbus_message_get_signature(msg_handle) : nullptr;
+            if (!msg_sig || strncmp(msg_sig, sig::value, sizeof(sig::value)-1)) {
+                retval.err (-1, std::string("Invalid message arguments, expected signature ") +
+                            sig::value + ", got " + signature());
+                return retval;
+            }
+
+            DBusMessageIter iter;
+            dbus_message_iter_init (msg_handle, &iter);
+            std::apply ([&iter](Ts&... values) {
+                    ((dbus_traits<Ts>::read(iter, values), dbus_message_iter_next(&iter)), ...);
+                },
+                retval.get());
+            return retval;
+        }
+
         /**
          * Return the DBus message type.
          * @return The DBus message type.
@@ -326,6 +433,24 @@ namespace ultrabus {
          */
         std::string signature () const;
 
+        /**
+         * @name Borrowed header fields
+         * Return a header field without copying it.
+         * The views point into the underlaying DBusMessage and are
+         * valid as long as the message exists and the field isn't
+         * changed. An empty view is returned if the field isn't set.
+         * Intended for routing and filtering received messages.
+         */
+        ///@{
+        std::string_view destination_view () const; /**< The destination of the message. */
+        std::string_view path_view () const;        /**< The object path of the message. */
+        std::string_view interface_view () const;   /**< The interface of the message. */
+        std::string_view name_view () const;        /**< The name of the method or signal. */
+        std::string_view error_name_view () const;  /**< The error name of an error message. */
+        std::string_view sender_view () const;      /**< The unique name of the sender. */
+        std::string_view signature_view () const;   /**< The signature of the message. */
+        ///@}
+
         /**
          * Increase message reference counter.
          */
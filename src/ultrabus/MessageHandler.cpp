@@ -17,18 +17,11 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <ultrabus/MessageHandler.hpp>
+#include <ultrabus/trace_buffer.hpp>
 #include <system_error>
+#include <algorithm>
 #include <cerrno>
 
-//#define TRACE_DEBUG
-
-#ifdef TRACE_DEBUG
-#  include <cstdio>
-#  define TRACE(format, ...) fprintf(stderr, "(%u) %s:%s:%d: " format "\n", (unsigned)gettid(), __FILE__, __FUNCTION__, __LINE__, ## __VA_ARGS__)
-#else
-#  define TRACE(format, ...)
-#endif
-
 
 namespace ultrabus {
 
@@ -39,13 +32,8 @@ namespace ultrabus {
     MessageHandler::MessageHandler (Connection& connection)
         : conn (connection)
     {
-        if (!dbus_connection_add_filter(conn.handle(),
-                                        static_dbus_handler,
-                                        this,
-                                        nullptr))
-        {
+        if (!conn.add_filter(static_dbus_handler, this))
             throw std::system_error (ENOMEM, std::generic_category());
-        }
     }
 
 
@@ -53,13 +41,15 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     MessageHandler::~MessageHandler ()
     {
-        dbus_connection_remove_filter (conn.handle(),
-                                       static_dbus_handler,
-                                       this);
+        conn.remove_filter (static_dbus_handler, this);
+        finish_jobs ();
 
+        // Match rules are only used by a bus
+        if (!conn.handle())
+            return;
         std::lock_guard<std::mutex> lock (match_rule_mutex);
         for (auto& rule : match_rules) {
-            TRACE ("Remove match rule: %s", rule.c_str());
+            trace_buffer::record (trace_event::match_remove, this);
             dbus_bus_remove_match (conn.handle(), rule.c_str(), nullptr);
         }
     }
@@ -72,8 +62,8 @@ namespace ultrabus {
         std::lock_guard<std::mutex> lock (match_rule_mutex);
 
         bool is_new_rule = match_rules.emplace(rule).second;
-        if (is_new_rule) {
-            TRACE ("Add match rule: %s", rule.c_str());
+        if (is_new_rule && conn.handle()) {
+            trace_buffer::record (trace_event::match_add, this);
             dbus_bus_add_match (conn.handle(), rule.c_str(), nullptr);
         }
     }
@@ -87,8 +77,9 @@ namespace ultrabus {
 
         auto iter = match_rules.find (rule);
         if (iter != match_rules.end()) {
-            TRACE ("Remove match rule: %s", rule.c_str());
-            dbus_bus_remove_match (conn.handle(), rule.c_str(), nullptr);
+            trace_buffer::record (trace_event::match_remove, this);
+            if (conn.handle())
+                dbus_bus_remove_match (conn.handle(), rule.c_str(), nullptr);
             match_rules.erase (iter);
         }
     }
@@ -130,6 +121,15 @@ namespace ultrabus {
     }
 
 
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void MessageHandler::finish_jobs ()
+    {
+        // Running jobs may be waiting for the I/O handler
+        jobs.purge (!conn.io_context());
+    }
+
+
     //--------------------------------------------------------------------------
     //--------------------------------------------------------------------------
     DBusHandlerResult MessageHandler::static_dbus_handler (
@@ -139,6 +139,22 @@ namespace ultrabus {
     {
         MessageHandler* handler {static_cast<MessageHandler*>(user_data)};
         Message msg (dbmsg);
+
+        // Signals are handled by the executor, if any. Other filters
+        // and object handlers also get the chance to handle them.
+        if (msg.is_signal()) {
+            auto pool = handler->conn.executor ();
+            if (pool) {
+                auto key = handler->conn.executor_key (msg);
+                handler->jobs.post (pool,
+                                    key,
+                                    [handler, m=std::move(msg)]() mutable {
+                                        handler->on_message (m);
+                                    });
+                return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+            }
+        }
+
         return handler->on_message(msg) ?
             DBUS_HANDLER_RESULT_HANDLED :
             DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
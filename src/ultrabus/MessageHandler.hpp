@@ -26,6 +26,8 @@
 #include <string>
 #include <mutex>
 #include <set>
+#include <vector>
+#include <memory>
 
 
 namespace ultrabus {
@@ -45,6 +47,8 @@ namespace ultrabus {
         /**
          * Destructor.
          * Remove all added match rules and unregister this handler from the DBus.
+         * If the connection has an executor, wait for messages being
+         * handled by the executor.
          */
         virtual ~MessageHandler ();
 
@@ -107,6 +111,23 @@ namespace ultrabus {
          */
         bool dispatch_msg (Message& msg);
 
+        /**
+         * Discard messages to this handler queued in the connection's
+         * executors, and wait for messages currently being handled
+         * to finish. This includes executors replaced since the
+         * messages were queued. Derived classes with state used when
+         * handling messages should call this method in their destructor,
+         * before the state is destroyed.<br/>
+         * <b>Note:</b> When called in the context of the I/O handler,
+         * messages currently being handled are not waited for since
+         * they may in turn be waiting for the I/O handler, like in
+         * <code>Connection::send_and_wait()</code>. Don't destroy a
+         * handler in the context of the I/O handler while the
+         * executor may be handling messages to it.
+         * @see Connection::executor
+         */
+        void finish_jobs ();
+
 
     private:
         static DBusHandlerResult static_dbus_handler (
@@ -116,6 +137,8 @@ namespace ultrabus {
 
         std::mutex match_rule_mutex;
         std::set<std::string> match_rules;
+
+        worker_jobs jobs {this}; // Messages posted to executors
     };
 
 }
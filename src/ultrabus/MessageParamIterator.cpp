@@ -27,11 +27,8 @@ namespace ultrabus {
     MessageParamIterator::MessageParamIterator (const Message& message)
     {
         auto* msg_handle = const_cast<Message&>(message).handle ();
-        if (msg_handle != nullptr) {
-            msg_iter = std::make_shared<DBusMessageIter> ();
-            if (!dbus_message_iter_init(msg_handle, msg_iter.get()))
-                msg_iter.reset (); // Reset shared pointer
-        }
+        if (msg_handle != nullptr)
+            valid = dbus_message_iter_init (msg_handle, &msg_iter);
     }
 
 
@@ -47,8 +44,8 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     MessageParamIterator& MessageParamIterator::operator++ ()
     {
-        if (msg_iter.use_count()!=0 && msg_iter.get()!=nullptr)
-            dbus_message_iter_next (msg_iter.get());
+        if (valid)
+            dbus_message_iter_next (&msg_iter);
 
         return *this;
     }
@@ -58,8 +55,8 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     int MessageParamIterator::arg_type () const
     {
-        if (msg_iter.use_count()!=0 && msg_iter.get()!=nullptr)
-            return dbus_message_iter_get_arg_type (msg_iter.get());
+        if (valid)
+            return dbus_message_iter_get_arg_type (const_cast<DBusMessageIter*>(&msg_iter));
         else
             return DBUS_TYPE_INVALID;
     }
@@ -69,8 +66,8 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     int MessageParamIterator::element_type () const
     {
-        if (msg_iter.use_count()!=0 && msg_iter.get()!=nullptr)
-            return dbus_message_iter_get_element_type (msg_iter.get());
+        if (valid)
+            return dbus_message_iter_get_element_type (const_cast<DBusMessageIter*>(&msg_iter));
         else
             return DBUS_TYPE_INVALID;
     }
@@ -81,9 +78,9 @@ namespace ultrabus {
     MessageParamIterator MessageParamIterator::iterator ()
     {
         MessageParamIterator recursive_iter;
-        if (msg_iter.use_count()!=0 && msg_iter.get()!=nullptr) {
-            recursive_iter.msg_iter = std::make_shared<DBusMessageIter> ();
-            dbus_message_iter_recurse (msg_iter.get(), recursive_iter.msg_iter.get());
+        if (valid) {
+            dbus_message_iter_recurse (&msg_iter, &recursive_iter.msg_iter);
+            recursive_iter.valid = true;
         }
         return recursive_iter;
     }
@@ -95,8 +92,8 @@ namespace ultrabus {
     {
         std::string s {""};
 
-        if (msg_iter.use_count()!=0 && msg_iter.get()!=nullptr) {
-            char* tmp_signature = dbus_message_iter_get_signature (msg_iter.get());
+        if (valid) {
+            char* tmp_signature = dbus_message_iter_get_signature (&msg_iter);
             if (tmp_signature) {
                 s = std::string (tmp_signature);
                 dbus_free (tmp_signature);
@@ -110,8 +107,19 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     void MessageParamIterator::basic_value (void* value)
     {
-        if (msg_iter.use_count()!=0 && msg_iter.get()!=nullptr && value!=nullptr)
-            dbus_message_iter_get_basic (msg_iter.get(), value);
+        if (valid && value!=nullptr)
+            dbus_message_iter_get_basic (&msg_iter, value);
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    int MessageParamIterator::fixed_array (void* values)
+    {
+        int n = 0;
+        if (valid && values!=nullptr)
+            dbus_message_iter_get_fixed_array (&msg_iter, values, &n);
+        return n;
     }
 
 
@@ -21,7 +21,6 @@
 
 #include <ultrabus/Message.hpp>
 #include <string>
-#include <memory>
 #include <dbus/dbus.h>
 
 
@@ -30,6 +29,21 @@ namespace ultrabus {
 
     /**
      * DBus message parameter iterator.
+     * The iterator is a value type, the libdbus iterator is embedded
+     * in the object and copying a MessageParamIterator copies its
+     * position. Iterating a message, or recursing into containers,
+     * makes no heap allocations.
+     * <br/>
+     * The remaining values at the level of an iterator can be
+     * walked with range-based for loops:
+     * <pre>
+     * for (auto& arg : ultrabus::MessageParamIterator(msg)) {
+     *     if (arg.arg_type() == DBUS_TYPE_ARRAY) {
+     *         for (auto& element : arg.iterator())
+     *             std::cout << element.signature() << std::endl;
+     *     }
+     * }
+     * </pre>
      */
     class MessageParamIterator {
     public:
@@ -73,6 +87,45 @@ namespace ultrabus {
          */
         operator bool () const;
 
+        /**
+         * Return true if both iterators are past their last value.
+         * Only iterators at the end compare equal, this is used
+         * to compare with <code>end()</code>.
+         */
+        bool operator== (const MessageParamIterator& rhs) const {
+            return !*this && !rhs;
+        }
+
+        /**
+         * Return false if both iterators are past their last value.
+         */
+        bool operator!= (const MessageParamIterator& rhs) const {
+            return !(*this == rhs);
+        }
+
+        /**
+         * Return a reference to this iterator.
+         * Used by range-based for loops.
+         */
+        MessageParamIterator& operator* () {
+            return *this;
+        }
+
+        /**
+         * Return a copy of this iterator,
+         * the start of a range-based for loop.
+         */
+        MessageParamIterator begin () const {
+            return *this;
+        }
+
+        /**
+         * Return an iterator past the last value.
+         */
+        MessageParamIterator end () const {
+            return MessageParamIterator ();
+        }
+
         /**
          * Operator ++a.
          */
@@ -106,9 +159,22 @@ namespace ultrabus {
          */
         void basic_value (void* value);
 
+        /**
+         * Read all elements of an array of a fixed size type at once.
+         * The iterator must be recursed into the array, like
+         * <code>arg.iterator().fixed_array(&values)</code>.
+         * No values are copied, <code>values</code> is set to point
+         * into the message.
+         * @param values Set to a pointer to the elements,
+         *               like a <code>const int32_t*</code>.
+         * @return The number of elements.
+         */
+        int fixed_array (void* values);
+
 
     private:
-        std::shared_ptr<DBusMessageIter> msg_iter;
+        DBusMessageIter msg_iter {};
+        bool valid {false};
     };
 
 
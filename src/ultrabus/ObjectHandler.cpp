@@ -18,6 +18,7 @@
  */
 #include <ultrabus/ObjectHandler.hpp>
 #include <cstring>
+#include <algorithm>
 
 
 #define TRACE_DEBUG
@@ -51,9 +52,12 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     ObjectHandler::~ObjectHandler ()
     {
-        std::lock_guard<std::mutex> lock (opaths_lock);
-        for (auto& opath : opaths)
-            dbus_connection_unregister_object_path (conn.handle(), opath.c_str());
+        {
+            std::lock_guard<std::mutex> lock (opaths_lock);
+            for (auto& opath : opaths)
+                conn.unregister_object_path (opath);
+        }
+        finish_jobs ();
     }
 
 
@@ -65,21 +69,7 @@ namespace ultrabus {
         if (opaths.find(opath) != opaths.end())
             return 0; // Already added
 
-        bool result;
-        if (fallback) {
-            result = dbus_connection_try_register_fallback (conn.handle(),
-                                                            opath.c_str(),
-                                                            this,
-                                                            this,
-                                                            nullptr);
-        }else{
-            result = dbus_connection_try_register_object_path (conn.handle(),
-                                                               opath.c_str(),
-                                                               this,
-                                                               this,
-                                                               nullptr);
-        }
-        if (!result)
+        if (!conn.register_object_path(opath, this, this, fallback))
             return -1;
 
         opaths.emplace (opath);
@@ -89,7 +79,6 @@ namespace ultrabus {
 
 
     //--------------------------------------------------------------------------
-    // Static method
     //--------------------------------------------------------------------------
     bool ObjectHandler::on_message (Message& msg)
     {
@@ -97,6 +86,15 @@ namespace ultrabus {
     }
 
 
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void ObjectHandler::finish_jobs ()
+    {
+        // Running jobs may be waiting for the I/O handler
+        jobs.purge (!conn.io_context());
+    }
+
+
     //--------------------------------------------------------------------------
     // Static method
     //--------------------------------------------------------------------------
@@ -117,9 +115,50 @@ namespace ultrabus {
         auto* self = static_cast<ObjectHandler*> (user_data);
         Message msg (message);
 
+        auto pool = self->conn.executor ();
+        if (pool && (msg.is_method_call() || msg.is_signal())) {
+            // The message is handled by the executor, so an unhandled
+            // method call is replied to by handle_message() instead of libdbus.
+            // Signals are still left to other handlers.
+            bool method_call = msg.is_method_call ();
+            auto key = self->conn.executor_key (msg);
+            self->jobs.post (pool,
+                             key,
+                             [self, m=std::move(msg)]() mutable {
+                                 handle_message (self, m);
+                             });
+            return method_call ?
+                DBUS_HANDLER_RESULT_HANDLED : DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+        }
+
         return self->on_message(msg) ?
             DBUS_HANDLER_RESULT_HANDLED : DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
 
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    void ObjectHandler::handle_message (ObjectHandler* self, Message& msg)
+    {
+        if (self->on_message(msg) ||
+            !msg.is_method_call() ||
+            dbus_message_get_no_reply(msg.handle()))
+        {
+            return;
+        }
+
+        // Same error reply as libdbus sends for unhandled method calls
+        std::string err_msg = "Method \"";
+        err_msg += msg.name ();
+        err_msg += "\" with signature \"";
+        err_msg += msg.signature ();
+        err_msg += "\" on interface \"";
+        err_msg += msg.interface ();
+        err_msg += "\" doesn't exist\n";
+        Message reply (msg, true, DBUS_ERROR_UNKNOWN_METHOD, err_msg);
+        self->conn.send (reply);
+    }
+
+
 }
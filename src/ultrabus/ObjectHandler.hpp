@@ -25,6 +25,8 @@
 #include <string>
 #include <mutex>
 #include <set>
+#include <vector>
+#include <memory>
 #include <dbus/dbus.h>
 
 
@@ -46,6 +48,8 @@ namespace ultrabus {
          * Destructor.
          * Remove all added match rules and unregister
          * this handler from the DBus.
+         * If the connection has an executor, wait for messages being
+         * handled by the executor.
          */
         virtual ~ObjectHandler ();
 
@@ -81,16 +85,36 @@ namespace ultrabus {
          */
         virtual bool on_message (Message& msg);
 
+        /**
+         * Discard messages to this handler queued in the connection's
+         * executors, and wait for messages currently being handled
+         * to finish. This includes executors replaced since the
+         * messages were queued. Derived classes with state used when
+         * handling messages should call this method in their destructor,
+         * before the state is destroyed.<br/>
+         * <b>Note:</b> When called in the context of the I/O handler,
+         * messages currently being handled are not waited for since
+         * they may in turn be waiting for the I/O handler, like in
+         * <code>Connection::send_and_wait()</code>. Don't destroy a
+         * handler in the context of the I/O handler while the
+         * executor may be handling messages to it.
+         * @see Connection::executor
+         */
+        void finish_jobs ();
+
 
     private:
         std::set<std::string> opaths;
         std::mutex opaths_lock;
 
+        worker_jobs jobs {this}; // Messages posted to executors
+
         static void dbus_on_unregister (DBusConnection* connection,
                                         void* user_data);
         static DBusHandlerResult dbus_on_message (DBusConnection* connection,
                                                   DBusMessage* message,
                                                   void* user_data);
+        static void handle_message (ObjectHandler* self, Message& msg);
     };
 
 }
@@ -175,12 +175,12 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     bool ObjectProxy::on_signal (Message &msg)
     {
-        if (msg.path() != opath)
+        if (msg.path_view() != opath)
             return false;
 
         bool retval = false;
-        auto interface = msg.interface ();
-        auto signal_name = msg.name ();
+        auto interface = msg.interface_view ();
+        auto signal_name = msg.name_view ();
 
         // Find callback mapped to a specific interface and a specific signal name
         if (on_signal_impl(interface, signal_name, msg))
@@ -204,8 +204,8 @@ namespace ultrabus {
 
     //--------------------------------------------------------------------------
     //--------------------------------------------------------------------------
-    bool ObjectProxy::on_signal_impl (const std::string& interface,
-                                      const std::string& signal_name,
+    bool ObjectProxy::on_signal_impl (std::string_view interface,
+                                      std::string_view signal_name,
                                       Message &msg)
     {
         bool retval = false;
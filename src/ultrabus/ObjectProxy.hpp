@@ -32,6 +32,7 @@
 #include <ultrabus/Properties.hpp>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <mutex>
 #include <map>
 #include <dbus/dbus.h>
@@ -78,7 +79,9 @@ namespace ultrabus {
         /**
          * Destructor.
          */
-        virtual ~ObjectProxy () = default;
+        virtual ~ObjectProxy () {
+            finish_jobs ();
+        }
 
         /**
          * Get the name of the service.
@@ -181,6 +184,46 @@ namespace ultrabus {
                 return send_msg_impl (msg);
             }
 
+#ifdef ULTRABUS_HAVE_COROUTINES
+        /**
+         * Call a method on the object and await the result in a coroutine.
+         * The coroutine is resumed in the context of the
+         * connection's I/O handler when the reply is received.
+         * <pre>
+         * auto reply = co_await proxy.async_call ("Echo", std::string("hello"));
+         * </pre>
+         * @param name The name of the method.
+         * @param params Optional parameters.
+         * @return An awaitable object resulting in the message reply.
+         */
+        template<typename... Targs>
+        Connection::reply_awaitable async_call (const std::string& name,
+                                                Targs... params)
+            {
+                return async_call_iface (def_iface, name, params...);
+            }
+
+        /**
+         * Call a method on the object and await the result in a coroutine.
+         * The coroutine is resumed in the context of the
+         * connection's I/O handler when the reply is received.
+         * @param interface The method interface.
+         * @param name The name of the method.
+         * @param params Optional parameters.
+         * @return An awaitable object resulting in the message reply.
+         */
+        template<typename... Targs>
+        Connection::reply_awaitable async_call_iface (const std::string& interface,
+                                                      const std::string& name,
+                                                      Targs... params)
+            {
+                Message msg (target, opath, interface, name);
+                if constexpr (sizeof...(params) > 0)
+                    msg.append_arg (params...);
+                return conn.async_send (msg, timeout);
+            }
+#endif
+
         /**
          * Get the timeout used when sending messages on the DBus
          * using this proxy instance.
@@ -207,15 +250,27 @@ namespace ultrabus {
 
 
     private:
+        // Compare callback keys with keys of borrowed strings
+        struct key_less {
+            using is_transparent = void;
+            template<typename L, typename R>
+            bool operator() (const L& lhs, const R& rhs) const {
+                std::string_view l_iface {lhs.first}, r_iface {rhs.first};
+                if (l_iface != r_iface)
+                    return l_iface < r_iface;
+                return std::string_view(lhs.second) < std::string_view(rhs.second);
+            }
+        };
+
         std::string target;
         std::string opath;
         std::string def_iface;
         int timeout;
         std::mutex cb_mutex;
-        std::map<std::pair<std::string, std::string>, sig_cb> callbacks;
+        std::map<std::pair<std::string, std::string>, sig_cb, key_less> callbacks;
         Message send_msg_impl (const Message& msg);
-        bool on_signal_impl (const std::string& interface,
-                             const std::string& signal_name,
+        bool on_signal_impl (std::string_view interface,
+                             std::string_view signal_name,
                              Message &msg);
     };
 
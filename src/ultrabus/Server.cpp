@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/Server.hpp>
+#include <ultrabus/trace_buffer.hpp>
+
+
+namespace ultrabus {
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    Server::Server ()
+        : server {nullptr},
+          ioh (new iomultiplex::default_iohandler(SIGRTMIN)),
+          internal_io_handler {true},
+          io_timers (new iomultiplex::timer_set(*ioh))
+    {
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    Server::Server (iomultiplex::iohandler_base& io_handler)
+        : server {nullptr},
+          ioh (&io_handler),
+          internal_io_handler {false},
+          io_timers (new iomultiplex::timer_set(*ioh))
+    {
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    Server::~Server ()
+    {
+        stop ();
+        delete io_timers;
+        if (internal_io_handler)
+            delete ioh;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int Server::listen (const std::string& address, connection_cb_t cb)
+    {
+        if (server)
+            return -1;
+
+        server = dbus_server_listen (address.c_str(), nullptr);
+        if (!server)
+            return -1;
+        trace_buffer::record (trace_event::listen, this);
+
+        connection_cb = std::move (cb);
+
+        if (internal_io_handler)
+            ioh->run (true); // Start I/O worker thread
+
+        dbus_server_set_new_connection_function (server,
+                                                 dbus_new_connection_cb,
+                                                 this,
+                                                 nullptr);
+        if (!dbus_server_set_watch_functions(server,
+                                             dbus_add_watch_cb,
+                                             dbus_remove_watch_cb,
+                                             dbus_toggled_watch_cb,
+                                             this,
+                                             nullptr) ||
+            !dbus_server_set_timeout_functions(server,
+                                               dbus_add_timeout_cb,
+                                               dbus_remove_timeout_cb,
+                                               dbus_toggled_timeout_cb,
+                                               this,
+                                               nullptr))
+        {
+            stop ();
+            return -1;
+        }
+
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void Server::stop ()
+    {
+        if (!server)
+            return;
+
+        trace_buffer::record (trace_event::disconnect, this);
+        dbus_server_disconnect (server);
+
+        // Make sure no callback is running
+        if (internal_io_handler) {
+            ioh->stop ();
+            ioh->join ();
+        }
+
+        dbus_server_set_watch_functions (server, nullptr, nullptr, nullptr, nullptr, nullptr);
+        dbus_server_set_timeout_functions (server, nullptr, nullptr, nullptr, nullptr, nullptr);
+        dbus_server_set_new_connection_function (server, nullptr, nullptr, nullptr);
+        dbus_server_unref (server);
+        server = nullptr;
+
+        std::lock_guard<std::mutex> lock (io_mutex);
+        io_watches.clear ();
+        io_timers->clear ();
+        io_timeouts.clear ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    bool Server::is_listening () const
+    {
+        return server && dbus_server_get_is_connected (server);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::string Server::address () const
+    {
+        if (!server)
+            return "";
+        auto* addr = dbus_server_get_address (server);
+        std::string retval (addr ? addr : "");
+        dbus_free (addr);
+        return retval;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called in the context of the I/O handler
+    //--------------------------------------------------------------------------
+    void Server::watch_rx (DBusWatch* watch)
+    {
+        trace_buffer::record (trace_event::watch_rx, this, 0, dbus_watch_get_unix_fd(watch));
+        dbus_watch_handle (watch, DBUS_WATCH_READABLE);
+
+        std::lock_guard<std::mutex> lock (io_mutex);
+        auto entry = io_watches.find (watch);
+        if (entry == io_watches.end())
+            return; // Watch removed in the watch_handle function
+
+        if (dbus_watch_get_enabled(watch)) {
+            entry->second.wait_for_rx ([this, watch](iomultiplex::io_result_t& ior)->bool
+                {
+                    if (!ior.errnum)
+                        watch_rx (watch);
+                    return false;
+                });
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called with io_mutex locked
+    //--------------------------------------------------------------------------
+    void Server::set_timeout (DBusTimeout* timeout)
+    {
+        long& timer_id = io_timeouts.emplace(timeout, -1).first->second;
+        if (timer_id >= 0)
+            io_timers->cancel (timer_id);
+        timer_id = -1;
+
+        auto interval = dbus_timeout_get_interval (timeout);
+        if (dbus_timeout_get_enabled(timeout) && interval >= 0) {
+            trace_buffer::record (trace_event::timeout_add, this, 0, interval);
+            timer_id = io_timers->set (interval, [this, timeout](iomultiplex::timer_set& ts, long id)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock (io_mutex);
+                        auto entry = io_timeouts.find (timeout);
+                        if (entry == io_timeouts.end() || entry->second != id)
+                            return; // Removed, or set again
+                        entry->second = -1;
+                    }
+                    trace_buffer::record (trace_event::timeout, this);
+                    dbus_timeout_handle (timeout);
+
+                    // A libdbus timeout is periodic until it is removed or
+                    // disabled, unless it was already set again when handled.
+                    std::lock_guard<std::mutex> lock (io_mutex);
+                    auto entry = io_timeouts.find (timeout);
+                    if (entry != io_timeouts.end() && entry->second < 0)
+                        set_timeout (timeout);
+                });
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    void Server::dbus_new_connection_cb (DBusServer* s, DBusConnection* c, void* data)
+    {
+        auto* self = static_cast<Server*> (data);
+        int fd = -1;
+        if (!dbus_connection_get_unix_fd(c, &fd))
+            fd = -1;
+        trace_buffer::record (trace_event::accept, self, 0, fd);
+
+        std::shared_ptr<Connection> connection;
+        if (self->internal_io_handler)
+            connection = std::make_shared<Connection> ();
+        else
+            connection = std::make_shared<Connection> (*self->ioh);
+
+        // The connection is closed if it isn't referenced
+        if (connection->attach(c, false))
+            return;
+        if (self->connection_cb)
+            self->connection_cb (connection);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    dbus_bool_t Server::dbus_add_watch_cb (DBusWatch* watch, void* data)
+    {
+        int fd = dbus_watch_get_unix_fd (watch);
+        if (fd < 0)
+            return true;
+
+        auto* self = static_cast<Server*> (data);
+        trace_buffer::record (trace_event::watch_add, self, 0, fd);
+        std::lock_guard<std::mutex> lock (self->io_mutex);
+
+        auto entry = self->io_watches.find (watch);
+        if (entry == self->io_watches.end())
+            entry = self->io_watches.emplace(watch, iomultiplex::fd_connection(*self->ioh, fd, true)).first;
+
+        // A server only waits for incoming connections
+        if (dbus_watch_get_enabled(watch) && (dbus_watch_get_flags(watch) & DBUS_WATCH_READABLE)) {
+            entry->second.wait_for_rx ([self, watch](iomultiplex::io_result_t& ior)->bool
+                {
+                    if (!ior.errnum)
+                        self->watch_rx (watch);
+                    return false;
+                });
+        }
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    void Server::dbus_remove_watch_cb (DBusWatch* watch, void* data)
+    {
+        auto* self = static_cast<Server*> (data);
+        trace_buffer::record (trace_event::watch_remove, self, 0, dbus_watch_get_unix_fd(watch));
+
+        std::lock_guard<std::mutex> lock (self->io_mutex);
+        self->io_watches.erase (watch);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    void Server::dbus_toggled_watch_cb (DBusWatch* watch, void* data)
+    {
+        auto* self = static_cast<Server*> (data);
+
+        if (dbus_watch_get_enabled(watch)) {
+            dbus_add_watch_cb (watch, data);
+        }else{
+            std::lock_guard<std::mutex> lock (self->io_mutex);
+            auto entry = self->io_watches.find (watch);
+            if (entry != self->io_watches.end())
+                entry->second.cancel (true, true, false);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    dbus_bool_t Server::dbus_add_timeout_cb (DBusTimeout* timeout, void* data)
+    {
+        auto* self = static_cast<Server*> (data);
+
+        std::lock_guard<std::mutex> lock (self->io_mutex);
+        self->set_timeout (timeout);
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    void Server::dbus_remove_timeout_cb (DBusTimeout* timeout, void* data)
+    {
+        auto* self = static_cast<Server*> (data);
+        trace_buffer::record (trace_event::timeout_remove, self);
+
+        std::lock_guard<std::mutex> lock (self->io_mutex);
+        auto entry = self->io_timeouts.find (timeout);
+        if (entry != self->io_timeouts.end()) {
+            if (entry->second >= 0)
+                self->io_timers->cancel (entry->second);
+            self->io_timeouts.erase (entry);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Static method
+    //--------------------------------------------------------------------------
+    void Server::dbus_toggled_timeout_cb (DBusTimeout* timeout, void* data)
+    {
+        auto* self = static_cast<Server*> (data);
+
+        std::lock_guard<std::mutex> lock (self->io_mutex);
+        self->set_timeout (timeout);
+    }
+
+
+}
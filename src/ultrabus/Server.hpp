@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_SERVER_HPP
+#define ULTRABUS_SERVER_HPP
+
+#include <ultrabus/Connection.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <map>
+#include <dbus/dbus.h>
+#include <iomultiplex.hpp>
+
+
+namespace ultrabus {
+
+
+    /**
+     * A server accepting direct DBus connections from peers,
+     * without a bus daemon.
+     * Each accepted peer connection is handed to the application as
+     * a Connection object, that can be used with message handlers,
+     * object handlers, and object proxies like any other connection.
+     * Peers connect using <code>Connection::connect_peer()</code>
+     * with the address of the server.
+     * <pre>
+     * ultrabus::Server server;
+     * std::vector<std::shared_ptr<ultrabus::Connection>> peers;
+     *
+     * server.listen ("unix:path=/run/example.socket",
+     *                [&peers](std::shared_ptr<ultrabus::Connection> peer) {
+     *                    peers.emplace_back (peer);
+     *                });
+     * </pre>
+     */
+    class Server {
+    public:
+        /**
+         * Callback called when a peer has connected.
+         * @param connection The new connection. The connection is
+         *                   closed if the callback doesn't keep
+         *                   a reference to it.
+         */
+        using connection_cb_t = std::function<void (std::shared_ptr<Connection> connection)>;
+
+        /**
+         * Default constructor.
+         * Creates a server object that uses an internal I/O handler.
+         * Each accepted connection has its own internal I/O handler.
+         */
+        Server ();
+
+        /**
+         * Constructor.
+         * @param io_handler An I/O handler object that shall be used
+         *                   by the server and the accepted connections.
+         */
+        Server (iomultiplex::iohandler_base& io_handler);
+
+        /**
+         * Destructor.
+         * Stop listening for connections. Connections already
+         * accepted are not closed.
+         * @see stop
+         */
+        ~Server ();
+
+        Server (const Server&) = delete;
+        Server& operator= (const Server&) = delete;
+
+        /**
+         * Start listening for connections.
+         * @param address The address to listen on, for example
+         *                <code>unix:path=/run/example.socket</code> or
+         *                <code>unix:tmpdir=/tmp</code>.
+         * @param cb A callback called with each new connection.
+         *           It is called in the context of the server's
+         *           I/O handler.
+         * @return 0 on success, -1 on failure.
+         */
+        int listen (const std::string& address, connection_cb_t cb);
+
+        /**
+         * Stop listening for connections.<br/>
+         * <b>Note:</b> When the server uses an I/O handler supplied
+         * to the constructor, this method must be called in the
+         * context of that I/O handler, or when it is no longer
+         * running. The watches and timeouts of the server are
+         * released without waiting for callbacks in the I/O handler.
+         * With an internal I/O handler it can be called by any
+         * thread, the I/O handler is stopped first.
+         */
+        void stop ();
+
+        /**
+         * Return <code>true</code> if the server is listening for connections.
+         */
+        bool is_listening () const;
+
+        /**
+         * Return the address peers use to connect to the server,
+         * or an empty string if not listening.
+         */
+        std::string address () const;
+
+        /**
+         * Return the iohandler_base used by the server object.
+         */
+        iomultiplex::iohandler_base& io_handler () {
+            return *ioh;
+        }
+
+        /**
+         * Return the libdbus server object.
+         */
+        DBusServer* handle () {
+            return server;
+        }
+
+
+    private:
+        DBusServer* server;
+        connection_cb_t connection_cb;
+
+        // I/O handler
+        iomultiplex::iohandler_base* ioh;
+        bool internal_io_handler;
+
+        // DBus I/O
+        std::mutex io_mutex;
+        iomultiplex::timer_set* io_timers;
+        std::map<DBusTimeout*, long> io_timeouts;
+        std::map<DBusWatch*, iomultiplex::fd_connection> io_watches;
+
+        void watch_rx (DBusWatch* watch);
+        void set_timeout (DBusTimeout* timeout);
+
+        // Static callbacks called from libdbus-1
+        //
+        static void dbus_new_connection_cb (DBusServer* s, DBusConnection* c, void* data);
+
+        static dbus_bool_t dbus_add_watch_cb (DBusWatch* watch, void* data);
+        static void dbus_remove_watch_cb (DBusWatch* watch, void* data);
+        static void dbus_toggled_watch_cb (DBusWatch* watch, void* data);
+
+        static dbus_bool_t dbus_add_timeout_cb (DBusTimeout* timeout, void* data);
+        static void dbus_remove_timeout_cb (DBusTimeout* timeout, void* data);
+        static void dbus_toggled_timeout_cb (DBusTimeout* timeout, void* data);
+    };
+
+
+}
+
+#endif
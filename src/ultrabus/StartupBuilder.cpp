@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/StartupBuilder.hpp>
+#include <ultrabus/dbus_basic.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace ultrabus {
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    StartupBuilder::StartupBuilder (Connection& connection)
+        : conn (connection)
+    {
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    StartupBuilder& StartupBuilder::request_name (const std::string& name, uint32_t flags)
+    {
+        Message msg (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "RequestName");
+        msg.append_arg (name, flags);
+        requests.push_back ({request_type::name, name, std::move(msg), nullptr});
+        return *this;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    StartupBuilder& StartupBuilder::add_match (const std::string& rule)
+    {
+        Message msg (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "AddMatch");
+        msg << rule;
+        requests.push_back ({request_type::match, rule, std::move(msg), nullptr});
+        return *this;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    StartupBuilder& StartupBuilder::call (const Message& msg, reply_cb_t reply_cb)
+    {
+        requests.push_back ({request_type::call,
+                             msg.interface() + "." + msg.name(),
+                             msg,
+                             std::move(reply_cb)});
+        return *this;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int StartupBuilder::connect (const std::string& bus_address,
+                                 int timeout,
+                                 bool private_connection,
+                                 bool exit_on_disconnect)
+    {
+        errs.clear ();
+        names.clear ();
+
+        if (conn.open_bus(bus_address, private_connection, exit_on_disconnect)) {
+            errs.emplace_back ("Unable to connect to " + bus_address);
+            return -1;
+        }
+
+        // Hello first, then all requests without waiting for replies
+        std::vector<Message> replies (requests.size() + 1);
+        if (conn.externally_driven())
+            send_all_blocking (replies, timeout);
+        else
+            send_all (replies, timeout);
+
+        if (!conn.set_unique_name(replies[0])) {
+            if (replies[0].is_error())
+                errs.emplace_back ("Hello: " + replies[0].error_name() + ": " + replies[0].error_msg());
+            else
+                errs.emplace_back ("Hello: Invalid reply");
+            conn.disconnect ();
+            return -1;
+        }
+
+        for (std::size_t i=0; i<requests.size(); ++i)
+            handle_reply (requests[i], replies[i+1]);
+
+        return errs.empty() ? 0 : -1;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int StartupBuilder::connect (DBusBusType type,
+                                 int timeout,
+                                 bool private_connection,
+                                 bool exit_on_disconnect)
+    {
+        auto address = bus_address (type);
+        if (address.empty()) {
+            errs.clear ();
+            errs.emplace_back ("Unknown bus address");
+            return -1;
+        }
+        return connect (address, timeout, private_connection, exit_on_disconnect);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Find the address of a well known bus in the same order as libdbus.
+    //--------------------------------------------------------------------------
+    std::string StartupBuilder::bus_address (DBusBusType type)
+    {
+        const char* address = nullptr;
+        switch (type) {
+        case DBUS_BUS_SESSION:
+            address = getenv ("DBUS_SESSION_BUS_ADDRESS");
+            if (!address) {
+                // The user bus, if any
+                const char* runtime_dir = getenv ("XDG_RUNTIME_DIR");
+                if (runtime_dir && *runtime_dir) {
+                    std::string path = std::string(runtime_dir) + "/bus";
+                    struct stat st;
+                    if (stat(path.c_str(), &st) == 0 &&
+                        S_ISSOCK(st.st_mode) &&
+                        st.st_uid == getuid())
+                    {
+                        char* escaped = dbus_address_escape_value (path.c_str());
+                        if (escaped) {
+                            std::string user_bus = std::string("unix:path=") + escaped;
+                            dbus_free (escaped);
+                            return user_bus;
+                        }
+                    }
+                }
+                address = "autolaunch:";
+            }
+            break;
+
+        case DBUS_BUS_SYSTEM:
+            address = getenv ("DBUS_SYSTEM_BUS_ADDRESS");
+            if (!address)
+                address = "unix:path=/var/run/dbus/system_bus_socket";
+            break;
+
+        case DBUS_BUS_STARTER:
+            address = getenv ("DBUS_STARTER_ADDRESS");
+            if (!address) {
+                const char* bus_type = getenv ("DBUS_STARTER_BUS_TYPE");
+                if (bus_type && strcmp(bus_type, "session") == 0)
+                    return bus_address (DBUS_BUS_SESSION);
+                else if (bus_type && strcmp(bus_type, "system") == 0)
+                    return bus_address (DBUS_BUS_SYSTEM);
+            }
+            break;
+        }
+        return address ? address : "";
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    retvalue<uint32_t> StartupBuilder::name_reply (const std::string& name) const
+    {
+        auto entry = names.find (name);
+        if (entry == names.end())
+            return retvalue<uint32_t> (-1, "Name not requested");
+        return entry->second;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void StartupBuilder::handle_reply (request_t& req, Message& reply)
+    {
+        if (reply.is_error())
+            errs.emplace_back (req.arg + ": " + reply.error_name() + ": " + reply.error_msg());
+
+        switch (req.type) {
+        case request_type::name:
+            {
+                retvalue<uint32_t> retval (0);
+                dbus_basic reply_arg;
+                if (reply.is_error())
+                    retval.err (-1, reply.error_name() + std::string(": ") + reply.error_msg());
+                else if (!reply.get_args(&reply_arg, nullptr))
+                    retval.err (-1, "Invalid message reply argument");
+                else
+                    retval = reply_arg.u32 ();
+                names[req.arg] = std::move (retval);
+            }
+            break;
+
+        case request_type::match:
+            break;
+
+        case request_type::call:
+            if (req.reply_cb)
+                req.reply_cb (reply);
+            break;
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Send Hello and the requests in one batch, and wait for
+    // the replies handled by the I/O handler.
+    //--------------------------------------------------------------------------
+    void StartupBuilder::send_all (std::vector<Message>& replies, int timeout)
+    {
+        struct state_t {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::size_t remaining;
+            std::vector<Message>* replies;
+        } state;
+        state.remaining = replies.size ();
+        state.replies = &replies;
+
+        Message hello (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "Hello");
+        conn.begin_batch ();
+        for (std::size_t i=0; i<replies.size(); ++i) {
+            auto& msg = i ? requests[i-1].msg : hello;
+            auto result = conn.send (msg, [&state, i](Message& reply)
+                {
+                    std::lock_guard<std::mutex> lock (state.mutex);
+                    (*state.replies)[i] = std::move (reply);
+                    if (--state.remaining == 0)
+                        state.cv.notify_one ();
+                },
+                timeout);
+            if (result) {
+                std::lock_guard<std::mutex> lock (state.mutex);
+                replies[i] = Message::create_error (DBUS_ERROR_DISCONNECTED, "Unable to send message");
+                --state.remaining;
+            }
+        }
+        conn.flush ();
+
+        std::unique_lock<std::mutex> lock (state.mutex);
+        state.cv.wait (lock, [&state]{ return state.remaining == 0; });
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Send Hello and the requests, and let libdbus block for the
+    // replies. An external event loop isn't run until connect() returns.
+    //--------------------------------------------------------------------------
+    void StartupBuilder::send_all_blocking (std::vector<Message>& replies, int timeout)
+    {
+        std::vector<DBusPendingCall*> pending (replies.size(), nullptr);
+
+        Message hello (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "Hello");
+        for (std::size_t i=0; i<replies.size(); ++i) {
+            auto& msg = i ? requests[i-1].msg : hello;
+            dbus_connection_send_with_reply (conn.handle(), msg.handle(), &pending[i], timeout);
+        }
+
+        for (std::size_t i=0; i<replies.size(); ++i) {
+            DBusMessage* reply = nullptr;
+            if (pending[i]) {
+                dbus_pending_call_block (pending[i]);
+                reply = dbus_pending_call_steal_reply (pending[i]);
+                dbus_pending_call_unref (pending[i]);
+            }
+            if (reply) {
+                replies[i] = Message (reply);
+                replies[i].dec_ref (); // ref count increased in Message constructor
+            }else{
+                replies[i] = Message::create_error (DBUS_ERROR_DISCONNECTED, "Unable to send message");
+            }
+        }
+
+        // Messages received while blocking, like NameAcquired,
+        // are dispatched when the event loop is run.
+        conn.schedule_dispatch ();
+    }
+
+
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_STARTUPBUILDER_HPP
+#define ULTRABUS_STARTUPBUILDER_HPP
+
+#include <ultrabus/Connection.hpp>
+#include <ultrabus/Message.hpp>
+#include <ultrabus/retvalue.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <dbus/dbus.h>
+
+
+namespace ultrabus {
+
+
+    /**
+     * Connect to a bus with the startup requests pipelined.
+     * Connecting with <code>Connection::connect()</code> and then
+     * requesting names is a chain of round trips to the bus daemon.
+     * A StartupBuilder collects the name requests, match rules and
+     * other method calls a service makes at startup, and sends them
+     * back-to-back right after <code>Hello</code> when connecting.
+     * All replies are then waited for at once, so the connection is
+     * ready after about one round trip.
+     * <pre>
+     * ultrabus::Connection conn;
+     * ultrabus::StartupBuilder startup (conn);
+     * startup.request_name ("se.example.Service", DBUS_NAME_FLAG_DO_NOT_QUEUE)
+     *        .add_match ("type='signal',interface='se.example.Events'");
+     * if (startup.connect(DBUS_BUS_SESSION)) {
+     *     for (auto& e : startup.errors())
+     *         std::cerr << e << std::endl;
+     * }
+     * auto owner = startup.name_reply ("se.example.Service");
+     * </pre>
+     * The bus daemon handles the messages of a connection in order,
+     * so the requests are handled after <code>Hello</code>. Match
+     * rules added here are not removed by a MessageHandler, they stay
+     * until the connection is closed.
+     */
+    class StartupBuilder {
+    public:
+        /**
+         * Callback called with the reply of a method call.
+         */
+        using reply_cb_t = std::function<void (Message& reply)>;
+
+        /**
+         * Constructor.
+         * @param connection The connection to connect. It must
+         *                   not be connected.
+         */
+        explicit StartupBuilder (Connection& connection);
+
+        /**
+         * Request a bus name when connecting.
+         * @param name The bus name to request.
+         * @param flags Flags like <code>DBUS_NAME_FLAG_DO_NOT_QUEUE</code>.
+         * @return A reference to this object.
+         * @see name_reply
+         */
+        StartupBuilder& request_name (const std::string& name, uint32_t flags=0);
+
+        /**
+         * Add a match rule when connecting.
+         * @param rule The match rule.
+         * @return A reference to this object.
+         */
+        StartupBuilder& add_match (const std::string& rule);
+
+        /**
+         * Send a method call when connecting.
+         * @param msg The method call.
+         * @param reply_cb Called with the reply by the thread calling
+         *                 <code>connect()</code>, when all replies are
+         *                 received. Error replies are also collected
+         *                 by <code>errors()</code>.
+         * @return A reference to this object.
+         */
+        StartupBuilder& call (const Message& msg, reply_cb_t reply_cb=nullptr);
+
+        /**
+         * Connect to a bus address, register with the bus and send
+         * the startup requests. Returns when all replies are received.
+         * Must not be called in the context of the I/O handler.
+         * @param bus_address The address of the bus to connect to.
+         * @param timeout Timeout in milliseconds of each request.
+         * @param private_connection Set to <code>true</code> for a private connection.
+         * @param exit_on_disconnect If <code>true</code>, the process will
+         *                           exit if the connection is disconnected.
+         * @return 0 on success. -1 if the connection failed, or if any
+         *         request got an error reply. The connection is only
+         *         disconnected if the registration with the bus failed.
+         */
+        int connect (const std::string& bus_address,
+                     int timeout=DBUS_TIMEOUT_USE_DEFAULT,
+                     bool private_connection=false,
+                     bool exit_on_disconnect=true);
+
+        /**
+         * Connect to a well known bus.
+         * The bus address is found in the same order as libdbus does:
+         * <ul>
+         * <li>Session bus: <code>DBUS_SESSION_BUS_ADDRESS</code>,
+         *     then <code>$XDG_RUNTIME_DIR/bus</code> if it is a socket
+         *     owned by the user, then <code>autolaunch:</code>.</li>
+         * <li>System bus: <code>DBUS_SYSTEM_BUS_ADDRESS</code>,
+         *     then the default system bus socket.</li>
+         * <li>Starter bus: <code>DBUS_STARTER_ADDRESS</code>, then
+         *     the session or system bus as given by
+         *     <code>DBUS_STARTER_BUS_TYPE</code>.</li>
+         * </ul>
+         * @see connect(const std::string&, int, bool, bool)
+         */
+        int connect (DBusBusType type=DBUS_BUS_SESSION,
+                     int timeout=DBUS_TIMEOUT_USE_DEFAULT,
+                     bool private_connection=false,
+                     bool exit_on_disconnect=true);
+
+        /**
+         * Return the reply to a name request, like
+         * <code>DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER</code>,
+         * or an error.
+         * @param name A bus name given to <code>request_name()</code>.
+         */
+        retvalue<uint32_t> name_reply (const std::string& name) const;
+
+        /**
+         * Return the errors of the last connect() call,
+         * one string per failed request.
+         */
+        const std::vector<std::string>& errors () const {
+            return errs;
+        }
+
+
+    private:
+        enum class request_type {
+            name,
+            match,
+            call
+        };
+        struct request_t {
+            request_type type;
+            std::string arg;
+            Message msg;
+            reply_cb_t reply_cb;
+        };
+
+        Connection& conn;
+        std::vector<request_t> requests;
+        std::map<std::string, retvalue<uint32_t>> names;
+        std::vector<std::string> errs;
+
+        void handle_reply (request_t& req, Message& reply);
+        void send_all (std::vector<Message>& replies, int timeout);
+        void send_all_blocking (std::vector<Message>& replies, int timeout);
+        static std::string bus_address (DBusBusType type);
+    };
+
+
+}
+
+#endif
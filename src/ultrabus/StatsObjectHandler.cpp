@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/StatsObjectHandler.hpp>
+#include <ultrabus/Properties.hpp>
+#include <ultrabus/dbus_struct.hpp>
+#include <ultrabus/dbus_array.hpp>
+#include <ultrabus/dbus_basic.hpp>
+#include <algorithm>
+
+
+namespace ultrabus {
+
+
+    static const char* introspect_data =
+        "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\"\n"
+        " \"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n"
+        "<node>\n"
+        "  <interface name=\"" DBUS_INTERFACE_INTROSPECTABLE "\">\n"
+        "    <method name=\"Introspect\">\n"
+        "      <arg name=\"data\" type=\"s\" direction=\"out\"/>\n"
+        "    </method>\n"
+        "  </interface>\n"
+        "  <interface name=\"se.ultramarin.ultrabus.Stats\">\n"
+        "    <method name=\"GetConnections\">\n"
+        "      <arg name=\"connections\" type=\"a(sa{sv})\" direction=\"out\"/>\n"
+        "    </method>\n"
+        "    <method name=\"GetMethods\">\n"
+        "      <arg name=\"methods\" type=\"a(ssstttttt)\" direction=\"out\"/>\n"
+        "    </method>\n"
+        "    <method name=\"Reset\">\n"
+        "    </method>\n"
+        "  </interface>\n"
+        "</node>\n";
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    StatsObjectHandler::StatsObjectHandler (Connection& connection, unsigned interval)
+        : ObjectHandler (connection),
+          interval {interval ? interval : 1},
+          connection_stats ("(sa{sv})"),
+          method_stats ("(ssstttttt)"),
+          timers (connection.externally_driven() ?
+                  nullptr : new iomultiplex::timer_set(connection.io_handler()))
+    {
+        add_connection (connection);
+        schedule ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    StatsObjectHandler::~StatsObjectHandler ()
+    {
+        finish_jobs ();
+        timers.reset ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void StatsObjectHandler::add_connection (Connection& connection, const std::string& name)
+    {
+        connection.track_methods (true);
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            auto stats = connection.stats ();
+            connections.push_back ({&connection,
+                                    name,
+                                    stats.method_calls.sent + stats.method_returns.sent +
+                                    stats.errors.sent + stats.signals.sent,
+                                    stats.method_calls.received + stats.method_returns.received +
+                                    stats.errors.received + stats.signals.received,
+                                    std::chrono::steady_clock::now()});
+        }
+        refresh ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void StatsObjectHandler::remove_connection (Connection& connection)
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            connections.erase (std::remove_if(connections.begin(), connections.end(),
+                                              [&connection](entry_t& e) {
+                                                  return e.conn == &connection;
+                                              }),
+                               connections.end());
+        }
+        refresh ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void StatsObjectHandler::refresh ()
+    {
+        dbus_array conn_stats ("(sa{sv})");
+        dbus_array meth_stats ("(ssstttttt)");
+
+        std::lock_guard<std::mutex> lock (mutex);
+        last_refresh = std::chrono::steady_clock::now ();
+        for (auto& entry : connections)
+            collect (entry, conn_stats, meth_stats);
+        connection_stats = std::move (conn_stats);
+        method_stats = std::move (meth_stats);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called with the mutex locked
+    //--------------------------------------------------------------------------
+    void StatsObjectHandler::collect (entry_t& entry,
+                                      dbus_array& conn_stats,
+                                      dbus_array& meth_stats)
+    {
+        auto& c = *entry.conn;
+        auto stats = c.stats ();
+        auto name = entry.name.empty() ? c.unique_name() : entry.name;
+
+        uint64_t sent = stats.method_calls.sent + stats.method_returns.sent +
+            stats.errors.sent + stats.signals.sent;
+        uint64_t received = stats.method_calls.received + stats.method_returns.received +
+            stats.errors.received + stats.signals.received;
+
+        // Messages per second since the last collection
+        auto now = std::chrono::steady_clock::now ();
+        double seconds = std::chrono::duration<double>(now - entry.last_time).count ();
+        double sent_rate = 0.0;
+        double received_rate = 0.0;
+        if (seconds > 0.0) {
+            sent_rate = sent >= entry.last_sent ? (sent - entry.last_sent) / seconds : 0.0;
+            received_rate = received >= entry.last_received ? (received - entry.last_received) / seconds : 0.0;
+        }
+        entry.last_sent = sent;
+        entry.last_received = received;
+        entry.last_time = now;
+
+        auto rtt = stats.round_trip ();
+        auto dispatch = stats.method_calls.dispatch_time;
+        dispatch += stats.method_returns.dispatch_time;
+        dispatch += stats.errors.dispatch_time;
+        dispatch += stats.signals.dispatch_time;
+        auto pool = c.executor ();
+
+        Properties props;
+        props.set ("MessagesSent",        dbus_basic(sent));
+        props.set ("MessagesReceived",    dbus_basic(received));
+        props.set ("MethodCallsSent",     dbus_basic(stats.method_calls.sent));
+        props.set ("MethodCallsReceived", dbus_basic(stats.method_calls.received));
+        props.set ("SignalsSent",         dbus_basic(stats.signals.sent));
+        props.set ("SignalsReceived",     dbus_basic(stats.signals.received));
+        props.set ("ErrorsReceived",      dbus_basic(stats.errors.received));
+        props.set ("BytesSent",           dbus_basic(stats.bytes_sent));
+        props.set ("BytesReceived",       dbus_basic(stats.bytes_received));
+        props.set ("Timeouts",            dbus_basic(stats.timeouts));
+        props.set ("SentPerSecond",       dbus_basic(sent_rate));
+        props.set ("ReceivedPerSecond",   dbus_basic(received_rate));
+        props.set ("PendingCalls",        dbus_basic(stats.pending_calls));
+        props.set ("SendQueue",           dbus_basic((uint64_t)c.outgoing_queued()));
+        props.set ("OutgoingBytes",       dbus_basic((uint64_t)c.outgoing_size()));
+        props.set ("ExecutorQueue",       dbus_basic((uint64_t)(pool ? pool->queued() : 0)));
+        props.set ("RoundTripP50",        dbus_basic(rtt.percentile(50.0)));
+        props.set ("RoundTripP99",        dbus_basic(rtt.percentile(99.0)));
+        props.set ("RoundTripMax",        dbus_basic(rtt.max()));
+        props.set ("DispatchP99",         dbus_basic(dispatch.percentile(99.0)));
+
+        dbus_array cpus ("t");
+        for (auto count : stats.cpu_messages)
+            cpus.add (dbus_basic(count));
+        props.set ("CpuMessages", cpus);
+
+        dbus_struct cs;
+        cs.add (dbus_basic(name));
+        cs.add (props.data());
+        conn_stats.add (cs);
+
+        for (auto& m : c.method_stats()) {
+            dbus_struct ms;
+            ms.add (dbus_basic(name));
+            ms.add (dbus_basic(m.interface));
+            ms.add (dbus_basic(m.method));
+            ms.add (dbus_basic(m.latency.count()));
+            ms.add (dbus_basic(m.errors));
+            ms.add (dbus_basic(m.latency.percentile(50.0)));
+            ms.add (dbus_basic(m.latency.percentile(90.0)));
+            ms.add (dbus_basic(m.latency.percentile(99.0)));
+            ms.add (dbus_basic(m.latency.max()));
+            meth_stats.add (ms);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void StatsObjectHandler::schedule ()
+    {
+        if (!timers)
+            return; // Collected when requested
+        timers->set (interval, [this](iomultiplex::timer_set& ts, long id)
+            {
+                refresh ();
+                schedule ();
+            });
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void StatsObjectHandler::reset ()
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            for (auto& entry : connections) {
+                entry.conn->reset_stats ();
+                entry.last_sent = 0;
+                entry.last_received = 0;
+                entry.last_time = std::chrono::steady_clock::now ();
+            }
+        }
+        refresh ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    bool StatsObjectHandler::on_message (Message& msg)
+    {
+        if (!msg.is_method_call())
+            return false;
+
+        auto iface = msg.interface_view ();
+        auto name = msg.name_view ();
+        Message reply (msg, false);
+
+        // Without a timer, the statistics are collected when
+        // requested if they are older than the interval.
+        if (!timers) {
+            bool expired;
+            {
+                std::lock_guard<std::mutex> lock (mutex);
+                expired = std::chrono::steady_clock::now() - last_refresh >=
+                    std::chrono::milliseconds (interval);
+            }
+            if (expired)
+                refresh ();
+        }
+
+        if (name == "Introspect" && (iface.empty() || iface == DBUS_INTERFACE_INTROSPECTABLE)) {
+            reply << introspect_data;
+        }
+        else if (!iface.empty() && iface != interface_name) {
+            return false;
+        }
+        else if (name == "GetConnections") {
+            std::lock_guard<std::mutex> lock (mutex);
+            reply << connection_stats;
+        }
+        else if (name == "GetMethods") {
+            std::lock_guard<std::mutex> lock (mutex);
+            reply << method_stats;
+        }
+        else if (name == "Reset") {
+            reset ();
+        }
+        else {
+            return false;
+        }
+
+        conn.send (reply);
+        return true;
+    }
+
+
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_STATSOBJECTHANDLER_HPP
+#define ULTRABUS_STATSOBJECTHANDLER_HPP
+
+#include <ultrabus/types.hpp>
+#include <ultrabus/ObjectHandler.hpp>
+#include <ultrabus/dbus_array.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iomultiplex.hpp>
+
+
+namespace ultrabus {
+
+
+    /**
+     * An object handler serving the statistics of one or more
+     * connections with the DBus interface <code>se.ultramarin.ultrabus.Stats</code>.
+     * <pre>
+     * ultrabus::StatsObjectHandler stats (conn);
+     * stats.register_opath (ultrabus::StatsObjectHandler::default_opath);
+     * </pre>
+     * The statistics are collected periodically in the context of the
+     * connection's I/O handler, and method calls are replied to with
+     * the latest collected values. The cost of a request doesn't
+     * depend on the number of messages or methods of the connections.
+     * On a connection driven by an external event loop, the statistics
+     * are instead collected when requested, at most once per interval.<br/>
+     * The interface has the following methods:
+     * <dl>
+     * <dt><code>GetConnections () -> a(sa{sv})</code></dt>
+     * <dd>The name of each connection and a dictionary of its statistics:
+     *     <code>MessagesSent</code>, <code>MessagesReceived</code>,
+     *     <code>MethodCallsSent</code>, <code>MethodCallsReceived</code>,
+     *     <code>SignalsSent</code>, <code>SignalsReceived</code>,
+     *     <code>ErrorsReceived</code>, <code>BytesSent</code>,
+     *     <code>BytesReceived</code> and <code>Timeouts</code> (uint64 counters),
+     *     <code>SentPerSecond</code> and <code>ReceivedPerSecond</code> (double,
+     *     messages per second since the previous collection),
+     *     <code>PendingCalls</code>, <code>SendQueue</code>,
+     *     <code>OutgoingBytes</code> and <code>ExecutorQueue</code> (uint64,
+     *     current queue depths), and <code>RoundTripP50</code>,
+     *     <code>RoundTripP99</code>, <code>RoundTripMax</code> and
+     *     <code>DispatchP99</code> (uint64, nanoseconds), and
+     *     <code>CpuMessages</code> (array of uint64, received
+     *     messages per CPU core).</dd>
+     * <dt><code>GetMethods () -> a(ssstttttt)</code></dt>
+     * <dd>For each method handled by the connections: connection name,
+     *     interface, method, number of calls, number of error replies,
+     *     and the 50th, 90th and 99th percentile and maximum of the
+     *     latency in nanoseconds from the call was received until it
+     *     was replied to.</dd>
+     * <dt><code>Reset ()</code></dt>
+     * <dd>Reset the statistics of all connections.</dd>
+     * </dl>
+     * The handler also implements <code>org.freedesktop.DBus.Introspectable</code>.
+     */
+    class StatsObjectHandler : public ObjectHandler {
+    public:
+        /**
+         * Name of the DBus interface.
+         */
+        static constexpr const char* interface_name = "se.ultramarin.ultrabus.Stats";
+
+        /**
+         * Suggested object path of the statistics object.
+         */
+        static constexpr const char* default_opath = "/se/ultramarin/ultrabus/Stats";
+
+        /**
+         * Constructor.
+         * The connection serving the statistics is added as the
+         * first connection to report, and method latency
+         * tracking is enabled on it.
+         * @param connection The connection serving the statistics.
+         * @param interval The interval in milliseconds
+         *                 between collections of the statistics.
+         * @see Connection::track_methods
+         */
+        StatsObjectHandler (Connection& connection, unsigned interval=1000);
+
+        /**
+         * Destructor.
+         */
+        virtual ~StatsObjectHandler ();
+
+        /**
+         * Add a connection to report.
+         * The connection must be removed with <code>remove_connection()</code>
+         * before it is destroyed. Method latency tracking is
+         * enabled on the connection.
+         * @param connection The connection.
+         * @param name The name of the connection in the statistics.
+         *             If empty, the unique bus name of the connection is used.
+         */
+        void add_connection (Connection& connection, const std::string& name="");
+
+        /**
+         * Stop reporting a connection.
+         */
+        void remove_connection (Connection& connection);
+
+        /**
+         * Collect the statistics now instead of waiting
+         * for the next periodic collection.
+         */
+        void refresh ();
+
+
+    protected:
+        /**
+         * Called on incoming messages.
+         */
+        virtual bool on_message (Message& msg);
+
+
+    private:
+        struct entry_t {
+            Connection* conn;
+            std::string name;
+            uint64_t last_sent;
+            uint64_t last_received;
+            std::chrono::steady_clock::time_point last_time;
+        };
+
+        unsigned interval;
+        std::mutex mutex;
+        std::vector<entry_t> connections;
+        dbus_array connection_stats; // a(sa{sv})
+        dbus_array method_stats;     // a(ssstttttt)
+        std::chrono::steady_clock::time_point last_refresh;
+
+        std::unique_ptr<iomultiplex::timer_set> timers;
+
+        void schedule ();
+        void reset ();
+        void collect (entry_t& entry, dbus_array& conn_stats, dbus_array& meth_stats);
+    };
+
+}
+
+
+
+#endif
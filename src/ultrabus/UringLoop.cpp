@@ -0,0 +1,615 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/UringLoop.hpp>
+#include <ultrabus/trace_buffer.hpp>
+#include <system_error>
+#include <memory>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+
+namespace ultrabus {
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI (1U << 0)
+#endif
+#ifndef IORING_POLL_ADD_LEVEL
+#define IORING_POLL_ADD_LEVEL (1U << 3)
+#endif
+
+
+    // user_data of requests whose completions are ignored
+    static constexpr uint64_t no_user_data = 0;
+
+
+    //--------------------------------------------------------------------------
+    // user_data of a poll request
+    //--------------------------------------------------------------------------
+    static inline uint64_t poll_user_data (int fd, uint32_t gen)
+    {
+        return ((uint64_t)gen << 32) | (uint32_t)fd;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // The rings shared with the kernel
+    //--------------------------------------------------------------------------
+    struct UringLoop::ring_t {
+        int fd {-1};
+
+        void* sq_ptr {MAP_FAILED};
+        std::size_t sq_size {0};
+        unsigned* sq_head {nullptr};
+        unsigned* sq_tail {nullptr};
+        unsigned* sq_mask {nullptr};
+        unsigned* sq_array {nullptr};
+        unsigned sq_entries {0};
+        io_uring_sqe* sqes {static_cast<io_uring_sqe*>(MAP_FAILED)};
+        std::size_t sqes_size {0};
+        unsigned tail {0};      // Tail of queued requests
+
+        void* cq_ptr {MAP_FAILED};
+        std::size_t cq_size {0};
+        unsigned* cq_head {nullptr};
+        unsigned* cq_tail {nullptr};
+        unsigned* cq_mask {nullptr};
+        io_uring_cqe* cqes {nullptr};
+
+        ~ring_t () {
+            if (sqes != MAP_FAILED)
+                munmap (sqes, sqes_size);
+            if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+                munmap (cq_ptr, cq_size);
+            if (sq_ptr != MAP_FAILED)
+                munmap (sq_ptr, sq_size);
+            if (fd >= 0)
+                close (fd);
+        }
+
+        // Return a cleared submission queue entry, or nullptr if the ring is full
+        io_uring_sqe* get_sqe () {
+            if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+                return nullptr;
+            auto index = tail & *sq_mask;
+            auto* sqe = &sqes[index];
+            memset (sqe, 0, sizeof(*sqe));
+            sq_array[index] = index;
+            ++tail;
+            return sqe;
+        }
+
+        // Make the queued requests visible to the kernel, return the
+        // number of requests to submit. Requests left in the ring by
+        // a failed submission are submitted again.
+        unsigned publish () {
+            __atomic_store_n (sq_tail, tail, __ATOMIC_RELEASE);
+            return tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+        }
+    };
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    UringLoop::UringLoop (unsigned entries)
+        : ring {new ring_t},
+          next_gen {1},
+          multishot {true},
+          quit {false},
+          loop_thread {std::thread::id()},
+          stat_enter {0},
+          stat_submit {0},
+          stat_complete {0}
+    {
+        std::unique_ptr<ring_t> r (ring);
+
+        io_uring_params params;
+        memset (&params, 0, sizeof(params));
+        r->fd = (int) syscall (__NR_io_uring_setup, entries, &params);
+        if (r->fd < 0)
+            throw std::system_error (errno, std::generic_category());
+        // The wait timeout is passed with IORING_ENTER_EXT_ARG, Linux 5.11
+        if (!(params.features & IORING_FEAT_EXT_ARG))
+            throw std::system_error (ENOSYS, std::generic_category());
+
+        r->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        r->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            r->sq_size = r->cq_size = std::max (r->sq_size, r->cq_size);
+
+        r->sq_ptr = mmap (nullptr, r->sq_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+        if (r->sq_ptr == MAP_FAILED)
+            throw std::system_error (errno, std::generic_category());
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            r->cq_ptr = r->sq_ptr;
+        }else{
+            r->cq_ptr = mmap (nullptr, r->cq_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+            if (r->cq_ptr == MAP_FAILED)
+                throw std::system_error (errno, std::generic_category());
+        }
+        r->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        r->sqes = static_cast<io_uring_sqe*> (mmap(nullptr, r->sqes_size, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES));
+        if (r->sqes == MAP_FAILED)
+            throw std::system_error (errno, std::generic_category());
+
+        auto* sq = static_cast<char*> (r->sq_ptr);
+        r->sq_head  = reinterpret_cast<unsigned*> (sq + params.sq_off.head);
+        r->sq_tail  = reinterpret_cast<unsigned*> (sq + params.sq_off.tail);
+        r->sq_mask  = reinterpret_cast<unsigned*> (sq + params.sq_off.ring_mask);
+        r->sq_array = reinterpret_cast<unsigned*> (sq + params.sq_off.array);
+        r->sq_entries = params.sq_entries;
+        r->tail = *r->sq_tail;
+
+        auto* cq = static_cast<char*> (r->cq_ptr);
+        r->cq_head = reinterpret_cast<unsigned*> (cq + params.cq_off.head);
+        r->cq_tail = reinterpret_cast<unsigned*> (cq + params.cq_off.tail);
+        r->cq_mask = reinterpret_cast<unsigned*> (cq + params.cq_off.ring_mask);
+        r->cqes    = reinterpret_cast<io_uring_cqe*> (cq + params.cq_off.cqes);
+
+        r.release ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    UringLoop::~UringLoop ()
+    {
+        while (!connections.empty())
+            remove (*connections.back());
+        delete ring;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int UringLoop::add (Connection& connection)
+    {
+        if (!connection.externally_driven() ||
+            std::find(connections.begin(), connections.end(), &connection) != connections.end())
+        {
+            return -1;
+        }
+        connections.push_back (&connection);
+
+        Connection* conn = &connection;
+        connection.on_watch_change ([this, conn](int fd, uint32_t events)
+            {
+                on_watch_change (conn, fd, events);
+            });
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void UringLoop::remove (Connection& connection)
+    {
+        auto entry = std::find (connections.begin(), connections.end(), &connection);
+        if (entry == connections.end())
+            return;
+        connection.on_watch_change (nullptr);
+        connections.erase (entry);
+
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            for (auto i=watches.begin(); i!=watches.end();) {
+                if (i->second.conn == &connection) {
+                    i->second.events = 0;
+                    update (i->first, i->second);
+                    i = watches.erase (i);
+                }else{
+                    ++i;
+                }
+            }
+        }
+        if (loop_thread.load() != std::this_thread::get_id())
+            enter (0, 0);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int UringLoop::run_once (int timeout)
+    {
+        loop_thread = std::this_thread::get_id ();
+
+        // Wait until the first timeout of the connections
+        for (auto* conn : connections) {
+            int t = conn->next_timeout ();
+            if (t >= 0 && (timeout < 0 || t < timeout))
+                timeout = t;
+        }
+
+        auto result = enter (timeout == 0 ? 0 : 1, timeout);
+        if (result < 0)
+            return -1;
+        handle_completions ();
+        while (result == cq_overflow) {
+            // The completion ring is emptied, let the kernel move the
+            // completions that didn't fit to the ring, and submit the
+            // requests that were refused.
+            result = enter (0, 0, true);
+            if (result < 0)
+                return -1;
+            handle_completions ();
+        }
+
+        for (auto* conn : connections) {
+            if (conn->next_timeout() == 0)
+                conn->process_timeouts ();
+        }
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int UringLoop::run ()
+    {
+        while (!quit) {
+            if (run_once() < 0)
+                return -1;
+        }
+        quit = false;
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void UringLoop::stop ()
+    {
+        quit = true;
+        {
+            // Complete a request to wake up the loop
+            std::lock_guard<std::mutex> lock (mutex);
+            queue_nop ();
+        }
+        enter (0, 0);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    UringLoop::stats_t UringLoop::stats () const
+    {
+        stats_t stats;
+        stats.enter_calls = stat_enter;
+        stats.submissions = stat_submit;
+        stats.completions = stat_complete;
+        return stats;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called by a connection with its I/O mutex locked
+    //--------------------------------------------------------------------------
+    void UringLoop::on_watch_change (Connection* conn, int fd, uint32_t events)
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            auto entry = watches.find (fd);
+            if (entry == watches.end()) {
+                if (!events)
+                    return;
+                entry = watches.emplace(fd, watch_t{conn, 0, 0, 0}).first;
+            }
+            entry->second.conn = conn;
+            entry->second.events = events;
+            update (fd, entry->second);
+            if (!events)
+                watches.erase (entry);
+        }
+
+        // Changes made by the loop are submitted when it waits
+        // for events, changes made by other threads directly.
+        if (loop_thread.load() != std::this_thread::get_id())
+            enter (0, 0);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called with the mutex locked
+    //--------------------------------------------------------------------------
+    void UringLoop::update (int fd, watch_t& w)
+    {
+        if (w.armed == w.events)
+            return;
+        if (w.armed) {
+            queue_poll_remove (poll_user_data(fd, w.gen));
+            w.armed = 0;
+        }
+        if (w.events)
+            arm (fd, w);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called with the mutex locked
+    //--------------------------------------------------------------------------
+    void UringLoop::arm (int fd, watch_t& w)
+    {
+        // A new generation for each request, completions
+        // of removed requests are ignored.
+        w.gen = next_gen++;
+        if (next_gen == 0)
+            next_gen = 1;
+        if (queue_poll_add(fd, w.events, poll_user_data(fd, w.gen)))
+            w.armed = w.events;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called with the mutex locked
+    //--------------------------------------------------------------------------
+    bool UringLoop::queue_poll_add (int fd, uint32_t events, uint64_t user_data)
+    {
+        auto* sqe = ring->get_sqe ();
+        if (!sqe && submit_locked() >= 0)
+            sqe = ring->get_sqe ();
+        if (!sqe)
+            return false;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        if (multishot)
+            sqe->len = IORING_POLL_ADD_MULTI | IORING_POLL_ADD_LEVEL;
+#if __BYTE_ORDER == __BIG_ENDIAN
+        events = (events << 16) | (events >> 16);
+#endif
+        sqe->poll32_events = events;
+        sqe->user_data = user_data;
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called with the mutex locked
+    //--------------------------------------------------------------------------
+    bool UringLoop::queue_poll_remove (uint64_t user_data)
+    {
+        auto* sqe = ring->get_sqe ();
+        if (!sqe && submit_locked() >= 0)
+            sqe = ring->get_sqe ();
+        if (!sqe)
+            return false;
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = user_data;
+        sqe->user_data = no_user_data;
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Called with the mutex locked
+    //--------------------------------------------------------------------------
+    bool UringLoop::queue_nop ()
+    {
+        auto* sqe = ring->get_sqe ();
+        if (!sqe && submit_locked() >= 0)
+            sqe = ring->get_sqe ();
+        if (!sqe)
+            return false;
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = no_user_data;
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Submit queued requests without waiting, when the ring is full.
+    // Called with the mutex locked
+    //--------------------------------------------------------------------------
+    int UringLoop::submit_locked ()
+    {
+        auto n = ring->publish ();
+        if (!n)
+            return 0;
+        ++stat_enter;
+        auto result = syscall (__NR_io_uring_enter, ring->fd, n, 0, 0, nullptr, 0);
+        if (result < 0) {
+            trace_buffer::record (trace_event::error, this, 0, errno);
+            return -1;
+        }
+        stat_submit += result;
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Submit queued requests, and wait for completions if
+    // min_complete isn't 0. Timeout in milliseconds, -1 for none.
+    // If get_events is true, overflowed completions are moved to
+    // the completion ring also when not waiting for completions.
+    // Returns cq_overflow if the completion ring must be emptied
+    // before requests can be submitted.
+    //--------------------------------------------------------------------------
+    int UringLoop::enter (unsigned min_complete, int timeout, bool get_events)
+    {
+        unsigned n;
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            n = ring->publish ();
+        }
+        if (!n && !min_complete && !get_events)
+            return 0;
+
+        unsigned flags = 0;
+        io_uring_getevents_arg arg;
+        __kernel_timespec ts;
+        memset (&arg, 0, sizeof(arg));
+        if (min_complete || get_events) {
+            flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+            arg.sigmask_sz = _NSIG / 8;
+            if (timeout >= 0) {
+                ts.tv_sec = timeout / 1000;
+                ts.tv_nsec = (timeout % 1000) * 1000000L;
+                arg.ts = (uint64_t)(uintptr_t) &ts;
+            }
+        }
+
+        ++stat_enter;
+        auto result = syscall (__NR_io_uring_enter, ring->fd, n, min_complete, flags,
+                               flags ? &arg : nullptr, sizeof(arg));
+        if (result < 0) {
+            switch (errno) {
+            case ETIME:  // Timeout
+            case EINTR:  // Interrupted by a signal
+                break;
+            case EBUSY:  // Completion ring overflow, nothing submitted
+                return cq_overflow;
+            default:
+                trace_buffer::record (trace_event::error, this, 0, errno);
+                return -1;
+            }
+        }else{
+            stat_submit += result;
+        }
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void UringLoop::handle_completions ()
+    {
+        ready.clear ();
+        failed.clear ();
+        uint64_t count = 0;
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            unsigned head = *ring->cq_head;
+            unsigned tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                auto& cqe = ring->cqes[head & *ring->cq_mask];
+                ++count;
+                if (cqe.user_data == no_user_data)
+                    continue;
+
+                int fd = (int)(uint32_t) cqe.user_data;
+                uint32_t gen = (uint32_t)(cqe.user_data >> 32);
+                auto entry = watches.find (fd);
+                if (entry == watches.end() || entry->second.gen != gen)
+                    continue; // A removed request
+                auto& w = entry->second;
+
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                    w.armed = 0; // The request is done, armed again below
+                if (cqe.res == -EINVAL && multishot) {
+                    // Multishot level triggered poll not supported,
+                    // use a single-shot request armed after each event.
+                    multishot = false;
+                }
+                else if (cqe.res < 0 &&
+                         cqe.res != -ECANCELED && cqe.res != -EINTR && cqe.res != -EAGAIN)
+                {
+                    // A hard error, like a closed file descriptor. Arming
+                    // the request again would fail the same way, drop the
+                    // watch and report an error on it to the connection.
+                    trace_buffer::record (trace_event::error, this, fd, -cqe.res);
+                    if (w.armed)
+                        queue_poll_remove (cqe.user_data);
+                    failed.push_back ({w.conn, fd, POLLERR});
+                    watches.erase (entry);
+                    continue;
+                }
+                else if (cqe.res > 0) {
+                    // Merge events on the same fd
+                    auto r = std::find_if (ready.begin(), ready.end(),
+                                           [fd](ready_t& r) { return r.fd == fd; });
+                    if (r == ready.end())
+                        ready.push_back ({w.conn, fd, (uint32_t) cqe.res});
+                    else
+                        r->events |= (uint32_t) cqe.res;
+                }
+                if (!w.armed && w.events)
+                    arm (fd, w);
+            }
+            __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+        }
+        stat_complete += count;
+
+        for (auto& r : ready) {
+            {
+                // The watch may be removed while handling another event
+                std::lock_guard<std::mutex> lock (mutex);
+                auto entry = watches.find (r.fd);
+                if (entry == watches.end() || entry->second.conn != r.conn)
+                    continue;
+            }
+            r.conn->process_ready (r.fd, r.events);
+        }
+
+        for (auto& r : failed) {
+            // The connection may be removed while handling another event
+            if (std::find(connections.begin(), connections.end(), r.conn) != connections.end())
+                r.conn->process_ready (r.fd, r.events);
+        }
+    }
+
+
+#else // HAVE_LINUX_IO_URING_H
+
+
+    struct UringLoop::ring_t {
+    };
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    UringLoop::UringLoop (unsigned entries)
+        : ring {nullptr},
+          next_gen {1},
+          multishot {false},
+          quit {false},
+          stat_enter {0},
+          stat_submit {0},
+          stat_complete {0}
+    {
+        throw std::system_error (ENOSYS, std::generic_category());
+    }
+
+
+    UringLoop::~UringLoop () {}
+    int UringLoop::add (Connection& connection) { return -1; }
+    void UringLoop::remove (Connection& connection) {}
+    int UringLoop::run_once (int timeout) { return -1; }
+    int UringLoop::run () { return -1; }
+    void UringLoop::stop () {}
+    UringLoop::stats_t UringLoop::stats () const { return stats_t {0, 0, 0}; }
+
+
+#endif // HAVE_LINUX_IO_URING_H
+
+
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_URINGLOOP_HPP
+#define ULTRABUS_URINGLOOP_HPP
+
+#include <ultrabus/Connection.hpp>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+
+namespace ultrabus {
+
+
+    /**
+     * An event loop using io_uring, driving connections created
+     * with <code>Connection::external_loop</code>.
+     * <pre>
+     * ultrabus::UringLoop uring;
+     * ultrabus::Connection conn (ultrabus::Connection::external_loop);
+     * uring.add (conn);
+     * conn.connect ();
+     * uring.run (); // Until uring.stop() is called
+     * </pre>
+     * The file descriptors of the connections are watched by
+     * multishot poll requests, that stay armed after each event
+     * instead of being re-armed with a system call per event.
+     * Changes of the watched events, like libdbus enabling and
+     * disabling the write watch for each outgoing message, are
+     * queued in the submission ring and submitted in the same
+     * system call that waits for the next events.<br/>
+     * Only the waiting is done by io_uring, libdbus still reads
+     * and writes the sockets itself when a watch is handled.<br/>
+     * The system calls are made directly, liburing is not used.
+     * Multishot level triggered poll requests need Linux 5.19, on
+     * older kernels a single-shot poll request is re-armed after each
+     * event, still submitted in the same system call as the wait.<br/>
+     * A watch whose poll request fails, like for a file descriptor
+     * that is closed, is dropped and reported to the connection
+     * as an error on the watch.
+     */
+    class UringLoop {
+    public:
+        /**
+         * Statistics of the event loop.
+         */
+        struct stats_t {
+            uint64_t enter_calls; /**< Number of io_uring_enter() system calls. */
+            uint64_t submissions; /**< Number of submitted requests. */
+            uint64_t completions; /**< Number of handled completions. */
+        };
+
+        /**
+         * Constructor.
+         * Create an io_uring instance.
+         * @param entries The size of the submission ring.
+         * @throw std::system_error If io_uring isn't supported by the
+         *                          kernel, or by the build of the library.
+         */
+        explicit UringLoop (unsigned entries=256);
+
+        /**
+         * Destructor.
+         * Connections still added are removed.
+         */
+        ~UringLoop ();
+
+        UringLoop (const UringLoop&) = delete;
+        UringLoop& operator= (const UringLoop&) = delete;
+
+        /**
+         * Add a connection driven by the event loop.
+         * The watch callback of the connection is set
+         * by the event loop. The connection must be
+         * removed before it is destroyed.
+         * @param connection A connection created with
+         *                   <code>Connection::external_loop</code>.
+         * @return 0 on success. -1 if the connection has an
+         *         I/O handler, or is already added.
+         */
+        int add (Connection& connection);
+
+        /**
+         * Remove a connection from the event loop.
+         */
+        void remove (Connection& connection);
+
+        /**
+         * Wait for events and handle them once.
+         * @param timeout Maximum time in milliseconds to wait
+         *                for events, or -1 to wait until an
+         *                event or a timeout of a connection.
+         * @return 0 on success, -1 on error.
+         */
+        int run_once (int timeout=-1);
+
+        /**
+         * Handle events until <code>stop()</code> is called.
+         * @return 0 when stopped, -1 on error.
+         */
+        int run ();
+
+        /**
+         * Make <code>run()</code> return.
+         * Can be called by any thread.
+         */
+        void stop ();
+
+        /**
+         * Return the statistics of the event loop.
+         */
+        stats_t stats () const;
+
+
+    private:
+        struct ring_t;
+        struct watch_t {
+            Connection* conn;
+            uint32_t events;    // Events to wait for
+            uint32_t armed;     // Events of the active poll request, 0 if none
+            uint32_t gen;       // Generation of the active poll request
+        };
+        struct ready_t {
+            Connection* conn;
+            int fd;
+            uint32_t events;
+        };
+
+        ring_t* ring;
+        mutable std::mutex mutex;
+        std::unordered_map<int, watch_t> watches;
+        std::vector<Connection*> connections;
+        std::vector<ready_t> ready;
+        std::vector<ready_t> failed; // Dropped watches, reported as errors
+        uint32_t next_gen;
+        bool multishot;
+        std::atomic_bool quit;
+        std::atomic<std::thread::id> loop_thread;
+
+        std::atomic<uint64_t> stat_enter;
+        std::atomic<uint64_t> stat_submit;
+        std::atomic<uint64_t> stat_complete;
+
+        void on_watch_change (Connection* conn, int fd, uint32_t events);
+        void update (int fd, watch_t& w);
+        void arm (int fd, watch_t& w);
+        bool queue_poll_add (int fd, uint32_t events, uint64_t user_data);
+        bool queue_poll_remove (uint64_t user_data);
+        bool queue_nop ();
+        int submit_locked ();
+        static constexpr int cq_overflow = 1;
+        int enter (unsigned min_complete, int timeout, bool get_events=false);
+        void handle_completions ();
+    };
+
+
+}
+
+#endif
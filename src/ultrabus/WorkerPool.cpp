@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/WorkerPool.hpp>
+#include <algorithm>
+#include <system_error>
+#include <string>
+#include <cerrno>
+
+
+namespace ultrabus {
+
+
+    // The worker running in the current thread, if any
+    static thread_local void* current_worker = nullptr;
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    WorkerPool::WorkerPool (unsigned num_threads, const thread_options& options)
+    {
+        if (num_threads == 0)
+            num_threads = std::max (std::thread::hardware_concurrency(), 1u);
+
+        workers.reserve (num_threads);
+        try {
+            for (unsigned i=0; i<num_threads; ++i) {
+                workers.emplace_back (std::make_shared<worker_t>());
+                auto& w = *workers.back ();
+                w.thread = std::thread (run, workers.back());
+                if (!options.empty() &&
+                    options.apply(w.thread.native_handle(), "-" + std::to_string(i)))
+                {
+                    throw std::system_error (errno, std::generic_category());
+                }
+            }
+        }
+        catch (...) {
+            for (auto& w : workers) {
+                {
+                    std::lock_guard<std::mutex> lock (w->mutex);
+                    w->quit = true;
+                }
+                w->cv.notify_all ();
+                if (w->thread.joinable())
+                    w->thread.join ();
+            }
+            throw;
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    WorkerPool::~WorkerPool ()
+    {
+        for (auto& w : workers) {
+            {
+                std::lock_guard<std::mutex> lock (w->mutex);
+                w->quit = true;
+                w->queue.clear ();
+            }
+            w->cv.notify_all ();
+        }
+        for (auto& w : workers) {
+            if (w->thread.joinable() && w->thread.get_id() != std::this_thread::get_id())
+                w->thread.join ();
+            else if (w->thread.joinable())
+                w->thread.detach ();
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::size_t WorkerPool::queued () const
+    {
+        std::size_t count = 0;
+        for (auto& w : workers) {
+            std::lock_guard<std::mutex> lock (w->mutex);
+            count += w->queue.size ();
+        }
+        return count;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void WorkerPool::post (std::size_t key, const void* owner, job_t&& job)
+    {
+        auto& w = *workers[key % workers.size()];
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lock (w.mutex);
+            was_empty = w.queue.empty ();
+            w.queue.push_back (entry_t{owner, std::move(job)});
+        }
+        if (was_empty)
+            w.cv.notify_all ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void WorkerPool::purge (const void* owner, bool wait)
+    {
+        for (auto& wp : workers) {
+            auto& w = *wp;
+            std::unique_lock<std::mutex> lock (w.mutex);
+            w.queue.erase (std::remove_if(w.queue.begin(), w.queue.end(),
+                                          [owner](const entry_t& e){ return e.owner == owner; }),
+                           w.queue.end());
+            if (!wait || current_worker == &w)
+                continue; // Don't wait for ourselves
+            w.cv.wait (lock, [&w, owner]{ return w.running != owner; });
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::size_t WorkerPool::key (const char* str)
+    {
+        // FNV-1a
+        std::size_t h = 14695981039346656037ULL;
+        if (str) {
+            while (*str) {
+                h ^= (unsigned char) *str++;
+                h *= 1099511628211ULL;
+            }
+        }
+        return h;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void worker_jobs::post (const std::shared_ptr<WorkerPool>& pool,
+                            std::size_t key,
+                            WorkerPool::job_t&& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            auto tracked = std::find_if (pools.begin(), pools.end(),
+                                         [&pool](const std::weak_ptr<WorkerPool>& wp) {
+                                             return !wp.owner_before(pool) && !pool.owner_before(wp);
+                                         });
+            if (tracked == pools.end()) {
+                pools.erase (std::remove_if(pools.begin(), pools.end(),
+                                            [](const std::weak_ptr<WorkerPool>& wp){ return wp.expired(); }),
+                             pools.end());
+                pools.emplace_back (pool);
+            }
+        }
+        pool->post (key, owner, std::move(job));
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void worker_jobs::purge (bool wait)
+    {
+        std::vector<std::weak_ptr<WorkerPool>> tracked;
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            tracked = pools;
+        }
+        for (auto& wp : tracked) {
+            auto pool = wp.lock ();
+            if (pool)
+                pool->purge (owner, wait);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void WorkerPool::run (std::shared_ptr<worker_t> wp)
+    {
+        auto& w = *wp;
+        current_worker = &w;
+        std::unique_lock<std::mutex> lock (w.mutex);
+        while (true) {
+            w.cv.wait (lock, [&w]{ return w.quit || !w.queue.empty(); });
+            if (w.quit)
+                break;
+
+            auto entry = std::move (w.queue.front());
+            w.queue.pop_front ();
+            w.running = entry.owner;
+            lock.unlock ();
+
+            entry.job ();
+            entry.job = nullptr; // Release captured objects before the owner is released
+
+            lock.lock ();
+            w.running = nullptr;
+            w.cv.notify_all ();
+        }
+    }
+
+
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_WORKERPOOL_HPP
+#define ULTRABUS_WORKERPOOL_HPP
+
+#include <ultrabus/inplace_function.hpp>
+#include <ultrabus/thread_options.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+
+namespace ultrabus {
+
+
+    /**
+     * A pool of worker threads executing jobs.
+     * Each job is posted with a key, and jobs with the same key
+     * are executed by the same worker thread in the order they
+     * were posted. This is used by the message and object handlers
+     * to run message callbacks concurrently while keeping the order
+     * of messages from the same sender, or to the same object path.
+     * @see Connection::executor
+     */
+    class WorkerPool {
+    public:
+        /**
+         * A job to execute in a worker thread.
+         */
+        using job_t = inplace_function<void ()>;
+
+        /**
+         * Constructor.
+         * Start the worker threads.
+         * @param num_threads The number of worker threads.
+         *                    If 0, the number of worker threads
+         *                    is the number of available CPU cores.
+         * @param options CPU affinity, scheduling policy and name of
+         *                the worker threads. The index of each worker
+         *                is appended to the name, like "worker-0".
+         * @throw std::system_error If a thread can't be started,
+         *                          or the thread options can't be applied.
+         */
+        explicit WorkerPool (unsigned num_threads=0,
+                             const thread_options& options=thread_options());
+
+        /**
+         * Destructor.
+         * Stop the worker threads. Jobs not yet
+         * started are discarded.
+         * If the pool is destroyed by one of its own worker threads,
+         * like when a job releases the last reference to the pool,
+         * that thread is detached and exits when the job returns.
+         */
+        ~WorkerPool ();
+
+        WorkerPool (const WorkerPool&) = delete;
+        WorkerPool& operator= (const WorkerPool&) = delete;
+
+        /**
+         * Return the number of worker threads.
+         */
+        unsigned size () const {
+            return (unsigned) workers.size ();
+        }
+
+        /**
+         * Return the number of jobs waiting to be executed
+         * by the worker threads.
+         */
+        std::size_t queued () const;
+
+        /**
+         * Post a job to a worker thread.
+         * @param key Jobs with the same key are executed in order
+         *            by the same worker thread.
+         * @param owner An object the job belongs to, used
+         *              to remove jobs with <code>purge()</code>.
+         * @param job The job to execute.
+         */
+        void post (std::size_t key, const void* owner, job_t&& job);
+
+        /**
+         * Remove all queued jobs belonging to an owner, and wait
+         * for jobs of the owner currently running to finish.
+         * If called from a job belonging to the owner,
+         * that job is not waited for.
+         * @param owner The owner of the jobs to remove.
+         * @param wait If false, only remove the queued jobs and
+         *             don't wait for running jobs to finish.
+         */
+        void purge (const void* owner, bool wait=true);
+
+        /**
+         * Make a key from a string, like a bus name or an object path.
+         * @param str A null terminated string, or <code>nullptr</code>.
+         */
+        static std::size_t key (const char* str);
+
+
+    private:
+        struct entry_t {
+            const void* owner;
+            job_t job;
+        };
+        struct worker_t {
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<entry_t> queue;
+            const void* running {nullptr}; // Owner of the running job
+            bool quit {false};
+        };
+        // Shared with the worker thread, a detached worker
+        // thread may outlive the pool.
+        std::vector<std::shared_ptr<worker_t>> workers;
+
+        static void run (std::shared_ptr<worker_t> w);
+    };
+
+
+    /**
+     * The jobs of one owner posted to worker pools.
+     * Keeps track of the pools the jobs are posted to, so the jobs
+     * can be removed from all of them, also from pools that are
+     * no longer used. Used by the message and object handlers.
+     */
+    class worker_jobs {
+    public:
+        /**
+         * Constructor.
+         * @param owner The owner of the jobs.
+         */
+        explicit worker_jobs (const void* owner)
+            : owner {owner}
+        {
+        }
+
+        /**
+         * Post a job of the owner to a worker pool.
+         * @see WorkerPool::post
+         */
+        void post (const std::shared_ptr<WorkerPool>& pool,
+                   std::size_t key,
+                   WorkerPool::job_t&& job);
+
+        /**
+         * Remove the queued jobs of the owner from all pools
+         * they were posted to, and wait for running jobs to finish.
+         * @see WorkerPool::purge
+         */
+        void purge (bool wait=true);
+
+
+    private:
+        const void* owner;
+        std::mutex mutex;
+        std::vector<std::weak_ptr<WorkerPool>> pools; // Pools jobs were posted to
+    };
+
+
+}
+
+#endif
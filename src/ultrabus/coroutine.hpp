@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_COROUTINE_HPP
+#define ULTRABUS_COROUTINE_HPP
+
+//
+// C++20 coroutine support.
+// ULTRABUS_HAVE_COROUTINES is defined if the compiler supports
+// coroutines, in that case the awaitable methods in ultrabus,
+// like Connection::async_send() and ObjectProxy::async_call(),
+// are available.
+//
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#  if __has_include(<coroutine>)
+#    define ULTRABUS_HAVE_COROUTINES 1
+#  endif
+#endif
+
+#ifdef ULTRABUS_HAVE_COROUTINES
+
+#include <ultrabus/retvalue.hpp>
+#include <coroutine>
+#include <functional>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <atomic>
+#include <cstdint>
+
+
+namespace ultrabus {
+
+
+    /**
+     * Base class of <code>task</code>.
+     */
+    class task_base {
+    protected:
+        static constexpr uintptr_t running_state  = 0;
+        static constexpr uintptr_t done_state     = 1;
+        static constexpr uintptr_t detached_state = 2;
+
+        struct promise_base {
+            // The state is running_state, done_state, detached_state,
+            // or the address of the coroutine awaiting the task.
+            std::atomic<uintptr_t> state {running_state};
+            std::exception_ptr error;
+
+            std::suspend_never initial_suspend () noexcept {
+                return {};
+            }
+
+            struct final_awaiter {
+                bool await_ready () const noexcept {
+                    return false;
+                }
+                template<typename P>
+                std::coroutine_handle<> await_suspend (std::coroutine_handle<P> h) noexcept {
+                    auto prev = h.promise().state.exchange (done_state, std::memory_order_acq_rel);
+                    if (prev == detached_state) {
+                        // Nobody owns the task anymore
+                        h.destroy ();
+                        return std::noop_coroutine ();
+                    }
+                    if (prev == running_state)
+                        return std::noop_coroutine ();
+                    // Resume the coroutine awaiting the task
+                    return std::coroutine_handle<>::from_address (reinterpret_cast<void*>(prev));
+                }
+                void await_resume () const noexcept {
+                }
+            };
+
+            final_awaiter final_suspend () noexcept {
+                return {};
+            }
+
+            void unhandled_exception () {
+                error = std::current_exception ();
+            }
+        };
+
+        template<typename T>
+        struct promise_value {
+            std::optional<T> value;
+            void return_value (T v) {
+                value.emplace (std::move(v));
+            }
+            T take () {
+                return std::move (*value);
+            }
+        };
+    };
+
+
+    template<>
+    struct task_base::promise_value<void> {
+        void return_void () {
+        }
+        void take () {
+        }
+    };
+
+
+    /**
+     * A coroutine returning a value of type <code>T</code>.
+     * The coroutine starts executing when called, and runs in the
+     * calling thread until it is suspended the first time. When
+     * awaiting a message reply, the coroutine is resumed in the
+     * context of the connection's I/O handler.<br/>
+     * A task can be awaited by another coroutine to get the
+     * result. If the task object is destroyed before the
+     * coroutine has finished, the coroutine continues to
+     * run and frees itself when done.
+     * <pre>
+     * ultrabus::task<std::string> get_owner (ultrabus::org_freedesktop_DBus& dbus)
+     * {
+     *     auto owner = co_await dbus.async_get_name_owner ("org.freedesktop.Notifications");
+     *     co_return owner.err() ? std::string("") : owner.get();
+     * }
+     * </pre>
+     */
+    template<typename T=void>
+    class task : public task_base {
+    public:
+        /**
+         * The promise type of the coroutine.
+         */
+        struct promise_type : public promise_base, public promise_value<T> {
+            task get_return_object () {
+                return task (std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+        };
+
+        /**
+         * Move constructor.
+         */
+        task (task&& t) noexcept : handle {std::exchange(t.handle, nullptr)} {
+        }
+
+        /**
+         * Move operator.
+         */
+        task& operator= (task&& t) noexcept {
+            if (&t != this) {
+                release ();
+                handle = std::exchange (t.handle, nullptr);
+            }
+            return *this;
+        }
+
+        task (const task&) = delete;
+        task& operator= (const task&) = delete;
+
+        /**
+         * Destructor.
+         * If the coroutine hasn't finished it is
+         * detached and frees itself when done.
+         */
+        ~task () {
+            release ();
+        }
+
+        /**
+         * Return <code>true</code> if the coroutine has finished.
+         */
+        bool done () const {
+            return !handle ||
+                handle.promise().state.load(std::memory_order_acquire) == done_state;
+        }
+
+        bool await_ready () const noexcept {
+            return done ();
+        }
+
+        bool await_suspend (std::coroutine_handle<> awaiting) noexcept {
+            auto expected = running_state;
+            return handle.promise().state.compare_exchange_strong (
+                    expected,
+                    reinterpret_cast<uintptr_t>(awaiting.address()),
+                    std::memory_order_acq_rel,
+                    std::memory_order_acquire);
+        }
+
+        T await_resume () {
+            auto& promise = handle.promise ();
+            if (promise.error)
+                std::rethrow_exception (promise.error);
+            return promise.take ();
+        }
+
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+
+        explicit task (std::coroutine_handle<promise_type> h) : handle {h} {
+        }
+
+        void release () {
+            if (handle) {
+                auto prev = handle.promise().state.exchange (detached_state,
+                                                            std::memory_order_acq_rel);
+                if (prev == done_state)
+                    handle.destroy ();
+                handle = nullptr;
+            }
+        }
+    };
+
+
+    /**
+     * Awaitable result of an asynchronous method taking
+     * a callback with a <code>retvalue</code> parameter.
+     * This is used to make awaitable versions of the
+     * asynchronous methods in the proxy classes for the
+     * standard DBus interfaces. It can also be used directly
+     * to await any of the callback based methods:
+     * <pre>
+     * auto names = co_await ultrabus::callback_awaitable<std::set<std::string>> (
+     *         [&dbus](auto cb){ return dbus.list_names(cb); });
+     * </pre>
+     * The awaiting coroutine is resumed in the thread calling the
+     * callback, normally the connection's I/O handler.
+     * If the message can't be sent, the coroutine isn't
+     * suspended and the result has error code -1.
+     */
+    template<typename T>
+    class callback_awaitable {
+    public:
+        /**
+         * Callback type of the asynchronous method.
+         */
+        using callback_t = std::function<void (retvalue<T>& retval)>;
+
+        /**
+         * Constructor.
+         * @param start A function that starts the asynchronous
+         *              operation, passing the callback to the
+         *              asynchronous method and returning its
+         *              result, 0 on success and -1 on failure.
+         */
+        explicit callback_awaitable (std::function<int (callback_t)> start)
+            : start_fn {std::move(start)}
+        {
+        }
+
+        bool await_ready () const noexcept {
+            return false;
+        }
+
+        bool await_suspend (std::coroutine_handle<> h) {
+            // The coroutine may be resumed, and this object destroyed,
+            // before the start function returns.
+            auto start = std::move (start_fn);
+            auto* retval = &result;
+            if (start([retval, h](retvalue<T>& r) {
+                        *retval = std::move (r);
+                        h.resume ();
+                    }) == 0)
+            {
+                return true;
+            }
+            result.err (-1, "Failed to send message");
+            return false;
+        }
+
+        retvalue<T> await_resume () {
+            return std::move (result);
+        }
+
+
+    private:
+        std::function<int (callback_t)> start_fn;
+        retvalue<T> result;
+    };
+
+
+}
+
+#endif
+#endif
@@ -40,12 +40,8 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     bool operator< (const dbus_basic& lhs, const dbus_basic& rhs)
     {
-        if (lhs.sig==DBUS_TYPE_STRING_AS_STRING ||
-            lhs.sig==DBUS_TYPE_OBJECT_PATH_AS_STRING ||
-            lhs.sig==DBUS_TYPE_SIGNATURE_AS_STRING)
-        {
-            return lhs.str_val < rhs.str_val;
-        }
+        if (lhs.is_string())
+            return lhs.str_view() < rhs.str_view();
         else if (lhs.sig == DBUS_TYPE_BYTE_AS_STRING)
             return lhs.val.byt < rhs.val.byt;
         else if (lhs.sig == DBUS_TYPE_BOOLEAN_AS_STRING)
@@ -267,6 +263,21 @@ namespace ultrabus {
     }
 
 
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    dbus_basic::dbus_basic (borrowed_t, const char* value, int str_type)
+    {
+        DBUS_BASIC_TRACE ("dbus_basic::dbus_basic(borrowed_t, const char*, int) - constructor");
+        if (str_type == DBUS_TYPE_OBJECT_PATH)
+            sig = DBUS_TYPE_OBJECT_PATH_AS_STRING;
+        else if (str_type == DBUS_TYPE_SIGNATURE)
+            sig = DBUS_TYPE_SIGNATURE_AS_STRING;
+        else
+            sig = DBUS_TYPE_STRING_AS_STRING;
+        val.str = const_cast<char*> (value ? value : "");
+    }
+
+
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
     dbus_basic& dbus_basic::operator= (const dbus_basic& obj)
@@ -296,12 +307,8 @@ namespace ultrabus {
         if (sig != mb.sig)
             return false;
 
-        if (sig==DBUS_TYPE_STRING_AS_STRING ||
-            sig==DBUS_TYPE_OBJECT_PATH_AS_STRING ||
-            sig==DBUS_TYPE_SIGNATURE_AS_STRING)
-        {
-            return str_val == mb.str_val;
-        }
+        if (is_string())
+            return str_view() == mb.str_view();
         else if (sig==DBUS_TYPE_DOUBLE_AS_STRING) {
             return val.dbl == mb.val.dbl;
         }
@@ -464,15 +471,12 @@ namespace ultrabus {
     //-----------------------------------------------------------------------
     const std::string dbus_basic::str () const
     {
+        if (is_string())
+            return std::string (str_view());
+
         std::stringstream ss;
 
-        if (sig==DBUS_TYPE_STRING_AS_STRING ||
-            sig==DBUS_TYPE_OBJECT_PATH_AS_STRING ||
-            sig==DBUS_TYPE_SIGNATURE_AS_STRING)
-        {
-            ss << str_val;
-        }
-        else if (sig == DBUS_TYPE_BYTE_AS_STRING)
+        if (sig == DBUS_TYPE_BYTE_AS_STRING)
             ss << (unsigned) val.byt;
         else if (sig == DBUS_TYPE_BOOLEAN_AS_STRING)
             ss << (val.bool_val ? "true" : "false");
@@ -497,6 +501,35 @@ namespace ultrabus {
     }
 
 
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    std::string_view dbus_basic::str_view () const
+    {
+        if (is_string() && val.str)
+            return std::string_view (val.str);
+        return std::string_view ();
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Owned strings always have val.str pointing to the data of str_val
+    //-----------------------------------------------------------------------
+    bool dbus_basic::is_borrowed () const
+    {
+        return is_string() && val.str != str_val.c_str();
+    }
+
+
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    bool dbus_basic::is_string () const
+    {
+        return sig==DBUS_TYPE_STRING_AS_STRING ||
+            sig==DBUS_TYPE_OBJECT_PATH_AS_STRING ||
+            sig==DBUS_TYPE_SIGNATURE_AS_STRING;
+    }
+
+
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
     dbus_basic& dbus_basic::str (const std::string& value, int str_type)
@@ -625,11 +658,9 @@ namespace ultrabus {
         const auto& b = dynamic_cast<const dbus_basic&> (obj);
         sig = b.sig;
         val = b.val;
-        if (sig==DBUS_TYPE_STRING_AS_STRING ||
-            sig==DBUS_TYPE_OBJECT_PATH_AS_STRING ||
-            sig==DBUS_TYPE_SIGNATURE_AS_STRING)
-        {
-            str_val = b.str_val;
+        if (is_string()) {
+            // Copies own their strings, also of borrowed strings
+            str_val = b.str_view ();
             val.str = const_cast<char*> (str_val.c_str());
         }else{
             str_val = "";
@@ -652,9 +683,14 @@ namespace ultrabus {
             throw std::invalid_argument (ss.str());
         }
         auto&& b = dynamic_cast<dbus_basic&&> (obj);
+        bool borrowed_str = b.is_borrowed ();
         sig      = std::move (b.sig);
         str_val  = std::move (b.str_val);
         val      = b.val;
+        // A moved short string is copied to a new buffer,
+        // val.str must point to the new one
+        if (is_string() && !borrowed_str)
+            val.str = const_cast<char*> (str_val.c_str());
 
         b.sig     = DBUS_TYPE_INT32_AS_STRING;
         b.val.u64 = 0LL;
@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <ultrabus/dbus_type.hpp>
 #include <string>
+#include <string_view>
 #include <dbus/dbus.h>
 
 namespace ultrabus {
@@ -32,6 +33,18 @@ namespace ultrabus {
      */
     class dbus_basic : public dbus_type {
     public:
+        /**
+         * Tag type for constructing a dbus_basic with a borrowed string.
+         */
+        struct borrowed_t {
+            explicit borrowed_t () = default;
+        };
+
+        /**
+         * Tag for constructing a dbus_basic with a borrowed string.
+         */
+        static constexpr borrowed_t borrowed {};
+
         dbus_basic (); /**< Default constructor. Default is a signed 32 bit integer with value 0. */
         virtual ~dbus_basic () = default; /**< Default destructor. */
 
@@ -74,6 +87,20 @@ namespace ultrabus {
                             Default is DBUS_TYPE_STRING.
          */
         dbus_basic (const char* value, int str_type=DBUS_TYPE_STRING);
+        /**
+           Construct a DBus string, object path or signature type
+           that refers to a string owned by someone else, like a
+           string in a received message. The string is not copied
+           and must outlive this object.
+           Moving the object keeps the string borrowed, copying
+           the object or assigning a new value copies the string.
+            @param value The string value.
+            @param str_type The type of DBus string.
+                            One of DBUS_TYPE_STRING, DBUS_TYPE_OBJECT_PATH, or DBUS_TYPE_SIGNATURE.
+                            Default is DBUS_TYPE_STRING.
+            @see Message::arguments(bool)
+         */
+        dbus_basic (borrowed_t, const char* value, int str_type=DBUS_TYPE_STRING);
 
         dbus_basic& operator= (const dbus_basic& t); /**< Assignment operator. */
         dbus_basic& operator= (dbus_basic&& t); /**< Move operator. */
@@ -113,6 +140,17 @@ namespace ultrabus {
         dbus_basic& fd (const int file_desc); /**< Assign a UNIX_FD value to the basic type. */
 
         virtual const std::string str () const; /**< Return the basic value as a string. */
+        /**
+         * Return a string, object path or signature value without copying it.
+         * The view is valid until the value is changed, and for a borrowed
+         * string as long as the borrowed string.
+         * An empty view is returned for other types.
+         */
+        std::string_view str_view () const;
+        /**
+         * Return true if this is a string value that isn't owned by the object.
+         */
+        bool is_borrowed () const;
         /**
          * Set a string, object path or signature value. Default is a string value.
          * @param val The string value.
@@ -172,7 +210,8 @@ namespace ultrabus {
     private:
         friend bool operator< (const dbus_basic& lval, const dbus_basic& rval);
         DBusBasicValue val;
-        std::string str_val;
+        std::string str_val; // Owned string values, val.str points to its data
+        bool is_string () const;
     };
 
 
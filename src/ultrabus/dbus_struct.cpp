@@ -127,6 +127,20 @@ namespace ultrabus {
     }
 
 
+    //-----------------------------------------------------------------------
+    //-----------------------------------------------------------------------
+    void dbus_struct::add (dbus_type&& t)
+    {
+        auto element = clone_dbus_type (std::forward<dbus_type>(t));
+        if (element != nullptr) {
+            elements.push_back (element);
+            sig.pop_back ();
+            sig.append (element->signature());
+            sig.append (DBUS_STRUCT_END_CHAR_AS_STRING);
+        }
+    }
+
+
     //-----------------------------------------------------------------------
     //-----------------------------------------------------------------------
     void dbus_struct::remove (size_t n)
@@ -225,7 +239,7 @@ namespace ultrabus {
         DBUS_STRUCT_TRACE ("dbus_struct::move(dbus_type&& obj) - obj: %s",
                            obj.str().c_str());
 
-        if (!obj.is_dict_entry()) {
+        if (!obj.is_struct()) {
             std::stringstream ss;
             ss << "Can't move a dbus_type with signature '"
                << obj.signature()
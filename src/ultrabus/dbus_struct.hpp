@@ -51,6 +51,7 @@ namespace ultrabus {
 
         size_t size () const;                          /**< Return the number of members in the struct. */
         void add (const dbus_type& t);                 /**< Add a member to the struct. */
+        void add (dbus_type&& t);                      /**< Move a member to the struct. */
         void remove (size_t n);                        /**< Remove the n:th member in the struct.
                                                             @throw std::out_of_range if <code>n</code> is out of range. */
         dbus_type& operator[] (size_t n);              /**< Return a reference to
@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_DBUS_TRAITS_HPP
+#define ULTRABUS_DBUS_TRAITS_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <type_traits>
+#include <cstdint>
+#include <ultrabus/fixed_array_view.hpp>
+#include <dbus/dbus.h>
+
+
+namespace ultrabus {
+
+
+    /**
+     * A DBus signature as a compile-time string.
+     * <code>value</code> is a null terminated string
+     * of the characters.
+     */
+    template<char... C>
+    struct dbus_sig {
+        static constexpr char value[] = {C..., '\0'}; /**< The signature. */
+    };
+
+
+    /**
+     * Concatenate dbus_sig types.
+     * <code>type</code> is a dbus_sig with the characters
+     * of all the given dbus_sig types.
+     */
+    template<typename... S>
+    struct dbus_sig_cat {
+        using type = dbus_sig<>; /**< The concatenated signature. */
+    };
+    /** @cond */
+    template<char... A>
+    struct dbus_sig_cat<dbus_sig<A...>> {
+        using type = dbus_sig<A...>;
+    };
+    template<char... A, char... B, typename... Rest>
+    struct dbus_sig_cat<dbus_sig<A...>, dbus_sig<B...>, Rest...> {
+        using type = typename dbus_sig_cat<dbus_sig<A..., B...>, Rest...>::type;
+    };
+    /** @endcond */
+
+
+    /**
+     * Mapping of a C++ type to a DBus type.
+     * Specializations exist for <code>bool</code>, the fixed size
+     * integer types, <code>double</code>, <code>std::string</code>,
+     * <code>std::string_view</code>, <code>const char*</code> (write only),
+     * <code>std::vector</code>, <code>fixed_array_view</code>,
+     * <code>std::map</code>, <code>std::unordered_map</code> and
+     * <code>std::tuple</code>, nested in any combination.
+     * <br/>
+     * Each specialization has:
+     * <ul>
+     * <li><code>supported</code> - true if the type can be marshalled.</li>
+     * <li><code>is_basic</code> - true for basic DBus types.</li>
+     * <li><code>is_fixed</code> - true if an array of the type can be
+     *     copied as a whole, the C++ and DBus representations are the same.</li>
+     * <li><code>type_code</code> - the DBus type code.</li>
+     * <li><code>signature</code> - the DBus signature as a dbus_sig type.</li>
+     * <li><code>append(iter, value)</code> - append a value to a message iterator.</li>
+     * <li><code>read(iter, value)</code> - read the value a message iterator
+     *     points to. The caller must have checked the signature.</li>
+     * </ul>
+     * Types without a specialization have <code>supported</code> set to false.
+     * @see Message::write
+     * @see Message::read
+     */
+    template<typename T, typename Enable=void>
+    struct dbus_traits {
+        static constexpr bool supported = false;
+        static constexpr bool is_basic = false;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_INVALID;
+        using signature = dbus_sig<>;
+    };
+
+
+    /**
+     * The DBus signature of a number of C++ types.
+     * <pre>
+     * // "ias"
+     * const char* sig = ultrabus::dbus_signature<int32_t, std::vector<std::string>>::value;
+     * </pre>
+     */
+    template<typename... Ts>
+    struct dbus_signature {
+        /** The signature as a dbus_sig type. */
+        using type = typename dbus_sig_cat<typename dbus_traits<std::decay_t<Ts>>::signature...>::type;
+        /** The signature as a null terminated string. */
+        static constexpr const char* value = type::value;
+        /** True if all types can be marshalled. */
+        static constexpr bool supported = (dbus_traits<std::decay_t<Ts>>::supported && ...);
+    };
+
+
+    /** @cond */
+
+    //
+    // Basic types with the same representation in C++ and DBus
+    //
+    template<typename T, int TypeCode, char Code>
+    struct dbus_basic_traits {
+        static constexpr bool supported = true;
+        static constexpr bool is_basic = true;
+        static constexpr bool is_fixed = true;
+        static constexpr int type_code = TypeCode;
+        using signature = dbus_sig<Code>;
+
+        static void append (DBusMessageIter& iter, const T& value) {
+            dbus_message_iter_append_basic (&iter, TypeCode, &value);
+        }
+        static void read (DBusMessageIter& iter, T& value) {
+            dbus_message_iter_get_basic (&iter, &value);
+        }
+    };
+
+    template<> struct dbus_traits<uint8_t>  : dbus_basic_traits<uint8_t,  DBUS_TYPE_BYTE,   'y'> {};
+    template<> struct dbus_traits<int16_t>  : dbus_basic_traits<int16_t,  DBUS_TYPE_INT16,  'n'> {};
+    template<> struct dbus_traits<uint16_t> : dbus_basic_traits<uint16_t, DBUS_TYPE_UINT16, 'q'> {};
+    template<> struct dbus_traits<int32_t>  : dbus_basic_traits<int32_t,  DBUS_TYPE_INT32,  'i'> {};
+    template<> struct dbus_traits<uint32_t> : dbus_basic_traits<uint32_t, DBUS_TYPE_UINT32, 'u'> {};
+    template<> struct dbus_traits<int64_t>  : dbus_basic_traits<int64_t,  DBUS_TYPE_INT64,  'x'> {};
+    template<> struct dbus_traits<uint64_t> : dbus_basic_traits<uint64_t, DBUS_TYPE_UINT64, 't'> {};
+    template<> struct dbus_traits<double>   : dbus_basic_traits<double,   DBUS_TYPE_DOUBLE, 'd'> {};
+
+    //
+    // A DBus boolean is 32 bits on the wire
+    //
+    template<>
+    struct dbus_traits<bool> {
+        static constexpr bool supported = true;
+        static constexpr bool is_basic = true;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_BOOLEAN;
+        using signature = dbus_sig<'b'>;
+
+        static void append (DBusMessageIter& iter, const bool value) {
+            dbus_bool_t val = value ? TRUE : FALSE;
+            dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &val);
+        }
+        static void read (DBusMessageIter& iter, bool& value) {
+            dbus_bool_t val = FALSE;
+            dbus_message_iter_get_basic (&iter, &val);
+            value = val != FALSE;
+        }
+    };
+
+    //
+    // Strings
+    //
+    template<>
+    struct dbus_traits<std::string> {
+        static constexpr bool supported = true;
+        static constexpr bool is_basic = true;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_STRING;
+        using signature = dbus_sig<'s'>;
+
+        static void append (DBusMessageIter& iter, const std::string& value) {
+            const char* str = value.c_str ();
+            dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &str);
+        }
+        static void read (DBusMessageIter& iter, std::string& value) {
+            const char* str = nullptr;
+            dbus_message_iter_get_basic (&iter, &str);
+            value.assign (str ? str : "");
+        }
+    };
+
+    template<>
+    struct dbus_traits<const char*> {
+        static constexpr bool supported = true;
+        static constexpr bool is_basic = true;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_STRING;
+        using signature = dbus_sig<'s'>;
+
+        static void append (DBusMessageIter& iter, const char* value) {
+            if (!value)
+                value = "";
+            dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &value);
+        }
+    };
+
+    template<>
+    struct dbus_traits<char*> : dbus_traits<const char*> {};
+
+    //
+    // A string view read from a message points into the message,
+    // appending one copies it to get a null terminated string
+    //
+    template<>
+    struct dbus_traits<std::string_view> {
+        static constexpr bool supported = true;
+        static constexpr bool is_basic = true;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_STRING;
+        using signature = dbus_sig<'s'>;
+
+        static void append (DBusMessageIter& iter, std::string_view value) {
+            std::string str (value);
+            dbus_traits<std::string>::append (iter, str);
+        }
+        static void read (DBusMessageIter& iter, std::string_view& value) {
+            const char* str = nullptr;
+            dbus_message_iter_get_basic (&iter, &str);
+            value = str ? std::string_view(str) : std::string_view();
+        }
+    };
+
+    //
+    // Arrays. Arrays of fixed size types are copied as a whole,
+    // booleans are converted to and from 32 bit values on the way.
+    //
+    template<typename T, typename Alloc>
+    struct dbus_traits<std::vector<T, Alloc>> {
+        using element = dbus_traits<T>;
+        static constexpr bool supported = element::supported;
+        static constexpr bool is_basic = false;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_ARRAY;
+        using signature = typename dbus_sig_cat<dbus_sig<'a'>, typename element::signature>::type;
+
+        static void append (DBusMessageIter& iter, const std::vector<T, Alloc>& value) {
+            DBusMessageIter sub_iter;
+            dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                              element::signature::value, &sub_iter);
+            if constexpr (element::is_fixed) {
+                const T* data = value.data ();
+                dbus_message_iter_append_fixed_array (&sub_iter, element::type_code,
+                                                      &data, (int) value.size());
+            }
+            else if constexpr (std::is_same_v<T, bool>) {
+                std::vector<dbus_bool_t> values (value.begin(), value.end());
+                const dbus_bool_t* data = values.data ();
+                dbus_message_iter_append_fixed_array (&sub_iter, DBUS_TYPE_BOOLEAN,
+                                                      &data, (int) values.size());
+            }
+            else {
+                for (const T& e : value)
+                    element::append (sub_iter, e);
+            }
+            dbus_message_iter_close_container (&iter, &sub_iter);
+        }
+        static void read (DBusMessageIter& iter, std::vector<T, Alloc>& value) {
+            DBusMessageIter sub_iter;
+            dbus_message_iter_recurse (&iter, &sub_iter);
+            value.clear ();
+            if constexpr (element::is_fixed || std::is_same_v<T, bool>) {
+                using fixed_t = std::conditional_t<element::is_fixed, T, dbus_bool_t>;
+                const fixed_t* data = nullptr;
+                int n = 0;
+                dbus_message_iter_get_fixed_array (&sub_iter, &data, &n);
+                if (data && n > 0)
+                    value.assign (data, data + n);
+            }
+            else {
+                while (dbus_message_iter_get_arg_type(&sub_iter) != DBUS_TYPE_INVALID) {
+                    T e {};
+                    element::read (sub_iter, e);
+                    value.push_back (std::move(e));
+                    dbus_message_iter_next (&sub_iter);
+                }
+            }
+        }
+    };
+
+    //
+    // Views of arrays of fixed size types, read without a copy
+    //
+    template<typename T>
+    struct dbus_traits<fixed_array_view<T>> {
+        using element = dbus_traits<T>;
+        static constexpr bool supported = element::is_fixed;
+        static constexpr bool is_basic = false;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_ARRAY;
+        using signature = typename dbus_sig_cat<dbus_sig<'a'>, typename element::signature>::type;
+
+        static void append (DBusMessageIter& iter, const fixed_array_view<T>& value) {
+            DBusMessageIter sub_iter;
+            const T* data = value.data ();
+            dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                              element::signature::value, &sub_iter);
+            dbus_message_iter_append_fixed_array (&sub_iter, element::type_code,
+                                                  &data, (int) value.size());
+            dbus_message_iter_close_container (&iter, &sub_iter);
+        }
+        static void read (DBusMessageIter& iter, fixed_array_view<T>& value) {
+            DBusMessageIter sub_iter;
+            const T* data = nullptr;
+            int n = 0;
+            dbus_message_iter_recurse (&iter, &sub_iter);
+            dbus_message_iter_get_fixed_array (&sub_iter, &data, &n);
+            value = fixed_array_view<T> (data, n > 0 ? (std::size_t) n : 0);
+        }
+    };
+
+    //
+    // Dictionaries, arrays of dict entries
+    //
+    template<typename M, typename K, typename V>
+    struct dbus_dict_traits {
+        using key = dbus_traits<K>;
+        using value = dbus_traits<V>;
+        static constexpr bool supported = key::supported && key::is_basic && value::supported;
+        static constexpr bool is_basic = false;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_ARRAY;
+        using entry_signature = typename dbus_sig_cat<dbus_sig<'{'>,
+                                                      typename key::signature,
+                                                      typename value::signature,
+                                                      dbus_sig<'}'>>::type;
+        using signature = typename dbus_sig_cat<dbus_sig<'a'>, entry_signature>::type;
+
+        static void append (DBusMessageIter& iter, const M& dict) {
+            DBusMessageIter sub_iter;
+            dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                              entry_signature::value, &sub_iter);
+            for (auto& entry : dict) {
+                DBusMessageIter entry_iter;
+                dbus_message_iter_open_container (&sub_iter, DBUS_TYPE_DICT_ENTRY,
+                                                  nullptr, &entry_iter);
+                key::append (entry_iter, entry.first);
+                value::append (entry_iter, entry.second);
+                dbus_message_iter_close_container (&sub_iter, &entry_iter);
+            }
+            dbus_message_iter_close_container (&iter, &sub_iter);
+        }
+        static void read (DBusMessageIter& iter, M& dict) {
+            DBusMessageIter sub_iter;
+            dbus_message_iter_recurse (&iter, &sub_iter);
+            dict.clear ();
+            while (dbus_message_iter_get_arg_type(&sub_iter) != DBUS_TYPE_INVALID) {
+                DBusMessageIter entry_iter;
+                dbus_message_iter_recurse (&sub_iter, &entry_iter);
+                K k {};
+                V v {};
+                key::read (entry_iter, k);
+                dbus_message_iter_next (&entry_iter);
+                value::read (entry_iter, v);
+                dict.emplace (std::move(k), std::move(v));
+                dbus_message_iter_next (&sub_iter);
+            }
+        }
+    };
+
+    template<typename K, typename V, typename Cmp, typename Alloc>
+    struct dbus_traits<std::map<K, V, Cmp, Alloc>>
+        : dbus_dict_traits<std::map<K, V, Cmp, Alloc>, K, V> {};
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Alloc>
+    struct dbus_traits<std::unordered_map<K, V, Hash, Eq, Alloc>>
+        : dbus_dict_traits<std::unordered_map<K, V, Hash, Eq, Alloc>, K, V> {};
+
+    //
+    // Structs
+    //
+    template<typename... Ts>
+    struct dbus_traits<std::tuple<Ts...>> {
+        static constexpr bool supported = sizeof...(Ts) > 0 && (dbus_traits<Ts>::supported && ...);
+        static constexpr bool is_basic = false;
+        static constexpr bool is_fixed = false;
+        static constexpr int type_code = DBUS_TYPE_STRUCT;
+        using signature = typename dbus_sig_cat<dbus_sig<'('>,
+                                                typename dbus_traits<Ts>::signature...,
+                                                dbus_sig<')'>>::type;
+
+        static void append (DBusMessageIter& iter, const std::tuple<Ts...>& value) {
+            DBusMessageIter sub_iter;
+            dbus_message_iter_open_container (&iter, DBUS_TYPE_STRUCT, nullptr, &sub_iter);
+            std::apply ([&sub_iter](const Ts&... members) {
+                    (dbus_traits<Ts>::append(sub_iter, members), ...);
+                },
+                value);
+            dbus_message_iter_close_container (&iter, &sub_iter);
+        }
+        static void read (DBusMessageIter& iter, std::tuple<Ts...>& value) {
+            DBusMessageIter sub_iter;
+            dbus_message_iter_recurse (&iter, &sub_iter);
+            std::apply ([&sub_iter](Ts&... members) {
+                    ((dbus_traits<Ts>::read(sub_iter, members), dbus_message_iter_next(&sub_iter)), ...);
+                },
+                value);
+        }
+    };
+
+    /** @endcond */
+
+
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_FIXED_ARRAY_VIEW_HPP
+#define ULTRABUS_FIXED_ARRAY_VIEW_HPP
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+
+namespace ultrabus {
+
+
+    /**
+     * A non-owning view of a contiguous array of a fixed size
+     * DBus type, like <code>uint8_t</code>, <code>int32_t</code>
+     * or <code>double</code>.
+     * Writing a view to a message with <code>Message::write()</code>
+     * copies the whole array at once:
+     * <pre>
+     * msg.write (ultrabus::fixed_array_view<uint8_t>(image, image_size));
+     * </pre>
+     * Reading a view with <code>Message::read()</code> doesn't copy
+     * anything, the view points into the message and is valid as
+     * long as the message is referenced.
+     * <pre>
+     * auto args = msg.read<ultrabus::fixed_array_view<uint8_t>> ();
+     * if (!args.err()) {
+     *     auto& blob = std::get<0> (args.get());
+     *     process (blob.data(), blob.size());
+     * }
+     * </pre>
+     */
+    template<typename T>
+    class fixed_array_view {
+    public:
+        using value_type = T;                /**< Element type. */
+        using const_iterator = const T*;     /**< Iterator type. */
+
+        /**
+         * Default constructor. An empty view.
+         */
+        fixed_array_view () = default;
+
+        /**
+         * Constructor.
+         * @param data Pointer to the first element.
+         * @param size Number of elements.
+         */
+        fixed_array_view (const T* data, std::size_t size)
+            : ptr (data), len (size)
+        {
+        }
+
+        /**
+         * Constructor.
+         * A view of a container with contiguous storage,
+         * like <code>std::vector</code> or <code>std::array</code>.
+         */
+        template<typename C,
+                 typename = std::enable_if_t<std::is_convertible_v<
+                     decltype(std::declval<const C&>().data()), const T*>>>
+        fixed_array_view (const C& container)
+            : ptr (container.data()), len (container.size())
+        {
+        }
+
+        /**
+         * Return a pointer to the first element.
+         */
+        const T* data () const {
+            return ptr;
+        }
+
+        /**
+         * Return the number of elements.
+         */
+        std::size_t size () const {
+            return len;
+        }
+
+        /**
+         * Return true if the view is empty.
+         */
+        bool empty () const {
+            return len == 0;
+        }
+
+        /**
+         * Return an element. No bounds checking is made.
+         */
+        const T& operator[] (std::size_t i) const {
+            return ptr[i];
+        }
+
+        /**
+         * Return an iterator to the first element.
+         */
+        const_iterator begin () const {
+            return ptr;
+        }
+
+        /**
+         * Return an iterator past the last element.
+         */
+        const_iterator end () const {
+            return ptr + len;
+        }
+
+
+    private:
+        const T* ptr {nullptr};
+        std::size_t len {0};
+    };
+
+
+}
+
+#endif
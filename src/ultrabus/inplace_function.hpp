@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_INPLACE_FUNCTION_HPP
+#define ULTRABUS_INPLACE_FUNCTION_HPP
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <new>
+
+
+namespace ultrabus {
+
+
+    template<typename Signature, std::size_t Capacity=48>
+    class inplace_function;
+
+
+    /**
+     * A function wrapper with a small internal buffer.
+     * This works like <code>std::function</code>, but callable
+     * objects that fit in <code>Capacity</code> bytes are stored
+     * inside the object itself and never allocated on the heap.
+     * Larger callable objects are allocated on the heap.<br/>
+     * A lambda capturing a <code>std::function</code> object
+     * and a couple of pointers fits in the default capacity.
+     */
+    template<typename R, typename... Args, std::size_t Capacity>
+    class inplace_function<R (Args...), Capacity> {
+    public:
+        /**
+         * Default constructor.
+         * Creates an empty function object.
+         */
+        inplace_function () noexcept : ops {nullptr} {
+        }
+
+        /**
+         * Creates an empty function object.
+         */
+        inplace_function (std::nullptr_t) noexcept : ops {nullptr} {
+        }
+
+        /**
+         * Create a function object from a callable object.
+         * If the callable object is a null function pointer
+         * or an empty <code>std::function</code>, an empty
+         * function object is created.
+         * Only callable objects that can be called with
+         * <code>Args</code>, returning something convertible
+         * to <code>R</code>, are accepted.
+         */
+        template<typename F,
+                 typename = typename std::enable_if<
+                     !std::is_same<typename std::decay<F>::type, inplace_function>::value &&
+                     std::is_invocable_r<R, typename std::decay<F>::type&, Args...>::value>::type>
+        inplace_function (F&& f) : ops {nullptr} {
+            if (!is_null(f))
+                assign<typename std::decay<F>::type> (std::forward<F>(f));
+        }
+
+        /**
+         * Copy constructor.
+         */
+        inplace_function (const inplace_function& f) : ops {f.ops} {
+            if (ops)
+                ops->copy (buf, f.buf);
+        }
+
+        /**
+         * Move constructor.
+         */
+        inplace_function (inplace_function&& f) noexcept : ops {f.ops} {
+            if (ops) {
+                ops->move (buf, f.buf);
+                f.ops = nullptr;
+            }
+        }
+
+        /**
+         * Destructor.
+         */
+        ~inplace_function () {
+            reset ();
+        }
+
+        /**
+         * Assignment operator.
+         */
+        inplace_function& operator= (const inplace_function& f) {
+            if (&f != this) {
+                reset ();
+                if (f.ops)
+                    f.ops->copy (buf, f.buf);
+                ops = f.ops;
+            }
+            return *this;
+        }
+
+        /**
+         * Move operator.
+         */
+        inplace_function& operator= (inplace_function&& f) noexcept {
+            if (&f != this) {
+                reset ();
+                if (f.ops) {
+                    f.ops->move (buf, f.buf);
+                    ops = f.ops;
+                    f.ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        /**
+         * Clear the function object.
+         */
+        inplace_function& operator= (std::nullptr_t) noexcept {
+            reset ();
+            return *this;
+        }
+
+        /**
+         * Call the wrapped callable object.
+         * @throw std::bad_function_call If the function object is empty.
+         */
+        R operator() (Args... args) const {
+            if (!ops)
+                throw std::bad_function_call ();
+            return ops->invoke (const_cast<void*>(static_cast<const void*>(buf)),
+                                std::forward<Args>(args)...);
+        }
+
+        /**
+         * Return <code>true</code> if the object contains a callable object.
+         */
+        explicit operator bool () const noexcept {
+            return ops != nullptr;
+        }
+
+
+    private:
+        struct ops_t {
+            R (*invoke) (void* buf, Args&&... args);
+            void (*copy) (void* dst, const void* src);
+            void (*move) (void* dst, void* src);
+            void (*destroy) (void* buf);
+        };
+
+        // Callable objects stored in the internal buffer
+        template<typename F>
+        struct local_ops {
+            static R invoke (void* buf, Args&&... args) {
+                return (*static_cast<F*>(buf)) (std::forward<Args>(args)...);
+            }
+            static void copy (void* dst, const void* src) {
+                new (dst) F (*static_cast<const F*>(src));
+            }
+            static void move (void* dst, void* src) {
+                new (dst) F (std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F ();
+            }
+            static void destroy (void* buf) {
+                static_cast<F*>(buf)->~F ();
+            }
+            static constexpr ops_t ops {invoke, copy, move, destroy};
+        };
+
+        // Callable objects allocated on the heap
+        template<typename F>
+        struct heap_ops {
+            static F*& ptr (void* buf) {
+                return *static_cast<F**>(buf);
+            }
+            static R invoke (void* buf, Args&&... args) {
+                return (*ptr(buf)) (std::forward<Args>(args)...);
+            }
+            static void copy (void* dst, const void* src) {
+                ptr(dst) = new F (*ptr(const_cast<void*>(src)));
+            }
+            static void move (void* dst, void* src) {
+                ptr(dst) = ptr(src);
+                ptr(src) = nullptr;
+            }
+            static void destroy (void* buf) {
+                delete ptr(buf);
+            }
+            static constexpr ops_t ops {invoke, copy, move, destroy};
+        };
+
+        template<typename F>
+        using fits = std::integral_constant<bool,
+                                            sizeof(F) <= Capacity &&
+                                            alignof(std::max_align_t) % alignof(F) == 0 &&
+                                            std::is_nothrow_move_constructible<F>::value>;
+
+        template<typename F, typename T>
+        void assign (T&& f) {
+            assign_impl<F> (std::forward<T>(f), fits<F>());
+        }
+        template<typename F, typename T>
+        void assign_impl (T&& f, std::true_type) {
+            new (buf) F (std::forward<T>(f));
+            ops = &local_ops<F>::ops;
+        }
+        template<typename F, typename T>
+        void assign_impl (T&& f, std::false_type) {
+            heap_ops<F>::ptr(buf) = new F (std::forward<T>(f));
+            ops = &heap_ops<F>::ops;
+        }
+
+        template<typename F>
+        static bool is_null (const F&) {
+            return false;
+        }
+        template<typename FR, typename... FArgs>
+        static bool is_null (FR (* const& f) (FArgs...)) {
+            return f == nullptr;
+        }
+        template<typename S>
+        static bool is_null (const std::function<S>& f) {
+            return !f;
+        }
+
+        void reset () noexcept {
+            if (ops) {
+                ops->destroy (buf);
+                ops = nullptr;
+            }
+        }
+
+        alignas(std::max_align_t) unsigned char buf[Capacity];
+        const ops_t* ops;
+    };
+
+
+    template<typename R, typename... Args, std::size_t Capacity>
+    template<typename F>
+    constexpr typename inplace_function<R (Args...), Capacity>::ops_t
+    inplace_function<R (Args...), Capacity>::local_ops<F>::ops;
+
+    template<typename R, typename... Args, std::size_t Capacity>
+    template<typename F>
+    constexpr typename inplace_function<R (Args...), Capacity>::ops_t
+    inplace_function<R (Args...), Capacity>::heap_ops<F>::ops;
+
+
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/latency_histogram.hpp>
+#include <algorithm>
+#include <cmath>
+
+
+namespace ultrabus {
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    latency_histogram::snapshot::snapshot ()
+        : buckets (num_buckets, 0),
+          total {0},
+          min_value {UINT64_MAX},
+          max_value {0},
+          sum_value {0}
+    {
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    uint64_t latency_histogram::snapshot::percentile (double p) const
+    {
+        if (!total)
+            return 0;
+        if (p <= 0.0)
+            return min ();
+        if (p >= 100.0)
+            return max_value;
+
+        // The rank of the value at the percentile, 1 to total
+        auto rank = (uint64_t) std::ceil (p / 100.0 * (double)total);
+        if (rank == 0)
+            rank = 1;
+
+        uint64_t n = 0;
+        for (std::size_t i=0; i<num_buckets; ++i) {
+            n += buckets[i];
+            if (n >= rank)
+                return std::max (std::min(bucket_max(i), max_value), min());
+        }
+        return max_value;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    latency_histogram::snapshot& latency_histogram::snapshot::operator+= (const snapshot& rhs)
+    {
+        for (std::size_t i=0; i<num_buckets; ++i)
+            buckets[i] += rhs.buckets[i];
+        total += rhs.total;
+        sum_value += rhs.sum_value;
+        min_value = std::min (min_value, rhs.min_value);
+        max_value = std::max (max_value, rhs.max_value);
+        return *this;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    latency_histogram::snapshot& latency_histogram::snapshot::operator-= (const snapshot& rhs)
+    {
+        total = 0;
+        std::size_t first = num_buckets;
+        std::size_t last = 0;
+        for (std::size_t i=0; i<num_buckets; ++i) {
+            buckets[i] -= std::min (buckets[i], rhs.buckets[i]);
+            total += buckets[i];
+            if (buckets[i]) {
+                first = std::min (first, i);
+                last = i;
+            }
+        }
+        sum_value -= std::min (sum_value, rhs.sum_value);
+
+        // The extremes of the values left are in the first and last
+        // non-empty buckets, the lifetime extremes narrow them down.
+        if (total) {
+            min_value = std::max (min_value, bucket_min(first));
+            max_value = std::min (max_value, bucket_max(last));
+        }else{
+            min_value = UINT64_MAX;
+            max_value = 0;
+        }
+        return *this;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    latency_histogram::latency_histogram ()
+        : sum_value {0},
+          min_value {UINT64_MAX},
+          max_value {0}
+    {
+        for (auto& b : buckets)
+            b.store (0, std::memory_order_relaxed);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    latency_histogram::snapshot latency_histogram::get () const
+    {
+        snapshot s;
+        for (std::size_t i=0; i<num_buckets; ++i) {
+            s.buckets[i] = buckets[i].load (std::memory_order_relaxed);
+            s.total += s.buckets[i];
+        }
+        s.sum_value = sum_value.load (std::memory_order_relaxed);
+        s.min_value = min_value.load (std::memory_order_relaxed);
+        s.max_value = max_value.load (std::memory_order_relaxed);
+        return s;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void latency_histogram::reset ()
+    {
+        for (auto& b : buckets)
+            b.store (0, std::memory_order_relaxed);
+        sum_value.store (0, std::memory_order_relaxed);
+        min_value.store (UINT64_MAX, std::memory_order_relaxed);
+        max_value.store (0, std::memory_order_relaxed);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    uint64_t latency_histogram::bucket_min (std::size_t bucket)
+    {
+        if (bucket < (1 << sub_bucket_bits))
+            return bucket;
+        unsigned shift = (unsigned)(bucket >> sub_bucket_bits) - 1;
+        uint64_t sub = bucket & ((1 << sub_bucket_bits) - 1);
+        return ((1 << sub_bucket_bits) + sub) << shift;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    uint64_t latency_histogram::bucket_max (std::size_t bucket)
+    {
+        if (bucket >= num_buckets - 1)
+            return UINT64_MAX;
+        return bucket_min(bucket + 1) - 1;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void latency_histogram::update_min (uint64_t value)
+    {
+        auto current = min_value.load (std::memory_order_relaxed);
+        while (value < current &&
+               !min_value.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            ;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void latency_histogram::update_max (uint64_t value)
+    {
+        auto current = max_value.load (std::memory_order_relaxed);
+        while (value > current &&
+               !max_value.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            ;
+    }
+
+
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_LATENCY_HISTOGRAM_HPP
+#define ULTRABUS_LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace ultrabus {
+
+
+    /**
+     * Histogram of latencies in nanoseconds.
+     * The buckets are log-linear, like in an HDR histogram: each power
+     * of two is split in 16 linear sub-buckets, so a recorded value
+     * is kept with a relative error of at most 1/16. Values up to
+     * 2<sup>36</sup> nanoseconds, about 68 seconds, are kept in
+     * 528 buckets, larger values are counted in the last bucket.<br/>
+     * Recording a value is a few relaxed atomic operations and never
+     * allocates memory, values can be recorded by several threads
+     * while a snapshot is taken by another.
+     */
+    class latency_histogram {
+    public:
+        /**
+         * Number of bits of the linear sub-buckets in each power of two.
+         */
+        static constexpr unsigned sub_bucket_bits = 4;
+
+        /**
+         * Values of 2<sup>max_bits</sup> and larger are
+         * counted in the last bucket.
+         */
+        static constexpr unsigned max_bits = 36;
+
+        /**
+         * Number of buckets in the histogram.
+         */
+        static constexpr std::size_t num_buckets = (max_bits - sub_bucket_bits + 1) << sub_bucket_bits;
+
+        /**
+         * A copy of a histogram at a point in time.
+         */
+        class snapshot {
+        public:
+            /**
+             * Create an empty snapshot.
+             */
+            snapshot ();
+
+            /**
+             * Return the number of recorded values.
+             */
+            uint64_t count () const {
+                return total;
+            }
+
+            /**
+             * Return the smallest recorded value, or 0 if empty.
+             */
+            uint64_t min () const {
+                return total ? min_value : 0;
+            }
+
+            /**
+             * Return the largest recorded value, or 0 if empty.
+             */
+            uint64_t max () const {
+                return max_value;
+            }
+
+            /**
+             * Return the sum of all recorded values.
+             */
+            uint64_t sum () const {
+                return sum_value;
+            }
+
+            /**
+             * Return the average of the recorded values, or 0 if empty.
+             */
+            double mean () const {
+                return total ? (double)sum_value / (double)total : 0.0;
+            }
+
+            /**
+             * Return the value at a percentile.
+             * The value is the upper limit of the bucket of the
+             * percentile, but never larger than the largest
+             * recorded value.
+             * @param p The percentile, 0.0 to 100.0.
+             * @return The value at the percentile, or 0 if empty.
+             */
+            uint64_t percentile (double p) const;
+
+            /**
+             * Add the values of another snapshot to this one.
+             */
+            snapshot& operator+= (const snapshot& rhs);
+
+            /**
+             * Subtract the values of an earlier snapshot of the same
+             * histogram, to get the values recorded in between.
+             * The minimum and maximum values are recomputed from the
+             * buckets left, so they are exact only to the resolution
+             * of a bucket.
+             */
+            snapshot& operator-= (const snapshot& rhs);
+
+            /**
+             * Return the number of values in a bucket.
+             */
+            uint64_t bucket_count (std::size_t bucket) const {
+                return buckets[bucket];
+            }
+
+        private:
+            friend class latency_histogram;
+            std::vector<uint64_t> buckets;
+            uint64_t total;
+            uint64_t min_value;
+            uint64_t max_value;
+            uint64_t sum_value;
+        };
+
+        /**
+         * Create an empty histogram.
+         */
+        latency_histogram ();
+
+        latency_histogram (const latency_histogram&) = delete;
+        latency_histogram& operator= (const latency_histogram&) = delete;
+
+        /**
+         * Record a value.
+         * @param value The latency in nanoseconds.
+         */
+        void record (uint64_t value) {
+            buckets[bucket(value)].fetch_add (1, std::memory_order_relaxed);
+            sum_value.fetch_add (value, std::memory_order_relaxed);
+            if (value < min_value.load(std::memory_order_relaxed))
+                update_min (value);
+            if (value > max_value.load(std::memory_order_relaxed))
+                update_max (value);
+        }
+
+        /**
+         * Return a copy of the histogram.
+         * Values recorded while the copy is made may
+         * or may not be included in the snapshot.
+         */
+        snapshot get () const;
+
+        /**
+         * Remove all recorded values.
+         * Values recorded while the histogram is reset
+         * may or may not be removed.
+         */
+        void reset ();
+
+        /**
+         * Return the bucket of a value.
+         */
+        static std::size_t bucket (uint64_t value) {
+            if (value < (1 << sub_bucket_bits))
+                return (std::size_t) value;
+            unsigned msb = 63 - __builtin_clzll (value);
+            if (msb >= max_bits)
+                return num_buckets - 1;
+            unsigned shift = msb - sub_bucket_bits;
+            return ((std::size_t)(shift + 1) << sub_bucket_bits) +
+                ((value >> shift) & ((1 << sub_bucket_bits) - 1));
+        }
+
+        /**
+         * Return the smallest value in a bucket.
+         */
+        static uint64_t bucket_min (std::size_t bucket);
+
+        /**
+         * Return the largest value in a bucket.
+         */
+        static uint64_t bucket_max (std::size_t bucket);
+
+
+    private:
+        std::atomic<uint64_t> buckets[num_buckets];
+        std::atomic<uint64_t> sum_value;
+        std::atomic<uint64_t> min_value;
+        std::atomic<uint64_t> max_value;
+
+        void update_min (uint64_t value);
+        void update_max (uint64_t value);
+    };
+
+
+}
+
+#endif
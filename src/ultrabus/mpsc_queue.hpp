@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_MPSC_QUEUE_HPP
+#define ULTRABUS_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <thread>
+
+
+namespace ultrabus {
+
+
+    /**
+     * Lock-free multiple producer, single consumer queue.
+     * This is an intrusive queue, objects put in the queue must
+     * inherit from class <code>mpsc_queue::node</code>.
+     * The queue never allocates memory, and it never takes
+     * ownership of the nodes.<br/>
+     * Any thread may call <code>push()</code>, but only one
+     * thread at a time may call <code>pop()</code>.
+     */
+    class mpsc_queue {
+    public:
+        /**
+         * Base class of objects that can be put in the queue.
+         */
+        struct node {
+            std::atomic<node*> next {nullptr}; /**< Next node in the queue. */
+        };
+
+        /**
+         * Constructor.
+         * Creates an empty queue.
+         */
+        mpsc_queue () : head {&stub}, tail {&stub} {
+        }
+
+        mpsc_queue (const mpsc_queue&) = delete;
+        mpsc_queue& operator= (const mpsc_queue&) = delete;
+
+        /**
+         * Add a node to the end of the queue.
+         * This method can be called by any thread.
+         * @param n The node to add.
+         */
+        void push (node* n) {
+            n->next.store (nullptr, std::memory_order_relaxed);
+            node* prev = head.exchange (n, std::memory_order_seq_cst);
+            prev->next.store (n, std::memory_order_release);
+        }
+
+        /**
+         * Remove the first node in the queue.
+         * This method may only be called by the consumer thread.
+         * @return The first node in the queue, or
+         *         <code>nullptr</code> if the queue is empty.
+         */
+        node* pop () {
+            node* t = tail.load (std::memory_order_relaxed);
+            node* next = t->next.load (std::memory_order_acquire);
+            if (t == &stub) {
+                if (next == nullptr) {
+                    if (head.load(std::memory_order_seq_cst) == &stub)
+                        return nullptr;
+                    next = wait_for_link (t);
+                }
+                tail.store (next, std::memory_order_relaxed);
+                t = next;
+                next = t->next.load (std::memory_order_acquire);
+            }
+            if (next == nullptr) {
+                if (head.load(std::memory_order_seq_cst) != t) {
+                    // A producer is between the exchange and
+                    // the store in push(), wait for it to finish.
+                    next = wait_for_link (t);
+                }else{
+                    push (&stub);
+                    next = wait_for_link (t);
+                }
+            }
+            tail.store (next, std::memory_order_relaxed);
+            return t;
+        }
+
+        /**
+         * Check if the queue is empty.
+         * The result is only a hint if called by any other thread
+         * than the consumer thread.
+         */
+        bool empty () const {
+            // The tail is the next node to pop unless it's the stub node,
+            // and the stub node is the head only if nothing is pushed after it.
+            return tail.load(std::memory_order_relaxed) == &stub &&
+                head.load(std::memory_order_seq_cst) == &stub;
+        }
+
+
+    private:
+        std::atomic<node*> head;
+        std::atomic<node*> tail; // Only changed by the consumer, read by empty()
+        node stub;
+
+        node* wait_for_link (node* n) {
+            node* next;
+            while ((next = n->next.load(std::memory_order_acquire)) == nullptr)
+                std::this_thread::yield ();
+            return next;
+        }
+    };
+
+
+}
+
+#endif
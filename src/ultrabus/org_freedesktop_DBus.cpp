@@ -823,8 +823,8 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     bool org_freedesktop_DBus::on_signal (Message& msg)
     {
-        if (msg.interface() != DBUS_INTERFACE_DBUS ||
-            msg.path() != DBUS_PATH_DBUS)
+        if (msg.interface_view() != DBUS_INTERFACE_DBUS ||
+            msg.path_view() != DBUS_PATH_DBUS)
         {
             return false;
         }
@@ -857,10 +857,11 @@ namespace ultrabus {
     void org_freedesktop_DBus::on_signal_impl (Message& msg,
                                                std::unique_lock<std::mutex>& cb_lock)
     {
-        if (msg.sender() != unique_bus_name)
+        if (msg.sender_view() != unique_bus_name)
             return;
 
-        if (msg.name() == "NameOwnerChanged" && name_owner_changed_cb) {
+        auto name_view = msg.name_view ();
+        if (name_view == "NameOwnerChanged" && name_owner_changed_cb) {
             dbus_basic name;
             dbus_basic old_owner;
             dbus_basic new_owner;
@@ -870,7 +871,7 @@ namespace ultrabus {
                 cb (name.str(), old_owner.str(), new_owner.str());
             }
         }
-        else if (msg.name() == "NameLost" && name_lost_cb) {
+        else if (name_view == "NameLost" && name_lost_cb) {
             dbus_basic name;
             if (msg.get_args(&name, nullptr)) {
                 auto cb = name_lost_cb;
@@ -878,7 +879,7 @@ namespace ultrabus {
                 cb (name.str());
             }
         }
-        else if (msg.name() == "NameAcquired" && name_acquired_cb) {
+        else if (name_view == "NameAcquired" && name_acquired_cb) {
             dbus_basic name;
             if (msg.get_args(&name, nullptr)) {
                 auto cb = name_acquired_cb;
@@ -22,6 +22,7 @@
 #include <ultrabus/Connection.hpp>
 #include <ultrabus/MessageHandler.hpp>
 #include <ultrabus/retvalue.hpp>
+#include <ultrabus/coroutine.hpp>
 #include <functional>
 #include <string>
 #include <vector>
@@ -78,7 +79,9 @@ namespace ultrabus {
          * Destructor.
          * Clean up resources. Removes any added callback.
          */
-        virtual ~org_freedesktop_DBus () = default;
+        virtual ~org_freedesktop_DBus () {
+            finish_jobs ();
+        }
 
         /**
          * Hello.
@@ -895,6 +898,219 @@ namespace ultrabus {
          */
         void set_name_acquired_cb (name_cb_t callback);
 
+#ifdef ULTRABUS_HAVE_COROUTINES
+        /**
+         * Awaitable version of the asynchronous <code>hello</code> method.
+         * Register the connection on the bus.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<std::string> async_hello ()
+        {
+            return callback_awaitable<std::string> ([this](callback_awaitable<std::string>::callback_t cb) {
+                    return hello (cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>request_name</code> method.
+         * Request a bus name.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<uint32_t> async_request_name (const std::string bus_name,
+                                                         uint32_t flags=0)
+        {
+            return callback_awaitable<uint32_t> ([this, bus_name, flags](callback_awaitable<uint32_t>::callback_t cb) {
+                    return request_name (bus_name, flags, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>release_name</code> method.
+         * Release a bus name.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<uint32_t> async_release_name (const std::string bus_name)
+        {
+            return callback_awaitable<uint32_t> ([this, bus_name](callback_awaitable<uint32_t>::callback_t cb) {
+                    return release_name (bus_name, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>list_queued_owners</code> method.
+         * List the connections queued for a bus name.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<std::vector<std::string>> async_list_queued_owners (const std::string& bus_name)
+        {
+            return callback_awaitable<std::vector<std::string>> ([this, bus_name](callback_awaitable<std::vector<std::string>>::callback_t cb) {
+                    return list_queued_owners (bus_name, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>list_names</code> method.
+         * List all names on the bus.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<std::set<std::string>> async_list_names ()
+        {
+            return callback_awaitable<std::set<std::string>> ([this](callback_awaitable<std::set<std::string>>::callback_t cb) {
+                    return list_names (cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>list_activatable_names</code> method.
+         * List all names that can be activated on the bus.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<std::set<std::string>> async_list_activatable_names ()
+        {
+            return callback_awaitable<std::set<std::string>> ([this](callback_awaitable<std::set<std::string>>::callback_t cb) {
+                    return list_activatable_names (cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>name_has_owner</code> method.
+         * Check if a bus name has an owner.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<bool> async_name_has_owner (const std::string bus_name)
+        {
+            return callback_awaitable<bool> ([this, bus_name](callback_awaitable<bool>::callback_t cb) {
+                    return name_has_owner (bus_name, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>start_service_by_name</code> method.
+         * Start a service by name.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<uint32_t> async_start_service_by_name (const std::string service,
+                                                                  uint32_t flags=0)
+        {
+            return callback_awaitable<uint32_t> ([this, service, flags](callback_awaitable<uint32_t>::callback_t cb) {
+                    return start_service_by_name (service, flags, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>update_activation_environment</code> method.
+         * Update the activation environment.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<int> async_update_activation_environment (const std::map<std::string, std::string>& env)
+        {
+            return callback_awaitable<int> ([this, env](callback_awaitable<int>::callback_t cb) {
+                    return update_activation_environment (env, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>get_name_owner</code> method.
+         * Get the unique name of the owner of a bus name.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<std::string> async_get_name_owner (const std::string bus_name)
+        {
+            return callback_awaitable<std::string> ([this, bus_name](callback_awaitable<std::string>::callback_t cb) {
+                    return get_name_owner (bus_name, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>get_connection_unix_user</code> method.
+         * Get the Unix user ID of a connection.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<uint32_t> async_get_connection_unix_user (const std::string service)
+        {
+            return callback_awaitable<uint32_t> ([this, service](callback_awaitable<uint32_t>::callback_t cb) {
+                    return get_connection_unix_user (service, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>get_connection_unix_process_id</code> method.
+         * Get the Unix process ID of a connection.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<uint32_t> async_get_connection_unix_process_id (const std::string service)
+        {
+            return callback_awaitable<uint32_t> ([this, service](callback_awaitable<uint32_t>::callback_t cb) {
+                    return get_connection_unix_process_id (service, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>get_connection_credentials</code> method.
+         * Get the credentials of a connection.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<std::map<std::string, dbus_variant>> async_get_connection_credentials (const std::string service)
+        {
+            return callback_awaitable<std::map<std::string, dbus_variant>> ([this, service](callback_awaitable<std::map<std::string, dbus_variant>>::callback_t cb) {
+                    return get_connection_credentials (service, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>add_match</code> method.
+         * Add a match rule.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<int> async_add_match (const std::string rule)
+        {
+            return callback_awaitable<int> ([this, rule](callback_awaitable<int>::callback_t cb) {
+                    return add_match (rule, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>remove_match</code> method.
+         * Remove a match rule.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<int> async_remove_match (const std::string rule)
+        {
+            return callback_awaitable<int> ([this, rule](callback_awaitable<int>::callback_t cb) {
+                    return remove_match (rule, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>get_id</code> method.
+         * Get the unique ID of the bus.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<std::string> async_get_id ()
+        {
+            return callback_awaitable<std::string> ([this](callback_awaitable<std::string>::callback_t cb) {
+                    return get_id (cb);
+                });
+        }
+
+#endif
+
         /**
          * Get the timeout used when sending messages on the DBus using instance.
          * @return A timeout value in milliseconds.
@@ -284,10 +284,11 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     bool org_freedesktop_DBus_ObjectManager::on_signal (Message& msg)
     {
-        if (msg.interface() != "org.freedesktop.DBus.ObjectManager")
+        if (msg.interface_view() != "org.freedesktop.DBus.ObjectManager")
             return false;
 
-        if (msg.name() == "InterfacesAdded") {
+        auto name = msg.name_view ();
+        if (name == "InterfacesAdded") {
             std::unique_lock<std::mutex> iface_lock (iface_mutex);
             auto key = std::make_pair (msg.sender(), msg.path());
             auto entry = iface_added_callbacks.find (key);
@@ -297,7 +298,7 @@ namespace ultrabus {
                 handle_added_ifaces (msg, cb);
             }
         }
-        else if (msg.name() == "InterfacesRemoved") {
+        else if (name == "InterfacesRemoved") {
             std::unique_lock<std::mutex> iface_lock (iface_mutex);
             auto key = std::make_pair (msg.sender(), msg.path());
             auto entry = iface_removed_callbacks.find (key);
@@ -23,6 +23,7 @@
 #include <ultrabus/Connection.hpp>
 #include <ultrabus/Properties.hpp>
 #include <ultrabus/retvalue.hpp>
+#include <ultrabus/coroutine.hpp>
 #include <functional>
 #include <string>
 #include <vector>
@@ -97,7 +98,9 @@ namespace ultrabus {
         /**
          * Destructor.
          */
-        virtual ~org_freedesktop_DBus_ObjectManager () = default;
+        virtual ~org_freedesktop_DBus_ObjectManager () {
+            finish_jobs ();
+        }
 
         /**
          * Get all sub-objects and properties of an object in a service.
@@ -222,6 +225,23 @@ namespace ultrabus {
         int remove_interfaces_removed_callback (const std::string& service,
                                                 const std::string& object_path);
 
+#ifdef ULTRABUS_HAVE_COROUTINES
+        /**
+         * Awaitable version of the asynchronous <code>get_managed_objects</code> method.
+         * Get all objects, interfaces and properties managed by a DBus object.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<managed_objects_t> async_get_managed_objects (const std::string& service,
+                                                                         const std::string& object_path)
+        {
+            return callback_awaitable<managed_objects_t> ([this, service, object_path](callback_awaitable<managed_objects_t>::callback_t cb) {
+                    return get_managed_objects (service, object_path, cb);
+                });
+        }
+
+#endif
+
         /**
          * Get the timeout used when sending messages on the DBus using instance.
          * @return A timeout value in milliseconds.
@@ -321,8 +321,8 @@ namespace ultrabus {
     //--------------------------------------------------------------------------
     bool org_freedesktop_DBus_Properties::on_signal (Message& msg)
     {
-        if (msg.interface() != DBUS_INTERFACE_PROPERTIES ||
-            msg.name() != "PropertiesChanged")
+        if (msg.interface_view() != DBUS_INTERFACE_PROPERTIES ||
+            msg.name_view() != "PropertiesChanged")
         {
             return false;
         }
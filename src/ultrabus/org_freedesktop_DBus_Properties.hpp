@@ -25,6 +25,7 @@
 #include <ultrabus/dbus_variant.hpp>
 #include <ultrabus/Properties.hpp>
 #include <ultrabus/retvalue.hpp>
+#include <ultrabus/coroutine.hpp>
 #include <functional>
 #include <string>
 #include <map>
@@ -73,7 +74,9 @@ namespace ultrabus {
          * Clean up resources. All callbacks added with method
          * <code>add_properties_changed_cb()</code> are removed.
          */
-        virtual ~org_freedesktop_DBus_Properties () = default;
+        virtual ~org_freedesktop_DBus_Properties () {
+            finish_jobs ();
+        }
 
         /**
          * Get all properties of a DBus object.
@@ -263,6 +266,57 @@ namespace ultrabus {
             return set_impl_async (service, object_path, interface, property_name, value, cb);
         }
 
+#ifdef ULTRABUS_HAVE_COROUTINES
+        /**
+         * Awaitable version of the asynchronous <code>get_all</code> method.
+         * Get all properties of a DBus object.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<Properties> async_get_all (const std::string& service,
+                                                      const std::string& object_path,
+                                                      const std::string& interface)
+        {
+            return callback_awaitable<Properties> ([this, service, object_path, interface](callback_awaitable<Properties>::callback_t cb) {
+                    return get_all (service, object_path, interface, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>get</code> method.
+         * Get the value of a property of a DBus object.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        callback_awaitable<dbus_variant> async_get (const std::string& service,
+                                                    const std::string& object_path,
+                                                    const std::string& interface,
+                                                    const std::string& property_name)
+        {
+            return callback_awaitable<dbus_variant> ([this, service, object_path, interface, property_name](callback_awaitable<dbus_variant>::callback_t cb) {
+                    return get (service, object_path, interface, property_name, cb);
+                });
+        }
+
+        /**
+         * Awaitable version of the asynchronous <code>set</code> method.
+         * Set a property of a DBus object.
+         * The awaiting coroutine is resumed in the context of
+         * the connection's I/O handler.
+         */
+        template<typename T>
+        callback_awaitable<int> async_set (const std::string& service,
+                                           const std::string& object_path,
+                                           const std::string& interface,
+                                           const std::string& property_name,
+                                           const T& value)
+        {
+            return callback_awaitable<int> ([this, service, object_path, interface, property_name, value](callback_awaitable<int>::callback_t cb) {
+                    return set (service, object_path, interface, property_name, value, cb);
+                });
+        }
+#endif
+
         /**
          * Set a callback to be called when the properties of a DBus object changes.
          * @param service A bus name.
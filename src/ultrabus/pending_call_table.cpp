@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/pending_call_table.hpp>
+#include <utility>
+
+
+namespace ultrabus {
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    pending_call_table::pending_call_table (std::size_t initial_size)
+        : count {0}
+    {
+        std::size_t size = 8;
+        while (size < initial_size)
+            size <<= 1;
+        slots.resize (size);
+        mask = size - 1;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    pending_call_table::~pending_call_table ()
+    {
+        clear ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    bool pending_call_table::insert (uint32_t serial,
+                                     DBusPendingCall* pending,
+                                     callback_t&& cb,
+                                     uint64_t time)
+    {
+        if (serial == 0 || find(serial) != npos)
+            return false;
+
+        // Keep the load factor at or below 50%
+        if ((count+1) * 2 > slots.size())
+            grow ();
+
+        slot_t entry;
+        entry.serial = serial;
+        entry.pending = pending;
+        entry.time = time;
+        entry.cb = std::move (cb);
+        place (entry);
+        ++count;
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    bool pending_call_table::take (uint32_t serial,
+                                   DBusPendingCall*& pending,
+                                   callback_t& cb,
+                                   uint64_t* time)
+    {
+        auto i = find (serial);
+        if (i == npos)
+            return false;
+
+        pending = slots[i].pending;
+        if (time)
+            *time = slots[i].time;
+        cb = std::move (slots[i].cb);
+        release (slots[i]);
+        --count;
+
+        // Shift back the following entries that aren't in their
+        // home slot, so no tombstones are needed.
+        for (auto j = (i+1) & mask; slots[j].serial!=0 && distance(j)>0; j = (j+1) & mask) {
+            move_slot (slots[i], slots[j]);
+            i = j;
+        }
+        return true;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void pending_call_table::clear ()
+    {
+        for (auto& slot : slots) {
+            if (slot.serial == 0)
+                continue;
+            if (slot.pending)
+                dbus_pending_call_unref (slot.pending);
+            release (slot);
+        }
+        count = 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void pending_call_table::take_all (std::vector<callback_t>& callbacks)
+    {
+        callbacks.reserve (callbacks.size() + count);
+        for (auto& slot : slots) {
+            if (slot.serial == 0)
+                continue;
+            if (slot.pending) {
+                dbus_pending_call_cancel (slot.pending);
+                dbus_pending_call_unref (slot.pending);
+            }
+            callbacks.emplace_back (std::move(slot.cb));
+            release (slot);
+        }
+        count = 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::size_t pending_call_table::find (uint32_t serial) const
+    {
+        if (serial == 0)
+            return npos;
+
+        // Robin Hood ordering, the search can stop as soon as we
+        // pass an entry that is closer to its home slot than the
+        // entry we are looking for would be.
+        std::size_t dist = 0;
+        for (auto i = serial & mask; ; i = (i+1) & mask, ++dist) {
+            if (slots[i].serial == serial)
+                return i;
+            if (slots[i].serial == 0 || distance(i) < dist)
+                return npos;
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void pending_call_table::place (slot_t& entry)
+    {
+        // Robin Hood insertion, an entry far from its home slot
+        // takes the place of an entry closer to its home slot.
+        std::size_t dist = 0;
+        for (auto i = entry.serial & mask; ; i = (i+1) & mask, ++dist) {
+            if (slots[i].serial == 0) {
+                move_slot (slots[i], entry);
+                return;
+            }
+            auto d = distance (i);
+            if (d < dist) {
+                slot_t tmp;
+                move_slot (tmp, slots[i]);
+                move_slot (slots[i], entry);
+                move_slot (entry, tmp);
+                dist = d;
+            }
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void pending_call_table::move_slot (slot_t& dst, slot_t& src)
+    {
+        dst.serial = src.serial;
+        dst.pending = src.pending;
+        dst.time = src.time;
+        dst.cb = std::move (src.cb);
+        release (src);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void pending_call_table::release (slot_t& slot)
+    {
+        slot.cb = nullptr;
+        slot.pending = nullptr;
+        slot.time = 0;
+        slot.serial = 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void pending_call_table::grow ()
+    {
+        std::vector<slot_t> old (slots.size() * 2);
+        old.swap (slots);
+        mask = slots.size() - 1;
+
+        for (auto& entry : old) {
+            if (entry.serial != 0)
+                place (entry);
+        }
+    }
+
+
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_PENDING_CALL_TABLE_HPP
+#define ULTRABUS_PENDING_CALL_TABLE_HPP
+
+#include <ultrabus/Message.hpp>
+#include <ultrabus/inplace_function.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <dbus/dbus.h>
+
+
+namespace ultrabus {
+
+
+    /**
+     * Table of pending method calls waiting for a reply.
+     * The table is an open addressed hash table with linear
+     * probing and Robin Hood ordering, keyed by the serial number
+     * of the method call message. Serial numbers are handed out
+     * in sequence by libdbus, so the serial number itself is used
+     * as hash value.<br/>
+     * The slots, including the reply callbacks, are preallocated.
+     * The table only allocates memory when it needs to grow,
+     * or when a reply callback doesn't fit in the small buffer
+     * of <code>callback_t</code>.<br/>
+     * The table is not thread safe.
+     */
+    class pending_call_table {
+    public:
+        /**
+         * Callback called with the message reply.
+         */
+        using callback_t = inplace_function<void (Message&)>;
+
+        /**
+         * Constructor.
+         * @param initial_size The initial number of slots in the table.
+         *                     Rounded up to the nearest power of two.
+         */
+        explicit pending_call_table (std::size_t initial_size=256);
+
+        /**
+         * Destructor.
+         * Pending calls left in the table are released.
+         */
+        ~pending_call_table ();
+
+        pending_call_table (const pending_call_table&) = delete;
+        pending_call_table& operator= (const pending_call_table&) = delete;
+
+        /**
+         * Add a pending call.
+         * The table takes over the caller's reference to the pending call.
+         * @param serial The serial number of the method call message.
+         * @param pending The pending call.
+         * @param cb The callback to call with the message reply.
+         * @param time The time the method call was sent, in any
+         *             unit. Returned by <code>take()</code>.
+         * @return <code>false</code> if the serial number is 0 or
+         *         already in the table.
+         */
+        bool insert (uint32_t serial, DBusPendingCall* pending, callback_t&& cb, uint64_t time=0);
+
+        /**
+         * Remove a pending call from the table.
+         * The caller takes over the reference to the pending call.
+         * @param serial The serial number of the method call message.
+         * @param pending Set to the pending call.
+         * @param cb Set to the reply callback.
+         * @param time If not <code>nullptr</code>, set to the
+         *             time given to <code>insert()</code>.
+         * @return <code>false</code> if the serial number wasn't found.
+         */
+        bool take (uint32_t serial, DBusPendingCall*& pending, callback_t& cb, uint64_t* time=nullptr);
+
+        /**
+         * Remove all entries and release the pending calls.
+         * The callbacks are not called.
+         */
+        void clear ();
+
+        /**
+         * Remove all entries and cancel the pending calls.
+         * The reply callbacks are moved to <code>callbacks</code>,
+         * for the caller to call them with an error reply.
+         * @param callbacks The reply callbacks are added to this vector.
+         */
+        void take_all (std::vector<callback_t>& callbacks);
+
+        /**
+         * Return the number of pending calls in the table.
+         */
+        std::size_t size () const {
+            return count;
+        }
+
+        /**
+         * Return <code>true</code> if the table is empty.
+         */
+        bool empty () const {
+            return count == 0;
+        }
+
+
+    private:
+        struct slot_t {
+            uint32_t serial {0}; // 0 is an empty slot
+            DBusPendingCall* pending {nullptr};
+            uint64_t time {0};
+            callback_t cb;
+        };
+        static constexpr std::size_t npos = static_cast<std::size_t> (-1);
+
+        std::vector<slot_t> slots;
+        std::size_t mask;
+        std::size_t count;
+
+        // Distance from the home slot of the entry in slot i
+        std::size_t distance (std::size_t i) const {
+            return (i - (slots[i].serial & mask)) & mask;
+        }
+        std::size_t find (uint32_t serial) const;
+        void place (slot_t& entry);
+        void move_slot (slot_t& dst, slot_t& src);
+        void release (slot_t& slot);
+        void grow ();
+    };
+
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/thread_options.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <sched.h>
+#include <unistd.h>
+
+
+namespace ultrabus {
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int thread_options::apply (pthread_t thread, const std::string& name_suffix) const
+    {
+        int errnum = 0;
+
+        if (!cpus.empty()) {
+            auto num_cpus = std::max (cpu_count(), (unsigned) CPU_SETSIZE);
+            auto size = CPU_ALLOC_SIZE (num_cpus);
+            auto* set = CPU_ALLOC (num_cpus);
+            if (set) {
+                CPU_ZERO_S (size, set);
+                for (auto cpu : cpus)
+                    CPU_SET_S (cpu, size, set);
+                auto result = pthread_setaffinity_np (thread, size, set);
+                if (result)
+                    errnum = result;
+                CPU_FREE (set);
+            }else{
+                errnum = ENOMEM;
+            }
+        }
+
+        if (policy >= 0) {
+            sched_param param {};
+            param.sched_priority = priority;
+            auto result = pthread_setschedparam (thread, policy, &param);
+            if (result && !errnum)
+                errnum = result;
+        }
+
+        if (!name.empty()) {
+            // The kernel limits thread names to 15 characters
+            auto thread_name = name.substr (0, 15 - std::min(name_suffix.size(), (std::size_t)15));
+            thread_name += name_suffix;
+            auto result = pthread_setname_np (thread, thread_name.substr(0, 15).c_str());
+            if (result && !errnum)
+                errnum = result;
+        }
+
+        if (errnum) {
+            errno = errnum;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    int thread_options::current_cpu ()
+    {
+        return sched_getcpu ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    unsigned thread_options::cpu_count ()
+    {
+        auto n = sysconf (_SC_NPROCESSORS_CONF);
+        return n > 0 ? (unsigned) n : 1;
+    }
+
+
+}
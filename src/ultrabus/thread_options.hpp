@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_THREAD_OPTIONS_HPP
+#define ULTRABUS_THREAD_OPTIONS_HPP
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+namespace ultrabus {
+
+
+    /**
+     * CPU affinity, scheduling policy and name of a thread.
+     * Used for the thread running the I/O handler of a connection,
+     * and for the worker threads of a WorkerPool.
+     * <pre>
+     * ultrabus::thread_options opts;
+     * opts.cpus = {2, 3};
+     * opts.policy = SCHED_FIFO;
+     * opts.priority = 10;
+     * opts.name = "dbus-io";
+     * conn.io_thread_options (opts);
+     * </pre>
+     * Settings left at their default values are not changed.
+     * Real-time scheduling policies need the CAP_SYS_NICE
+     * capability, or a suitable RLIMIT_RTPRIO.
+     */
+    struct thread_options {
+        /**
+         * CPU cores the thread may run on.
+         * If empty, the CPU affinity is not changed.
+         */
+        std::vector<unsigned> cpus;
+
+        /**
+         * Scheduling policy, like <code>SCHED_OTHER</code>,
+         * <code>SCHED_FIFO</code> or <code>SCHED_RR</code>.
+         * If -1, the scheduling policy is not changed.
+         */
+        int policy {-1};
+
+        /**
+         * Scheduling priority, used with the scheduling policy.
+         * Must be 0 for <code>SCHED_OTHER</code> and
+         * <code>SCHED_BATCH</code>.
+         */
+        int priority {0};
+
+        /**
+         * Thread name, truncated to 15 characters.
+         * If empty, the name is not changed.
+         */
+        std::string name;
+
+        /**
+         * Return true if no settings are changed.
+         */
+        bool empty () const {
+            return cpus.empty() && policy < 0 && name.empty();
+        }
+
+        /**
+         * Apply the settings to a thread.
+         * All settings are tried even if one of them fails.
+         * @param thread The thread to change.
+         * @param name_suffix Appended to the thread name, if the
+         *                    name is set, like the index of a worker
+         *                    thread. The name is shortened to keep
+         *                    the suffix within 15 characters.
+         * @return 0 on success, -1 on failure
+         *         and <code>errno</code> is set.
+         */
+        int apply (pthread_t thread, const std::string& name_suffix="") const;
+
+        /**
+         * Apply the settings to the calling thread.
+         * @return 0 on success, -1 on failure
+         *         and <code>errno</code> is set.
+         */
+        int apply () const {
+            return apply (pthread_self());
+        }
+
+        /**
+         * Return the CPU core the calling thread is running on,
+         * or -1 if unknown.
+         */
+        static int current_cpu ();
+
+        /**
+         * Return the number of configured CPU cores,
+         * one more than the highest CPU number.
+         */
+        static unsigned cpu_count ();
+    };
+
+
+}
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/timer_wheel.hpp>
+
+
+namespace ultrabus {
+
+
+    //--------------------------------------------------------------------------
+    // Rotate right
+    //--------------------------------------------------------------------------
+    static inline uint64_t rotr (uint64_t value, unsigned n)
+    {
+        n &= 63;
+        return n ? (value >> n) | (value << (64 - n)) : value;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    timer_wheel::timer_wheel (uint64_t now)
+        : current (now),
+          count (0)
+    {
+        for (auto& head : heads)
+            head.prev = head.next = &head;
+        for (auto& bits : bitmap)
+            bits = 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    timer_wheel::~timer_wheel ()
+    {
+        clear ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void timer_wheel::add (entry& e, uint64_t expires)
+    {
+        if (e.active())
+            unlink (e);
+        else
+            ++count;
+        e.when = expires;
+        place (e);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void timer_wheel::cancel (entry& e)
+    {
+        if (e.active()) {
+            unlink (e);
+            --count;
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void timer_wheel::advance (uint64_t now)
+    {
+        while (current < now) {
+            auto t = next_event ();
+            if (t > now) {
+                current = now;
+                break;
+            }
+            current = t;
+
+            // Move timers down from higher levels, highest first
+            for (unsigned level=levels-1; level>0; --level) {
+                if ((current & ((1ULL << (slot_bits*level)) - 1)) == 0)
+                    cascade (level);
+            }
+            expire_slot (current & (num_slots - 1));
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    timer_wheel::entry* timer_wheel::pop_expired ()
+    {
+        auto& head = heads[expired_slot];
+        if (head.next == &head)
+            return nullptr;
+        auto* e = head.next;
+        unlink (*e);
+        --count;
+        return e;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    uint64_t timer_wheel::next_expiry () const
+    {
+        auto& head = heads[expired_slot];
+        if (head.next != &head)
+            return current;
+        return next_event ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void timer_wheel::clear ()
+    {
+        for (auto& head : heads) {
+            while (head.next != &head) {
+                auto* e = head.next;
+                head.next = e->next;
+                e->prev = e->next = nullptr;
+            }
+            head.prev = &head;
+        }
+        for (auto& bits : bitmap)
+            bits = 0;
+        count = 0;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Put a timer in the level and slot given by its expiry time
+    // relative to the current time. Level 0 holds timers expiring
+    // in the current 64 tick period, level n (n > 0) holds timers
+    // 1 to 64 periods of 64^n ticks ahead.
+    //--------------------------------------------------------------------------
+    void timer_wheel::place (entry& e)
+    {
+        if (e.when <= current) {
+            link (e, expired_slot);
+            return;
+        }
+        if ((e.when >> slot_bits) == (current >> slot_bits)) {
+            link (e, e.when & (num_slots - 1));
+            return;
+        }
+        for (unsigned level=1; level<levels; ++level) {
+            auto shift = slot_bits * level;
+            if ((e.when >> shift) - (current >> shift) <= num_slots) {
+                link (e, level*num_slots + ((e.when >> shift) & (num_slots - 1)));
+                return;
+            }
+        }
+        // Out of range, keep it in the last slot of the highest
+        // level until it can be placed in a lower level.
+        auto shift = slot_bits * (levels - 1);
+        link (e, (levels-1)*num_slots + ((current >> shift) & (num_slots - 1)));
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void timer_wheel::link (entry& e, unsigned slot)
+    {
+        auto& head = heads[slot];
+        e.slot = slot;
+        e.prev = head.prev;
+        e.next = &head;
+        head.prev->next = &e;
+        head.prev = &e;
+        if (slot != expired_slot)
+            bitmap[slot / num_slots] |= 1ULL << (slot % num_slots);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void timer_wheel::unlink (entry& e)
+    {
+        e.prev->next = e.next;
+        e.next->prev = e.prev;
+        if (e.slot != expired_slot) {
+            auto& head = heads[e.slot];
+            if (head.next == &head)
+                bitmap[e.slot / num_slots] &= ~(1ULL << (e.slot % num_slots));
+        }
+        e.prev = e.next = nullptr;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Move the timers in the current slot of a level to lower levels
+    //--------------------------------------------------------------------------
+    void timer_wheel::cascade (unsigned level)
+    {
+        auto slot = level*num_slots + ((current >> (slot_bits*level)) & (num_slots - 1));
+        auto& head = heads[slot];
+        if (head.next == &head)
+            return;
+
+        // Detach the list before placing the timers, a timer out
+        // of range may be placed in the same slot again
+        auto* e = head.next;
+        head.prev->next = nullptr;
+        head.prev = head.next = &head;
+        bitmap[level] &= ~(1ULL << (slot % num_slots));
+
+        while (e) {
+            auto* next = e->next;
+            place (*e);
+            e = next;
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void timer_wheel::expire_slot (unsigned slot)
+    {
+        auto& head = heads[slot];
+        if (head.next == &head)
+            return;
+
+        // Append the whole list to the expired list
+        auto& expired = heads[expired_slot];
+        for (auto* e=head.next; e!=&head; e=e->next)
+            e->slot = expired_slot;
+        head.next->prev = expired.prev;
+        expired.prev->next = head.next;
+        head.prev->next = &expired;
+        expired.prev = head.prev;
+        head.prev = head.next = &head;
+        bitmap[0] &= ~(1ULL << slot);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // Return the next time a slot is to be expired or cascaded
+    //--------------------------------------------------------------------------
+    uint64_t timer_wheel::next_event () const
+    {
+        // Level 0 only holds timers in the current period,
+        // after the current time
+        auto pos = current & (num_slots - 1);
+        auto bits = pos == num_slots-1 ? 0 : bitmap[0] & (~0ULL << (pos + 1));
+        if (bits)
+            return (current & ~uint64_t(num_slots - 1)) | __builtin_ctzll (bits);
+
+        uint64_t next = no_expiry;
+        for (unsigned level=1; level<levels; ++level) {
+            if (!bitmap[level])
+                continue;
+            auto shift = slot_bits * level;
+            auto period = current >> shift;
+            // Number of periods ahead of the first non-empty slot, 1 to 64
+            auto ahead = __builtin_ctzll (rotr(bitmap[level], (period + 1) & (num_slots - 1))) + 1;
+            auto t = (period + ahead) << shift;
+            if (t < next)
+                next = t;
+        }
+        return next;
+    }
+
+
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_TIMER_WHEEL_HPP
+#define ULTRABUS_TIMER_WHEEL_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+
+namespace ultrabus {
+
+
+    /**
+     * Hierarchical timer wheel.
+     * Timers are intrusive list entries placed in one of four levels
+     * of 64 slots each, where a slot in level <em>n</em> covers
+     * 64<sup><em>n</em></sup> ticks. Adding and cancelling a timer
+     * is O(1) and doesn't allocate memory. Timers in higher levels
+     * are moved to lower levels as time advances. A bitmap of
+     * non-empty slots per level is used to find the next expiry
+     * time and to skip empty slots when advancing the time.<br/>
+     * The time unit is arbitrary, the connection uses milliseconds.
+     * Timers further in the future than 64<sup>4</sup> ticks are
+     * kept in the highest level until they are in range.<br/>
+     * The timer wheel is not thread safe.
+     */
+    class timer_wheel {
+    public:
+        /**
+         * Returned by <code>next_expiry()</code> when there are no timers.
+         */
+        static constexpr uint64_t no_expiry = UINT64_MAX;
+
+        /**
+         * A timer in the timer wheel.
+         * Normally used as a base class of an object that
+         * is to be notified when the timer expires.
+         */
+        struct entry {
+            entry () = default;
+            entry (const entry&) = delete;
+            entry& operator= (const entry&) = delete;
+
+            /**
+             * Return <code>true</code> if the timer
+             * is in a timer wheel, expired or not.
+             */
+            bool active () const {
+                return next != nullptr;
+            }
+
+            /**
+             * Return the expiry time of the timer.
+             */
+            uint64_t expires () const {
+                return when;
+            }
+
+        private:
+            friend class timer_wheel;
+            entry* prev {nullptr};
+            entry* next {nullptr};
+            uint64_t when {0};
+            unsigned slot {0};
+        };
+
+        /**
+         * Constructor.
+         * @param now The current time.
+         */
+        explicit timer_wheel (uint64_t now=0);
+
+        /**
+         * Destructor.
+         * Timers left in the timer wheel are removed.
+         */
+        ~timer_wheel ();
+
+        timer_wheel (const timer_wheel&) = delete;
+        timer_wheel& operator= (const timer_wheel&) = delete;
+
+        /**
+         * Add a timer.
+         * If the timer is already in the timer wheel, it is
+         * moved to the new expiry time.
+         * @param e The timer.
+         * @param expires The expiry time of the timer. If not later
+         *                than the current time of the timer wheel,
+         *                the timer is expired immediately.
+         */
+        void add (entry& e, uint64_t expires);
+
+        /**
+         * Remove a timer, expired or not.
+         * Nothing is done if the timer isn't in the timer wheel.
+         * @param e The timer.
+         */
+        void cancel (entry& e);
+
+        /**
+         * Advance the time of the timer wheel.
+         * Timers expiring up to, and including, the new time are
+         * moved to the list of expired timers.
+         * @param now The new time. Nothing is done if it is
+         *            earlier than the current time.
+         */
+        void advance (uint64_t now);
+
+        /**
+         * Remove and return the next expired timer.
+         * @return An expired timer, or <code>nullptr</code>
+         *         if no timer has expired.
+         */
+        entry* pop_expired ();
+
+        /**
+         * Return the time when the timer wheel next needs to
+         * be advanced. This is the expiry time of the next timer,
+         * or an earlier time when timers are to be moved to a
+         * lower level. If there are expired timers, the current
+         * time is returned.
+         * @return The time of the next event, or <code>no_expiry</code>
+         *         if the timer wheel is empty.
+         */
+        uint64_t next_expiry () const;
+
+        /**
+         * Return the current time of the timer wheel.
+         */
+        uint64_t now () const {
+            return current;
+        }
+
+        /**
+         * Return the number of timers in the timer wheel, expired or not.
+         */
+        std::size_t size () const {
+            return count;
+        }
+
+        /**
+         * Return <code>true</code> if the timer wheel is empty.
+         */
+        bool empty () const {
+            return count == 0;
+        }
+
+        /**
+         * Remove all timers.
+         */
+        void clear ();
+
+
+    private:
+        static constexpr unsigned levels      = 4;
+        static constexpr unsigned slot_bits   = 6;
+        static constexpr unsigned num_slots   = 1u << slot_bits;
+        static constexpr unsigned expired_slot = levels * num_slots;
+
+        entry heads[levels * num_slots + 1]; // The last one is the expired list
+        uint64_t bitmap[levels];             // Non-empty slots per level
+        uint64_t current;
+        std::size_t count;
+
+        void place (entry& e);
+        void link (entry& e, unsigned slot);
+        void unlink (entry& e);
+        void cascade (unsigned level);
+        void expire_slot (unsigned slot);
+        uint64_t next_event () const;
+    };
+
+
+}
+
+#endif
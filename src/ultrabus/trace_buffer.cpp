@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ultrabus/trace_buffer.hpp>
+#include <ultrabus/thread_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+namespace ultrabus {
+
+
+    std::atomic_bool trace_buffer::enabled_flag {false};
+
+
+    //--------------------------------------------------------------------------
+    // The ring buffer of a thread.
+    // Only the owning thread writes to the ring buffer. Readers copy
+    // the events and then check that the events weren't overwritten
+    // while they were copied.
+    //--------------------------------------------------------------------------
+    struct trace_ring {
+        trace_ring (std::size_t size, unsigned gen)
+            : records (new trace_record[size]),
+              mask (size - 1),
+              generation (gen),
+              tid ((uint32_t) syscall(SYS_gettid))
+        {
+        }
+
+        std::unique_ptr<trace_record[]> records;
+        std::size_t mask;
+        unsigned generation;
+        uint32_t tid;
+        std::atomic<uint64_t> head {0};   // Index of the next event
+        std::atomic<uint64_t> floor {0};  // Events before this index are cleared
+        std::atomic_bool retired {false}; // Not used by the thread anymore
+    };
+
+
+    //--------------------------------------------------------------------------
+    // All ring buffers. Allocated once and never freed, threads
+    // may record events while static objects are destroyed.
+    //--------------------------------------------------------------------------
+    struct trace_registry {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<trace_ring>> rings;
+        std::atomic<std::size_t> capacity {trace_buffer::default_capacity};
+        std::atomic<unsigned> generation {0};
+    };
+
+    static trace_registry& registry ()
+    {
+        static auto* r = new trace_registry;
+        return *r;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // The ring buffer of the current thread
+    //--------------------------------------------------------------------------
+    struct trace_ring_holder {
+        std::shared_ptr<trace_ring> ring;
+        ~trace_ring_holder () {
+            if (ring)
+                ring->retired = true;
+        }
+    };
+    static thread_local trace_ring_holder local_ring;
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    static trace_ring* thread_ring ()
+    {
+        auto& reg = registry ();
+        auto generation = reg.generation.load (std::memory_order_relaxed);
+        auto* ring = local_ring.ring.get ();
+        if (ring && ring->generation == generation)
+            return ring;
+
+        std::shared_ptr<trace_ring> new_ring;
+        try {
+            new_ring = std::make_shared<trace_ring> (reg.capacity.load(), generation);
+            std::lock_guard<std::mutex> lock (reg.mutex);
+            reg.rings.emplace_back (new_ring);
+        }
+        catch (std::bad_alloc&) {
+            return nullptr;
+        }
+        if (ring)
+            ring->retired = true;
+        local_ring.ring = std::move (new_ring);
+        return local_ring.ring.get ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void trace_buffer::write (trace_event event,
+                              const void* object,
+                              uint32_t serial,
+                              uint64_t arg)
+    {
+        auto* ring = thread_ring ();
+        if (!ring)
+            return;
+
+        auto i = ring->head.load (std::memory_order_relaxed);
+        auto& r = ring->records[i & ring->mask];
+        r.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count ();
+        r.object = object;
+        r.arg    = arg;
+        r.serial = serial;
+        r.tid    = ring->tid;
+        r.event  = event;
+        r.cpu    = (uint16_t) thread_options::current_cpu ();
+        ring->head.store (i + 1, std::memory_order_release);
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void trace_buffer::capacity (std::size_t events)
+    {
+        std::size_t size = 16;
+        while (size < events)
+            size <<= 1;
+        auto& reg = registry ();
+        reg.capacity = size;
+        ++reg.generation;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::size_t trace_buffer::capacity ()
+    {
+        return registry().capacity;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    std::vector<trace_record> trace_buffer::dump ()
+    {
+        std::vector<trace_record> result;
+        auto& reg = registry ();
+        std::lock_guard<std::mutex> lock (reg.mutex);
+
+        for (auto& ring : reg.rings) {
+            uint64_t size = ring->mask + 1;
+            uint64_t head = ring->head.load (std::memory_order_acquire);
+            uint64_t first = std::max (ring->floor.load(), head > size ? head - size : 0);
+            if (first >= head)
+                continue;
+
+            auto start = result.size ();
+            for (auto i=first; i<head; ++i)
+                result.push_back (ring->records[i & ring->mask]);
+
+            // Drop the events overwritten while they were copied
+            std::atomic_thread_fence (std::memory_order_acquire);
+            uint64_t new_head = ring->head.load (std::memory_order_relaxed);
+            if (new_head + 1 > first + size) {
+                auto overwritten = std::min (new_head + 1 - size - first, head - first);
+                result.erase (result.begin() + start, result.begin() + start + overwritten);
+            }
+        }
+
+        std::stable_sort (result.begin(), result.end(),
+                          [](const trace_record& a, const trace_record& b) {
+                              return a.time < b.time;
+                          });
+        return result;
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void trace_buffer::clear ()
+    {
+        auto& reg = registry ();
+        auto generation = reg.generation.load ();
+        std::lock_guard<std::mutex> lock (reg.mutex);
+
+        for (auto& ring : reg.rings)
+            ring->floor = ring->head.load ();
+
+        // Forget the ring buffers of exited threads, and old ring
+        // buffers replaced after a change of capacity.
+        reg.rings.erase (std::remove_if(reg.rings.begin(), reg.rings.end(),
+                                        [generation](std::shared_ptr<trace_ring>& ring) {
+                                            return ring->retired || ring->generation != generation;
+                                        }),
+                         reg.rings.end());
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    void trace_buffer::write_text (std::ostream& out)
+    {
+        auto records = dump ();
+        if (records.empty())
+            return;
+
+        auto base = records.front().time;
+        for (auto& r : records) {
+            out << (r.time - base) << ' '
+                << r.tid << ' '
+                << (r.cpu == 0xffff ? -1 : (int) r.cpu) << ' '
+                << name(r.event) << ' '
+                << r.object << ' '
+                << r.serial << ' '
+                << r.arg << '\n';
+        }
+        out.flush ();
+    }
+
+
+    //--------------------------------------------------------------------------
+    //--------------------------------------------------------------------------
+    const char* trace_buffer::name (trace_event event)
+    {
+        switch (event) {
+        case trace_event::connect:         return "connect";
+        case trace_event::disconnect:      return "disconnect";
+        case trace_event::send:            return "send";
+        case trace_event::send_with_reply: return "send_with_reply";
+        case trace_event::reply:           return "reply";
+        case trace_event::wakeup:          return "wakeup";
+        case trace_event::dispatch_begin:  return "dispatch_begin";
+        case trace_event::dispatch_end:    return "dispatch_end";
+        case trace_event::watch_rx:        return "watch_rx";
+        case trace_event::watch_tx:        return "watch_tx";
+        case trace_event::watch_add:       return "watch_add";
+        case trace_event::watch_remove:    return "watch_remove";
+        case trace_event::timeout_add:     return "timeout_add";
+        case trace_event::timeout_remove:  return "timeout_remove";
+        case trace_event::timeout:         return "timeout";
+        case trace_event::match_add:       return "match_add";
+        case trace_event::match_remove:    return "match_remove";
+        case trace_event::error:           return "error";
+        case trace_event::listen:          return "listen";
+        case trace_event::accept:          return "accept";
+        }
+        return "unknown";
+    }
+
+
+}
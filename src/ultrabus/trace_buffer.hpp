@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2023 Dan Arrhenius <dan@ultramarin.se>
+ *
+ * This file is part of libultrabus.
+ *
+ * libultrabus is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ULTRABUS_TRACE_BUFFER_HPP
+#define ULTRABUS_TRACE_BUFFER_HPP
+
+#include <atomic>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace ultrabus {
+
+
+    /**
+     * Type of a trace event.
+     */
+    enum class trace_event : uint16_t {
+        connect,         /**< Connected, <code>arg</code> is 1 for a loopback connection. */
+        disconnect,      /**< Disconnected. */
+        send,            /**< A message without reply was handed to the transport,
+                              <code>arg</code> is the message type. */
+        send_with_reply, /**< A method call was handed to the transport,
+                              <code>arg</code> is the reply timeout in milliseconds,
+                              as given to <code>send()</code>. */
+        reply,           /**< A reply to a method call was received, the serial is the
+                              serial of the method call, <code>arg</code> is the message type. */
+        wakeup,          /**< The I/O handler was woken up by another thread. */
+        dispatch_begin,  /**< Start of a dispatch pass. */
+        dispatch_end,    /**< End of a dispatch pass, <code>arg</code> is the number
+                              of dispatched messages. */
+        watch_rx,        /**< A socket is readable, <code>arg</code> is the file descriptor. */
+        watch_tx,        /**< A socket is writable, <code>arg</code> is the file descriptor. */
+        watch_add,       /**< A watch was added, <code>arg</code> is the file descriptor. */
+        watch_remove,    /**< A watch was removed, <code>arg</code> is the file descriptor. */
+        timeout_add,     /**< A timeout was set, <code>arg</code> is the interval in milliseconds. */
+        timeout_remove,  /**< A timeout was removed. */
+        timeout,         /**< A timeout expired. For a pending call on a loopback
+                              connection, the serial is the serial of the method call. */
+        match_add,       /**< A message handler added a match rule. */
+        match_remove,    /**< A message handler removed a match rule. */
+        error,           /**< A system call failed, <code>arg</code> is the errno value. */
+        listen,          /**< A server started to listen for connections. */
+        accept           /**< A server got a new connection, <code>arg</code> is
+                              the file descriptor, or -1 if not known. */
+    };
+
+
+    /**
+     * A trace event.
+     */
+    struct trace_record {
+        uint64_t    time;   /**< Time in nanoseconds of the monotonic clock. */
+        const void* object; /**< The object tracing the event, like a Connection. */
+        uint64_t    arg;    /**< Event specific argument. */
+        uint32_t    serial; /**< Message serial number, 0 if not applicable. */
+        uint32_t    tid;    /**< Id of the thread tracing the event. */
+        trace_event event;  /**< The type of event. */
+        uint16_t    cpu;    /**< CPU core running the thread, 0xffff if unknown. */
+    };
+
+
+    /**
+     * Runtime trace of connection events.
+     * Each thread records events in its own ring buffer, without
+     * locks or memory allocation once the buffer is allocated.
+     * When a ring buffer is full, the oldest events are overwritten.
+     * Tracing is disabled by default, a disabled trace costs a
+     * relaxed atomic load per event.
+     * <pre>
+     * ultrabus::trace_buffer::enable ();
+     * ...
+     * ultrabus::trace_buffer::write_text (std::cerr);
+     * </pre>
+     * All methods are static and thread safe.
+     */
+    class trace_buffer {
+    public:
+        /**
+         * Default number of events in the ring buffer of each thread.
+         */
+        static constexpr std::size_t default_capacity = 4096;
+
+        /**
+         * Enable or disable tracing.
+         */
+        static void enable (bool on=true) {
+            enabled_flag.store (on, std::memory_order_relaxed);
+        }
+
+        /**
+         * Disable tracing.
+         */
+        static void disable () {
+            enable (false);
+        }
+
+        /**
+         * Return <code>true</code> if tracing is enabled.
+         */
+        static bool enabled () {
+            return enabled_flag.load (std::memory_order_relaxed);
+        }
+
+        /**
+         * Set the number of events in the ring buffer of each thread.
+         * Threads allocate a new ring buffer the next time they
+         * record an event, events in the old buffers are kept
+         * until <code>clear()</code> is called.
+         * @param events The number of events, rounded up to
+         *               the nearest power of two.
+         */
+        static void capacity (std::size_t events);
+
+        /**
+         * Return the number of events in the ring buffer of each thread.
+         */
+        static std::size_t capacity ();
+
+        /**
+         * Record an event, if tracing is enabled.
+         * @param event The type of event.
+         * @param object The object tracing the event.
+         * @param serial Message serial number, or 0.
+         * @param arg Event specific argument.
+         */
+        static void record (trace_event event,
+                            const void* object,
+                            uint32_t serial=0,
+                            uint64_t arg=0)
+        {
+            if (enabled())
+                write (event, object, serial, arg);
+        }
+
+        /**
+         * Return a copy of the recorded events of all threads,
+         * sorted by time. Events are not removed from the ring buffers.
+         */
+        static std::vector<trace_record> dump ();
+
+        /**
+         * Remove all recorded events.
+         */
+        static void clear ();
+
+        /**
+         * Write the recorded events as text, one event per line:<br/>
+         * <code>time tid cpu event object serial arg</code><br/>
+         * Times are in nanoseconds relative to the first event.
+         * @param out The output stream.
+         */
+        static void write_text (std::ostream& out);
+
+        /**
+         * Return the name of an event type.
+         */
+        static const char* name (trace_event event);
+
+
+    private:
+        static std::atomic_bool enabled_flag;
+        static void write (trace_event event,
+                           const void* object,
+                           uint32_t serial,
+                           uint64_t arg);
+    };
+
+
+}
+
+#endif
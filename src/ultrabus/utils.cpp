@@ -87,8 +87,7 @@ namespace ultrabus {
     dbus_type_ptr clone_dbus_type (dbus_type&& mt)
     {
         if (typeid(mt) == typeid(dbus_basic)) {
-            //return std::make_shared<dbus_basic> (std::forward<dbus_basic>(dynamic_cast<dbus_basic&&>(mt)));
-            return std::make_shared<dbus_basic> (std::forward<dbus_basic>(mt));
+            return std::make_shared<dbus_basic> (dynamic_cast<dbus_basic&&>(mt));
         }
         else if (typeid(mt) == typeid(dbus_struct)) {
             return std::make_shared<dbus_struct> (dynamic_cast<dbus_struct&&>(mt));